@@ -0,0 +1,603 @@
+// Replays recorded or generated input through the bridge core on the
+// simulated platform, reports throughput and latency and compares the
+// keyboard reports with a golden run.
+//
+//   bridge_replay [options] TRACE           replay a trace read from a bridge
+//   bridge_replay [options] --gen NAME      replay generated input
+//   bridge_replay --dump PORT [--baud N]    read the trace of a bridge to stdout
+//
+//   --gen NAME        burst: characters back to back, typing: characters with
+//                     human-like gaps, lines: lines spread over the input channels
+//   --count N         characters to generate (2000)
+//   --seed N          generator seed (1)
+//   --baud N          UART baud rate (115200)
+//   --interval-us N   HID endpoint poll interval (5000)
+//   --layout NAME     keypad, us, fi or de (us)
+//   --timing NAME     fast, safe or legacy (fast)
+//   --pack N          keys packed per report (HID_PACK_MAX)
+//   --boot            host uses the boot protocol
+//   --flow            sender honours RTS/CTS flow control
+//   --save FILE       write the input and the reports of this run as a trace
+//   --trace FILE      write the trace the bridge core recorded during the run
+//   --golden FILE     compare the reports with those of a trace, one saved
+//                     with --save or the trace that is replayed
+//
+// The options must match the bridge the trace was read from. A trace is
+// text with one entry per line, times in us:
+//   <time> rx <channel> <byte>            byte received, in hex
+//   <time> report <modifier> <key>...     keyboard report submitted, in hex
+// Lines starting with # are comments. Exits with 0 when the reports match
+// the golden trace, or when there is none.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bridge.h"
+#include "cobs.h"
+#include "config_store.h"
+#include "crc16.h"
+#include "hid_engine.h"
+#include "keymap.h"
+#include "latency.h"
+#include "log.h"
+#include "protocol.h"
+#include "sim_hal.h"
+#include "sim_keyboard.h"
+#include "trace.h"
+#include "usb_descriptors.h"
+
+// Simulation time step
+#define SIM_TICK_US 10
+
+// Give up when the bridge has not finished this long after the last input byte
+#define SIM_TIMEOUT_US 60000000ull
+
+// Wait for a reply from a real bridge
+#define DUMP_REPLY_TIMEOUT_MS 1000
+
+typedef struct {
+    uint64_t time_us;
+    bool report;
+    uint8_t arg;                // Channel, or modifier of a report
+    std::vector<uint8_t> data;  // The byte, or the keys of a report
+} trace_line_t;
+
+static keymap_layout_t parse_layout(const char *name) {
+    if (!strcmp(name, "keypad")) return LAYOUT_KEYPAD;
+    if (!strcmp(name, "fi")) return LAYOUT_FI;
+    if (!strcmp(name, "de")) return LAYOUT_DE;
+    return LAYOUT_US;
+}
+
+static hid_timing_t parse_timing(const char *name) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    hid_timing_t safe = HID_TIMING_SAFE;
+    hid_timing_t legacy = HID_TIMING_LEGACY;
+    if (!strcmp(name, "safe")) return safe;
+    if (!strcmp(name, "legacy")) return legacy;
+    return fast;
+}
+
+static void print_line(FILE *f, const trace_line_t &line) {
+    if (line.report) {
+        fprintf(f, "%llu report %02X", (unsigned long long)line.time_us, line.arg);
+        for (uint8_t key : line.data) fprintf(f, " %02X", key);
+    } else {
+        fprintf(f, "%llu rx %u %02X", (unsigned long long)line.time_us, line.arg, line.data[0]);
+    }
+    fprintf(f, "\n");
+}
+
+// Reads a trace file, times from a bridge are unwrapped to 64 bits
+static bool load_trace(const char *path, std::vector<trace_line_t> &lines) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char buf[256];
+    uint64_t last = 0;
+    uint64_t wraps = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        if (buf[0] == '#' || buf[0] == '\n') continue;
+        char *p = buf;
+        uint64_t raw = strtoull(p, &p, 10);
+        // The bridge records 32 bit times, they wrap every 71 minutes
+        if (raw < last && last - raw > 0x80000000ull) wraps += 0x100000000ull;
+        last = raw;
+        uint64_t time = raw + wraps;
+
+        trace_line_t line = { time, false, 0, {} };
+        while (*p == ' ') p++;
+        if (!strncmp(p, "report", 6)) {
+            line.report = true;
+            line.arg = strtoul(p + 6, &p, 16);
+            for (;;) {
+                char *end;
+                unsigned long key = strtoul(p, &end, 16);
+                if (end == p) break;
+                line.data.push_back(key);
+                p = end;
+            }
+        } else if (!strncmp(p, "rx", 2)) {
+            line.arg = strtoul(p + 2, &p, 10);
+            line.data.push_back(strtoul(p, &p, 16));
+            if (line.arg >= HAL_UART_CHANNELS) continue;
+        } else {
+            continue;
+        }
+        lines.push_back(line);
+    }
+    fclose(f);
+    return true;
+}
+
+// Deterministic pseudo random numbers, so a seed always gives the same input
+static uint32_t gen_state = 1;
+
+static uint32_t gen_next(void) {
+    gen_state = gen_state * 1103515245u + 12345u;
+    return gen_state >> 8;
+}
+
+// Printable characters the layout can type
+static std::vector<uint8_t> typable_chars(void) {
+    std::vector<uint8_t> chars;
+    for (int ch = ' '; ch < 0x7F; ch++) {
+        if (keymap_lookup(ch).keycode) chars.push_back(ch);
+    }
+    return chars;
+}
+
+static bool generate(const char *name, size_t count, std::vector<trace_line_t> &lines) {
+    std::vector<uint8_t> chars = typable_chars();
+    if (chars.empty()) return false;
+    bool burst = !strcmp(name, "burst");
+    bool typing = !strcmp(name, "typing");
+    bool spread = !strcmp(name, "lines");
+    if (!burst && !typing && !spread) {
+        fprintf(stderr, "unknown generator %s\n", name);
+        return false;
+    }
+
+    uint64_t time = 0;
+    uint8_t channel = 0;
+    size_t line_left = 10 + gen_next() % 50;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t ch = chars[gen_next() % chars.size()];
+        if (--line_left == 0) {
+            ch = '\n';
+            line_left = 10 + gen_next() % 50;
+        }
+        if (typing) {
+            // 40 to 200 ms between keys with a longer pause now and then
+            time += 40000 + gen_next() % 160000;
+            if (gen_next() % 50 == 0) time += 1000000;
+        }
+        lines.push_back({ time, false, channel, { ch } });
+        // All lines are sent at once, each channel sends its own back to back
+        if (spread && ch == '\n') channel = (channel + 1) % HAL_UART_CHANNELS;
+    }
+    return true;
+}
+
+// Keyboard reports as the host read them
+static std::vector<trace_line_t> sim_report_lines(void) {
+    std::vector<trace_line_t> lines;
+    for (const sim_report_t &r : sim_reports()) {
+        if (r.instance != HID_INSTANCE_KEYBOARD || r.data.empty()) continue;
+        lines.push_back({ r.time_us, true, r.data[0], sim_report_keys(r.data) });
+    }
+    return lines;
+}
+
+// Turns report lines back into host reports, for decoding them to text
+static std::vector<sim_report_t> to_sim_reports(const std::vector<trace_line_t> &lines) {
+    std::vector<sim_report_t> reports;
+    for (const trace_line_t &line : lines) {
+        if (!line.report) continue;
+        sim_report_t r = { line.time_us, HID_INSTANCE_KEYBOARD, 0, {} };
+        if (line.data.size() <= HID_BOOT_KEYS) {
+            r.data.assign(8, 0);
+            std::copy(line.data.begin(), line.data.end(), r.data.begin() + 2);
+        } else {
+            r.data.assign(HID_NKRO_REPORT_LEN, 0);
+            for (uint8_t key : line.data) {
+                if (key < HID_NKRO_KEYS) r.data[1 + key / 8] |= 1 << (key % 8);
+            }
+        }
+        r.data[0] = line.arg;
+        reports.push_back(r);
+    }
+    return reports;
+}
+
+// Runs the input through the bridge until it has typed everything
+static bool run(const std::vector<trace_line_t> &input, const sim_config_t *config) {
+    uint64_t base = UINT64_MAX;
+    for (const trace_line_t &line : input) {
+        if (!line.report) base = std::min(base, line.time_us);
+    }
+    // Recorded times are arrivals, the byte started a byte time earlier
+    uint64_t byte_us = 10000000ull / config->baud_rate;
+    for (const trace_line_t &line : input) {
+        if (line.report) continue;
+        uint64_t start = line.time_us - base;
+        sim_uart_send_channel_at(line.arg, start > byte_us ? start - byte_us : 0, line.data[0]);
+    }
+
+    uint64_t input_end = 0;
+    while (sim_uart_busy() || !hid_engine_idle()) {
+        sim_advance(SIM_TICK_US);
+        bridge_uart_task();
+        bridge_hid_task();
+        if (sim_uart_busy()) input_end = sim_now();
+        if (sim_now() - input_end > SIM_TIMEOUT_US) {
+            fprintf(stderr, "bridge did not finish\n");
+            return false;
+        }
+    }
+    sim_advance(config->poll_interval_us);
+    return true;
+}
+
+static void print_results(size_t input_bytes) {
+    hid_engine_stats_t stats;
+    hid_engine_get_stats(&stats);
+    const std::vector<sim_report_t> &reports = sim_reports();
+    double seconds = reports.empty() ? 0 : reports.back().time_us / 1e6;
+    printf("bytes %zu  keys %u  reports %u  time %.3f s  %.1f keys/s  overruns %u\n",
+        input_bytes, stats.keys, stats.reports, seconds,
+        seconds > 0 ? stats.keys / seconds : 0.0, sim_uart_overruns());
+
+    static const char *const stage_names[LAT_STAGE_COUNT] = { "parse", "pacing", "usb", "total" };
+    for (uint8_t i = 0; i < LAT_STAGE_COUNT; i++) {
+        latency_hist_t hist;
+        latency_get((latency_stage_t)i, &hist);
+        printf("latency %-6s  min %u  mean %u  p50 <=%u  p90 <=%u  p99 <=%u  max %u us\n", stage_names[i],
+            hist.min_us, hist.count ? (uint32_t)(hist.sum_us / hist.count) : 0,
+            latency_percentile(&hist, 50), latency_percentile(&hist, 90),
+            latency_percentile(&hist, 99), hist.max_us);
+    }
+}
+
+// Time from the first entry to the last report
+static double report_seconds(const std::vector<trace_line_t> &lines, uint64_t first) {
+    uint64_t last = 0;
+    for (const trace_line_t &line : lines) {
+        first = std::min(first, line.time_us);
+        if (line.report) last = std::max(last, line.time_us);
+    }
+    return last > first ? (last - first) / 1e6 : 0;
+}
+
+// Compares the key state of each report, then the text the host typed
+static bool compare(const std::vector<trace_line_t> &golden_lines, const std::vector<trace_line_t> &typed) {
+    std::vector<trace_line_t> golden;
+    for (const trace_line_t &line : golden_lines) {
+        if (line.report) golden.push_back(line);
+    }
+    double golden_s = report_seconds(golden_lines, UINT64_MAX);
+    double typed_s = report_seconds(typed, 0);
+    printf("golden  reports %zu  time %.3f s  this run  reports %zu  time %.3f s", golden.size(), golden_s,
+        typed.size(), typed_s);
+    if (golden_s > 0) printf("  (%+.1f%%)", (typed_s / golden_s - 1) * 100);
+    printf("\n");
+
+    // NKRO reports list their keys by usage, so the order is not compared
+    size_t i = 0;
+    for (; i < golden.size() && i < typed.size(); i++) {
+        std::vector<uint8_t> a = golden[i].data, b = typed[i].data;
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        if (golden[i].arg != typed[i].arg || a != b) break;
+    }
+    bool same = i == golden.size() && i == typed.size();
+    if (!same) {
+        printf("reports differ from report %zu\n", i);
+        if (i < golden.size()) { printf("  golden:   "); print_line(stdout, golden[i]); }
+        if (i < typed.size()) { printf("  this run: "); print_line(stdout, typed[i]); }
+    }
+
+    std::string golden_text = sim_keyboard_decode(to_sim_reports(golden), HID_INSTANCE_KEYBOARD);
+    std::string typed_text = sim_keyboard_decode(to_sim_reports(typed), HID_INSTANCE_KEYBOARD);
+    if (golden_text != typed_text) {
+        size_t pos = 0;
+        while (pos < golden_text.size() && pos < typed_text.size() && golden_text[pos] == typed_text[pos]) pos++;
+        size_t from = pos > 20 ? pos - 20 : 0;
+        printf("text differs at character %zu\n  golden:   ...%s\n  this run: ...%s\n", pos,
+            golden_text.substr(from, 40).c_str(), typed_text.substr(from, 40).c_str());
+    }
+    return same;
+}
+
+// Turns trace entries read from a bridge into lines. A report spans
+// several entries, the decoder keeps the one being collected.
+typedef struct {
+    trace_line_t report;
+    size_t keys_left;
+} entry_decoder_t;
+
+static void decode_entry(entry_decoder_t *dec, const trace_entry_t &e, std::vector<trace_line_t> &lines) {
+    switch (e.type) {
+        case TRACE_RX:
+            lines.push_back({ e.time_us, false, e.arg, { e.data[0] } });
+            return;
+        case TRACE_REPORT:
+            dec->report = { e.time_us, true, e.arg, {} };
+            dec->keys_left = e.data[0];
+            if (dec->keys_left) {
+                dec->report.data.push_back(e.data[1]);
+                dec->keys_left--;
+            }
+            break;
+        case TRACE_KEYS: {
+            const uint8_t keys[TRACE_KEYS_PER_ENTRY] = { e.arg, e.data[0], e.data[1] };
+            for (uint8_t k = 0; k < TRACE_KEYS_PER_ENTRY && dec->keys_left; k++, dec->keys_left--) {
+                dec->report.data.push_back(keys[k]);
+            }
+            break;
+        }
+        default:
+            return;
+    }
+    if (dec->keys_left == 0) lines.push_back(dec->report);
+}
+
+// Writes what the bridge core traced during a run, the way --dump would
+static bool save_core_trace(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    entry_decoder_t dec = { { 0, true, 0, {} }, 0 };
+    trace_entry_t entries[64];
+    uint32_t lost;
+    size_t n;
+    while ((n = trace_read(entries, 64, &lost)) > 0 || lost) {
+        if (lost) fprintf(f, "# %u entries lost\n", lost);
+        std::vector<trace_line_t> lines;
+        for (size_t i = 0; i < n; i++) decode_entry(&dec, entries[i], lines);
+        for (const trace_line_t &line : lines) print_line(f, line);
+    }
+    fclose(f);
+    return true;
+}
+
+// Serial link to a real bridge, for --dump
+static int port_fd = -1;
+static uint8_t port_seq = 0;
+
+static speed_t baud_constant(uint32_t baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B115200;
+    }
+}
+
+static bool port_open(const char *path, uint32_t baud) {
+    port_fd = open(path, O_RDWR | O_NOCTTY);
+    if (port_fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct termios tio;
+    tcgetattr(port_fd, &tio);
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, baud_constant(baud));
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(port_fd, TCSANOW, &tio);
+    tcflush(port_fd, TCIOFLUSH);
+    return true;
+}
+
+// Reads one reply frame, returns its decoded length or 0 on a timeout or damage
+static size_t port_read_reply(uint8_t *reply) {
+    uint8_t encoded[COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX)];
+    size_t len = 0;
+    struct pollfd pfd = { port_fd, POLLIN, 0 };
+    while (poll(&pfd, 1, DUMP_REPLY_TIMEOUT_MS) > 0) {
+        uint8_t ch;
+        if (read(port_fd, &ch, 1) != 1) break;
+        if (ch != 0) {
+            if (len < sizeof(encoded)) encoded[len++] = ch;
+            continue;
+        }
+        if (len == 0) continue;
+        size_t n = cobs_decode(encoded, len, reply);
+        if (n >= 4 && crc16(reply, n - 2) == (reply[n - 2] | (reply[n - 1] << 8))) return n - 2;
+        len = 0;
+    }
+    return 0;
+}
+
+// Sends one frame and waits for its ACK, returns the reply data length or -1
+static int port_request(const std::vector<uint8_t> &records, uint8_t *data) {
+    for (int attempt = 0; attempt < 3; attempt++) {
+        std::vector<uint8_t> frame(1, port_seq);
+        frame.insert(frame.end(), records.begin(), records.end());
+        uint16_t crc = crc16(frame.data(), frame.size());
+        frame.push_back(crc & 0xFF);
+        frame.push_back(crc >> 8);
+        uint8_t out[COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX) + 2];
+        out[0] = 0;
+        size_t len = 1 + cobs_encode(frame.data(), frame.size(), &out[1]);
+        out[len++] = 0;
+        if (write(port_fd, out, len) != (ssize_t)len) return -1;
+
+        uint8_t reply[PROTO_FRAME_MAX];
+        size_t n = port_read_reply(reply);
+        if (n < 2) continue;
+        if (reply[1] == PROTO_NACK_SEQ && n > 2) {
+            // The bridge was already in framed mode, continue its sequence
+            port_seq = reply[2];
+            continue;
+        }
+        if (reply[0] != port_seq) continue;
+        port_seq++;
+        if (reply[1] != PROTO_ACK) {
+            fprintf(stderr, "bridge refused the request, status %u\n", reply[1]);
+            return -1;
+        }
+        memcpy(data, &reply[2], n - 2);
+        return n - 2;
+    }
+    fprintf(stderr, "no reply from the bridge\n");
+    return -1;
+}
+
+static bool set_trace(uint32_t value) {
+    uint8_t data[PROTO_FRAME_MAX];
+    std::vector<uint8_t> records = { CMD_CONFIG, 6, CONFIG_OP_SET, CONFIG_TRACE,
+        (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    return port_request(records, data) >= 0;
+}
+
+// Reads the whole trace of a bridge and prints it. Tracing is paused while
+// reading, so the dump does not record itself, and the bridge is left in text mode.
+static int dump(const char *path, uint32_t baud) {
+    if (!port_open(path, baud)) return 2;
+    uint8_t data[PROTO_FRAME_MAX];
+    std::vector<uint8_t> get = { CMD_CONFIG, 2, CONFIG_OP_GET, CONFIG_TRACE };
+    if (port_request(get, data) != 5) return 2;
+    uint32_t was_on = data[1];
+    if (was_on && !set_trace(0)) return 2;
+
+    entry_decoder_t dec = { { 0, true, 0, {} }, 0 };
+    uint32_t lost_total = 0;
+    for (;;) {
+        std::vector<uint8_t> query = { CMD_QUERY, 2, QUERY_TRACE, 0 };
+        int n = port_request(query, data);
+        if (n < 5) return 2;
+        uint32_t lost = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+        if (lost) printf("# %u entries lost\n", lost);
+        lost_total += lost;
+        uint8_t count = data[4];
+        if (count == 0) break;
+        std::vector<trace_line_t> lines;
+        for (uint8_t i = 0; i < count; i++) {
+            const uint8_t *e = &data[5 + i * 8];
+            trace_entry_t entry = { (uint32_t)(e[0] | (e[1] << 8) | (e[2] << 16) | ((uint32_t)e[3] << 24)),
+                e[4], e[5], { e[6], e[7] } };
+            decode_entry(&dec, entry, lines);
+        }
+        for (const trace_line_t &line : lines) print_line(stdout, line);
+    }
+    if (was_on) set_trace(1);
+    std::vector<uint8_t> text_mode = { CMD_SET_MODE, 1, 0 };
+    port_request(text_mode, data);
+    close(port_fd);
+    if (lost_total) fprintf(stderr, "%u entries were overwritten before they were read\n", lost_total);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    sim_config_t config = SIM_CONFIG_DEFAULT;
+    keymap_layout_t layout = LAYOUT_US;
+    hid_timing_t timing = HID_TIMING_FAST;
+    uint8_t pack = HID_PACK_MAX;
+    const char *gen = NULL;
+    const char *trace_path = NULL;
+    const char *dump_port = NULL;
+    const char *save_path = NULL;
+    const char *golden_path = NULL;
+    const char *core_trace_path = NULL;
+    size_t count = 2000;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : "";
+        if (!strcmp(arg, "--baud")) { config.baud_rate = atoi(val); i++; }
+        else if (!strcmp(arg, "--interval-us")) { config.poll_interval_us = atoi(val); i++; }
+        else if (!strcmp(arg, "--layout")) { layout = parse_layout(val); i++; }
+        else if (!strcmp(arg, "--timing")) { timing = parse_timing(val); i++; }
+        else if (!strcmp(arg, "--pack")) { pack = atoi(val); i++; }
+        else if (!strcmp(arg, "--boot")) { config.boot_protocol = true; }
+        else if (!strcmp(arg, "--flow")) { config.flow_control = true; }
+        else if (!strcmp(arg, "--gen")) { gen = val; i++; }
+        else if (!strcmp(arg, "--count")) { count = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--seed")) { gen_state = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--save")) { save_path = val; i++; }
+        else if (!strcmp(arg, "--golden")) { golden_path = val; i++; }
+        else if (!strcmp(arg, "--trace")) { core_trace_path = val; i++; }
+        else if (!strcmp(arg, "--dump")) { dump_port = val; i++; }
+        else { trace_path = arg; }
+    }
+    if (dump_port) return dump(dump_port, config.baud_rate);
+
+    sim_init(&config);
+    bridge_config_t defaults = {};
+    defaults.baud_rate = config.baud_rate;
+    defaults.layout = layout;
+    defaults.pacing = timing.pacing;
+    defaults.hold_us = timing.hold_us;
+    defaults.gap_us = timing.gap_us;
+    defaults.pack_limit = pack;
+    defaults.log_level = LOG_LEVEL_NONE;
+    defaults.trace = core_trace_path != NULL;
+    for (uint8_t &pin : defaults.input_pin) pin = CONFIG_PIN_NONE;
+    for (uint8_t &weight : defaults.weight) weight = 1;
+    config_store_init(&defaults);
+    bridge_init();
+
+    std::vector<trace_line_t> input;
+    if (gen) {
+        if (!generate(gen, count, input)) return 2;
+    } else if (!trace_path || !load_trace(trace_path, input)) {
+        fprintf(stderr, "usage: bridge_replay [options] TRACE | --gen NAME | --dump PORT\n");
+        return 2;
+    }
+    std::vector<trace_line_t> golden;
+    if (golden_path && !load_trace(golden_path, golden)) return 2;
+
+    size_t input_bytes = std::count_if(input.begin(), input.end(), [](const trace_line_t &l) { return !l.report; });
+    if (!run(input, &config)) return 2;
+    print_results(input_bytes);
+
+    if (core_trace_path && !save_core_trace(core_trace_path)) return 2;
+
+    std::vector<trace_line_t> typed = sim_report_lines();
+    if (save_path) {
+        FILE *f = fopen(save_path, "w");
+        if (!f) {
+            fprintf(stderr, "%s: %s\n", save_path, strerror(errno));
+            return 2;
+        }
+        // The input with its replay times, then what the host read
+        uint64_t base = UINT64_MAX;
+        for (const trace_line_t &line : input) {
+            if (!line.report) base = std::min(base, line.time_us);
+        }
+        for (const trace_line_t &line : input) {
+            if (line.report) continue;
+            trace_line_t rebased = line;
+            rebased.time_us -= base;
+            print_line(f, rebased);
+        }
+        for (const trace_line_t &line : typed) print_line(f, line);
+        fclose(f);
+    }
+
+    if (golden_path) {
+        if (!compare(golden, typed)) return 1;
+        printf("MATCH\n");
+    }
+    return 0;
+}
@@ -0,0 +1,298 @@
+// Runs text through the bridge core on the simulated platform and checks
+// that the simulated host types exactly the text that was sent.
+//
+//   bridge_sim [options] [text]      text defaults to stdin
+//
+//   --baud N          UART baud rate (115200)
+//   --interval-us N   HID endpoint poll interval (5000)
+//   --layout NAME     keypad, us, fi or de (us)
+//   --timing NAME     fast, safe or legacy (fast)
+//   --pack N          keys packed per report (HID_PACK_MAX)
+//   --boot            host uses the boot protocol, no NKRO reports
+//   --flow            sender honours RTS/CTS flow control
+//   --suspended       host starts suspended and resumes on remote wakeup
+//   --leds N          host lock LEDs at start, 1 NumLock, 2 CapsLock (1)
+//   --utf8            the text is UTF-8 rather than Latin-1
+//   --unicode NAME    host hex input method, none, linux or windows (none)
+//   --channels N      deal the lines of the text out to N input channels (1)
+//   --replay-us N     schedule the characters N us apart in framed mode
+//   --align           align scheduled keys to USB frames
+//   --reports         print every report read by the host
+//
+// Exits with 0 when the typed text matches the input. With several
+// channels the lines may come out in any order but each must be intact.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "bridge.h"
+#include "cobs.h"
+#include "config_store.h"
+#include "crc16.h"
+#include "hid_engine.h"
+#include "keymap.h"
+#include "latency.h"
+#include "log.h"
+#include "protocol.h"
+#include "sim_hal.h"
+#include "sim_keyboard.h"
+#include "unicode.h"
+
+// Simulation time step
+#define SIM_TICK_US 10
+
+// Give up when the bridge has not finished this long after the last input byte
+#define SIM_TIMEOUT_US 60000000ull
+
+static keymap_layout_t parse_layout(const char *name) {
+    if (!strcmp(name, "keypad")) return LAYOUT_KEYPAD;
+    if (!strcmp(name, "fi")) return LAYOUT_FI;
+    if (!strcmp(name, "de")) return LAYOUT_DE;
+    return LAYOUT_US;
+}
+
+// Lines including their line end, the last one may have none
+static std::vector<std::string> split_lines(const std::string &text) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        end = (end == std::string::npos) ? text.size() : end + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+// Queues one frame behind a zero byte, sent at time_us
+static void send_frame_at(uint64_t time_us, uint8_t seq, const std::vector<uint8_t> &records) {
+    std::vector<uint8_t> frame(1, seq);
+    frame.insert(frame.end(), records.begin(), records.end());
+    uint16_t crc = crc16(frame.data(), frame.size());
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+
+    uint8_t encoded[COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX)];
+    size_t len = cobs_encode(frame.data(), frame.size(), encoded);
+    sim_uart_send_at(time_us, 0);
+    for (size_t i = 0; i < len; i++) sim_uart_send_at(time_us, encoded[i]);
+    sim_uart_send_at(time_us, 0);
+}
+
+// Types each character interval_us after the previous one. A frame goes out
+// half an interval before the previous character is due, so the schedule
+// stays chained and the key queue stays short. A UTF-8 character goes in one
+// record with its continuation bytes.
+static void send_replay(const std::string &text, uint32_t interval_us, bool align, bool utf8) {
+    uint8_t flags = align ? SCHEDULE_FRAME : 0;
+    size_t pos = 0;
+    for (size_t i = 0; pos < text.size(); i++) {
+        size_t len = 1;
+        while (utf8 && pos + len < text.size() && ((uint8_t)text[pos + len] & 0xC0) == 0x80) len++;
+        std::vector<uint8_t> records = {
+            CMD_SCHEDULE, 5, flags, (uint8_t)interval_us, (uint8_t)(interval_us >> 8),
+            (uint8_t)(interval_us >> 16), (uint8_t)(interval_us >> 24),
+            CMD_TEXT, (uint8_t)len
+        };
+        records.insert(records.end(), text.begin() + pos, text.begin() + pos + len);
+        pos += len;
+        uint64_t at = i ? i * (uint64_t)interval_us - interval_us / 2 : 0;
+        send_frame_at(at, (uint8_t)i, records);
+    }
+}
+
+// Spread of the times between keyboard reads that press keys
+static void print_press_intervals(const std::vector<sim_report_t> &reports, uint32_t interval_us) {
+    uint64_t last = 0;
+    bool keys_down = false;
+    uint64_t min = UINT64_MAX, max = 0;
+    for (const sim_report_t &r : reports) {
+        if (r.instance != HID_INSTANCE_KEYBOARD) continue;
+        bool down = false;
+        for (size_t i = 1; i < r.data.size(); i++) down = down || r.data[i];
+        if (down && !keys_down) {
+            if (last) {
+                uint64_t gap = r.time_us - last;
+                if (gap < min) min = gap;
+                if (gap > max) max = gap;
+            }
+            last = r.time_us;
+        }
+        keys_down = down;
+    }
+    if (max) {
+        printf("press interval %u us  min %llu  max %llu  jitter %llu us\n", interval_us,
+            (unsigned long long)min, (unsigned long long)max, (unsigned long long)(max - min));
+    }
+}
+
+static unicode_method_t parse_unicode(const char *name) {
+    if (!strcmp(name, "linux")) return UNICODE_LINUX;
+    if (!strcmp(name, "windows")) return UNICODE_WINDOWS;
+    return UNICODE_NONE;
+}
+
+static hid_timing_t parse_timing(const char *name) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    hid_timing_t safe = HID_TIMING_SAFE;
+    hid_timing_t legacy = HID_TIMING_LEGACY;
+    if (!strcmp(name, "safe")) return safe;
+    if (!strcmp(name, "legacy")) return legacy;
+    return fast;
+}
+
+int main(int argc, char **argv) {
+    sim_config_t config = SIM_CONFIG_DEFAULT;
+    keymap_layout_t layout = LAYOUT_US;
+    hid_timing_t timing = HID_TIMING_FAST;
+    uint8_t pack = HID_PACK_MAX;
+    bool print_reports = false;
+    bool suspended = false;
+    int channel_count = 1;
+    uint32_t replay_us = 0;
+    bool align = false;
+    bool utf8 = false;
+    unicode_method_t method = UNICODE_NONE;
+    std::string text;
+    bool have_text = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : "";
+        if (!strcmp(arg, "--baud")) { config.baud_rate = atoi(val); i++; }
+        else if (!strcmp(arg, "--interval-us")) { config.poll_interval_us = atoi(val); i++; }
+        else if (!strcmp(arg, "--layout")) { layout = parse_layout(val); i++; }
+        else if (!strcmp(arg, "--timing")) { timing = parse_timing(val); i++; }
+        else if (!strcmp(arg, "--pack")) { pack = atoi(val); i++; }
+        else if (!strcmp(arg, "--boot")) { config.boot_protocol = true; }
+        else if (!strcmp(arg, "--flow")) { config.flow_control = true; }
+        else if (!strcmp(arg, "--suspended")) { suspended = true; }
+        else if (!strcmp(arg, "--leds")) { config.leds = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--utf8")) { utf8 = true; }
+        else if (!strcmp(arg, "--unicode")) { method = parse_unicode(val); i++; }
+        else if (!strcmp(arg, "--channels")) { channel_count = atoi(val); i++; }
+        else if (!strcmp(arg, "--replay-us")) { replay_us = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--align")) { align = true; }
+        else if (!strcmp(arg, "--reports")) { print_reports = true; }
+        else { text = arg; have_text = true; }
+    }
+    if (!have_text) {
+        text.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+    if (channel_count < 1 || channel_count > HAL_UART_CHANNELS) {
+        fprintf(stderr, "--channels must be 1 to %d\n", HAL_UART_CHANNELS);
+        return 2;
+    }
+
+    sim_init(&config);
+
+    // The options stand in for the build time defaults, the flash is empty
+    bridge_config_t defaults = {};
+    defaults.baud_rate = config.baud_rate;
+    defaults.layout = layout;
+    defaults.pacing = timing.pacing;
+    defaults.hold_us = timing.hold_us;
+    defaults.gap_us = timing.gap_us;
+    defaults.pack_limit = pack;
+    defaults.log_level = LOG_LEVEL_NONE;
+    defaults.utf8 = utf8;
+    defaults.unicode_method = method;
+    for (uint8_t &pin : defaults.input_pin) pin = CONFIG_PIN_NONE;
+    for (uint8_t &weight : defaults.weight) weight = 1;
+    config_store_init(&defaults);
+    bridge_init();
+    if (suspended) sim_usb_suspend(true);
+
+    if (replay_us) {
+        send_replay(text, replay_us, align, utf8);
+    } else if (channel_count == 1) {
+        sim_uart_send((const uint8_t *)text.data(), text.size());
+    } else {
+        std::vector<std::string> lines = split_lines(text);
+        for (size_t i = 0; i < lines.size(); i++) {
+            sim_uart_send_channel(i % channel_count, (const uint8_t *)lines[i].data(), lines[i].size());
+        }
+    }
+    uint64_t input_end = 0;
+    while (sim_uart_busy() || !hid_engine_idle()) {
+        sim_advance(SIM_TICK_US);
+        bridge_uart_task();
+        bridge_hid_task();
+        if (sim_uart_busy()) input_end = sim_now();
+        if (sim_now() - input_end > SIM_TIMEOUT_US) {
+            fprintf(stderr, "bridge did not finish\n");
+            return 2;
+        }
+    }
+    // Let the host read the final report
+    sim_advance(config.poll_interval_us);
+
+    const std::vector<sim_report_t> &reports = sim_reports();
+    if (print_reports) {
+        for (const sim_report_t &r : reports) {
+            printf("%10llu us  itf %u ", (unsigned long long)r.time_us, r.instance);
+            for (uint8_t b : r.data) printf(" %02X", b);
+            printf("\n");
+        }
+    }
+
+    // Characters that neither the layout nor the input method can type are
+    // dropped, as are invalid UTF-8 bytes
+    std::string expected;
+    utf8_decoder_t decoder;
+    utf8_reset(&decoder);
+    for (char c : text) {
+        uint32_t ch = utf8 ? utf8_decode(&decoder, (uint8_t)c) : (uint8_t)c;
+        if (ch >= UTF8_INVALID || !unicode_sequence(ch)->count) continue;
+        sim_append_char(expected, (ch == '\r') ? '\n' : ch, utf8);
+    }
+    std::string typed = sim_keyboard_decode(reports, HID_INSTANCE_KEYBOARD, config.leds, utf8);
+    if (channel_count > 1) {
+        // Compare the lines in a canonical order
+        std::vector<std::string> typed_lines = split_lines(typed);
+        std::vector<std::string> expected_lines = split_lines(expected);
+        std::sort(typed_lines.begin(), typed_lines.end());
+        std::sort(expected_lines.begin(), expected_lines.end());
+        typed.clear();
+        expected.clear();
+        for (const std::string &line : typed_lines) typed += line;
+        for (const std::string &line : expected_lines) expected += line;
+    }
+
+    hid_engine_stats_t stats;
+    hid_engine_get_stats(&stats);
+    double seconds = reports.empty() ? 0 : reports.back().time_us / 1e6;
+    printf("chars %zu  keys %u  reports %u  time %.3f s  %.1f keys/s  overruns %u\n",
+        text.size(), stats.keys, stats.reports, seconds,
+        seconds > 0 ? stats.keys / seconds : 0.0, sim_uart_overruns());
+
+    if (replay_us) print_press_intervals(reports, replay_us);
+
+    static const char *const stage_names[LAT_STAGE_COUNT] = { "parse", "pacing", "usb", "total" };
+    for (uint8_t i = 0; i < LAT_STAGE_COUNT; i++) {
+        latency_hist_t hist;
+        latency_get((latency_stage_t)i, &hist);
+        printf("latency %-6s  min %u  mean %u  p50 <=%u  p99 <=%u  max %u us\n", stage_names[i],
+            hist.min_us, hist.count ? (uint32_t)(hist.sum_us / hist.count) : 0,
+            latency_percentile(&hist, 50), latency_percentile(&hist, 99), hist.max_us);
+    }
+
+    if (typed != expected) {
+        size_t pos = 0;
+        while (pos < typed.size() && pos < expected.size() && typed[pos] == expected[pos]) pos++;
+        size_t from = pos > 20 ? pos - 20 : 0;
+        printf("MISMATCH at character %zu of %zu (typed %zu)\n  expected: ...%s\n  typed:    ...%s\n",
+            pos, expected.size(), typed.size(),
+            expected.substr(from, 40).c_str(), typed.substr(from, 40).c_str());
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,335 @@
+#include "sim_hal.h"
+
+#include <string.h>
+
+#include <deque>
+
+#include "bridge.h"
+#include "hal.h"
+#include "hid_keycodes.h"
+#include "sim_keyboard.h"
+#include "usb_descriptors.h"
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t ch;
+} sim_byte_t;
+
+typedef struct {
+    bool busy;
+    uint8_t report_id;
+    std::vector<uint8_t> data;
+} sim_endpoint_t;
+
+static sim_config_t config = SIM_CONFIG_DEFAULT;
+static uint64_t now_us = 0;
+static uint64_t next_poll_us = 0;
+
+// One sender per input channel, all at the same baud rate
+typedef struct {
+    // Bytes the sender has queued, with the time it wants to send each
+    std::deque<sim_byte_t> line;
+    uint64_t line_free_us;
+    // Received bytes with their arrival times
+    std::deque<sim_byte_t> rx_ring;
+    uint32_t rx_overruns;
+} sim_channel_t;
+
+static sim_channel_t channels[HAL_UART_CHANNELS];
+static bool rx_paused = false;  // Flow control, only the bridge UART has it
+static sim_endpoint_t endpoints[SIM_HID_INSTANCES];
+static std::vector<sim_report_t> reports;
+static uint8_t host_leds = 0;
+static std::vector<uint8_t> host_keys;  // Keyboard keys down as last read
+
+static bool usb_suspended = false;
+static bool usb_remote_wakeup = false;
+static uint64_t usb_resume_at = 0;  // Pending remote wakeup, 0 if none
+static std::string uart_output;
+
+// NOR flash behaviour: erase sets bytes to 0xFF, programming only clears bits
+static uint8_t storage[HAL_STORAGE_SIZE];
+static uint32_t storage_writes = 0;
+
+// Toggles the host lock state for newly pressed lock keys and sends the
+// LED report back, like a host does on each change
+static void host_keyboard_report(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> keys = sim_report_keys(data);
+    uint8_t leds = host_leds;
+    for (uint8_t key : keys) {
+        if (memchr(host_keys.data(), key, host_keys.size())) continue;
+        if (key == KC_NUM_LOCK) leds ^= LED_NUM_LOCK;
+        if (key == KC_CAPS_LOCK) leds ^= LED_CAPS_LOCK;
+    }
+    host_keys = keys;
+    if (leds != host_leds) {
+        host_leds = leds;
+        bridge_set_leds(HID_INSTANCE_KEYBOARD, host_leds);
+    }
+}
+
+static uint64_t byte_time_us(void) {
+    return 10 * 1000000ull / config.baud_rate;
+}
+
+void sim_init(const sim_config_t *cfg) {
+    config = *cfg;
+    now_us = 0;
+    next_poll_us = config.poll_interval_us;
+    for (sim_channel_t &ch : channels) {
+        ch.line.clear();
+        ch.line_free_us = 0;
+        ch.rx_ring.clear();
+        ch.rx_overruns = 0;
+    }
+    rx_paused = false;
+    for (auto &ep : endpoints) ep = sim_endpoint_t{ false, 0, {} };
+    reports.clear();
+    host_leds = config.leds;
+    host_keys.clear();
+    // Sent when the host configures the device, long before any input
+    bridge_set_leds(HID_INSTANCE_KEYBOARD, host_leds);
+    uart_output.clear();
+    usb_suspended = false;
+    usb_remote_wakeup = false;
+    usb_resume_at = 0;
+    memset(storage, 0xFF, sizeof(storage));
+    storage_writes = 0;
+}
+
+uint64_t sim_now(void) {
+    return now_us;
+}
+
+void sim_uart_send_at(uint64_t time_us, uint8_t ch) {
+    sim_uart_send_channel_at(0, time_us, ch);
+}
+
+void sim_uart_send_channel_at(uint8_t channel, uint64_t time_us, uint8_t ch) {
+    channels[channel].line.push_back({ time_us, ch });
+}
+
+void sim_uart_send(const uint8_t *data, size_t len) {
+    sim_uart_send_channel(0, data, len);
+}
+
+void sim_uart_send_channel(uint8_t channel, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        channels[channel].line.push_back({ now_us, data[i] });
+    }
+}
+
+bool sim_uart_busy(void) {
+    for (const sim_channel_t &ch : channels) {
+        if (!ch.line.empty() || !ch.rx_ring.empty()) return true;
+    }
+    return false;
+}
+
+// Same hysteresis as uart_io: pause at three quarters full, resume at one quarter
+static void flow_update(void) {
+    if (!config.flow_control) return;
+    size_t level = channels[0].rx_ring.size();
+    if (!rx_paused && level >= config.rx_buf_size - config.rx_buf_size / 4) {
+        rx_paused = true;
+    } else if (rx_paused && level <= config.rx_buf_size / 4) {
+        rx_paused = false;
+    }
+}
+
+static void channel_advance(uint8_t channel) {
+    sim_channel_t &ch = channels[channel];
+    while (!ch.line.empty()) {
+        // A held off sender finishes the byte it is sending but starts no new one
+        if (channel == 0 && rx_paused) {
+            if (ch.line_free_us < now_us) ch.line_free_us = now_us;
+            break;
+        }
+        uint64_t start = ch.line.front().time_us > ch.line_free_us ? ch.line.front().time_us : ch.line_free_us;
+        uint64_t arrival = start + byte_time_us();
+        if (arrival > now_us) break;
+
+        if (ch.rx_ring.size() < config.rx_buf_size) {
+            ch.rx_ring.push_back({ arrival, ch.line.front().ch });
+        } else {
+            ch.rx_overruns++;
+        }
+        ch.line.pop_front();
+        ch.line_free_us = arrival;
+        if (channel == 0) flow_update();
+    }
+}
+
+void sim_advance(uint64_t us) {
+    now_us += us;
+
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        channel_advance(channel);
+    }
+
+    if (usb_resume_at && now_us >= usb_resume_at) {
+        sim_usb_resume();
+    }
+
+    // The host reads every endpoint once per poll interval, except while suspended
+    if (usb_suspended) next_poll_us = now_us + config.poll_interval_us;
+    while (next_poll_us <= now_us) {
+        for (uint8_t i = 0; i < SIM_HID_INSTANCES; i++) {
+            sim_endpoint_t &ep = endpoints[i];
+            if (!ep.busy) continue;
+            reports.push_back({ next_poll_us, i, ep.report_id, ep.data });
+            if (i == HID_INSTANCE_KEYBOARD) host_keyboard_report(ep.data);
+            ep.busy = false;
+            bridge_report_complete(i);
+        }
+        next_poll_us += config.poll_interval_us;
+    }
+}
+
+void sim_usb_suspend(bool remote_wakeup) {
+    usb_suspended = true;
+    usb_remote_wakeup = remote_wakeup;
+    usb_resume_at = 0;
+}
+
+void sim_usb_resume(void) {
+    usb_suspended = false;
+    usb_resume_at = 0;
+    next_poll_us = now_us + config.poll_interval_us;
+}
+
+bool sim_usb_suspended(void) {
+    return usb_suspended;
+}
+
+uint8_t sim_host_leds(void) {
+    return host_leds;
+}
+
+const std::vector<sim_report_t> &sim_reports(void) {
+    return reports;
+}
+
+const std::string &sim_uart_output(void) {
+    return uart_output;
+}
+
+uint32_t sim_uart_overruns(void) {
+    uint32_t overruns = 0;
+    for (const sim_channel_t &ch : channels) overruns += ch.rx_overruns;
+    return overruns;
+}
+
+uint32_t sim_storage_writes(void) {
+    return storage_writes;
+}
+
+//--------------------------------------------------------------------+
+// HAL
+//--------------------------------------------------------------------+
+
+uint64_t hal_time_us(void) {
+    return now_us;
+}
+
+bool hal_hid_ready(uint8_t instance) {
+    return instance < SIM_HID_INSTANCES && !endpoints[instance].busy && !usb_suspended;
+}
+
+bool hal_hid_boot_protocol(uint8_t instance) {
+    (void)instance;
+    return config.boot_protocol;
+}
+
+bool hal_hid_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len) {
+    if (!hal_hid_ready(instance)) return false;
+    sim_endpoint_t &ep = endpoints[instance];
+    const uint8_t *data = (const uint8_t *)report;
+    ep.busy = true;
+    ep.report_id = report_id;
+    ep.data.assign(data, data + len);
+    return true;
+}
+
+bool hal_usb_suspended(void) {
+    return usb_suspended;
+}
+
+bool hal_usb_remote_wakeup(void) {
+    if (!usb_suspended || !usb_remote_wakeup) return false;
+    if (!usb_resume_at) usb_resume_at = now_us + SIM_RESUME_US;
+    return true;
+}
+
+// Frames start on whole milliseconds of the simulated clock
+uint64_t hal_usb_frame_time(void) {
+    return now_us - now_us % HAL_USB_FRAME_US;
+}
+
+// The simulation loop runs every tick, it needs no wakeup
+void hal_alarm_at(uint64_t time_us) {
+    (void)time_us;
+}
+
+// Spinning only moves the clock, the host catches up on the next sim_advance()
+void hal_busy_wait_until(uint64_t time_us) {
+    if (time_us > now_us) now_us = time_us;
+}
+
+size_t hal_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max) {
+    if (channel >= HAL_UART_CHANNELS) return 0;
+    std::deque<sim_byte_t> &rx_ring = channels[channel].rx_ring;
+    size_t n = 0;
+    while (n < max && !rx_ring.empty()) {
+        dst[n] = rx_ring.front().ch;
+        if (rx_time_us) rx_time_us[n] = (uint32_t)rx_ring.front().time_us;
+        n++;
+        rx_ring.pop_front();
+    }
+    if (channel == 0) flow_update();
+    return n;
+}
+
+size_t hal_uart_write(const uint8_t *src, size_t len) {
+    uart_output.append((const char *)src, len);
+    return len;
+}
+
+size_t hal_uart_tx_free(void) {
+    return 4096;
+}
+
+size_t hal_uart_rx_available(uint8_t channel) {
+    return channel < HAL_UART_CHANNELS ? channels[channel].rx_ring.size() : 0;
+}
+
+// The simulated lines never damage a byte
+void hal_uart_get_errors(uint8_t channel, hal_uart_errors_t *errors) {
+    *errors = hal_uart_errors_t{ channel < HAL_UART_CHANNELS ? channels[channel].rx_overruns : 0, 0, 0, 0 };
+}
+
+unsigned hal_core_num(void) {
+    return 0;
+}
+
+void hal_wake(void) {
+}
+
+const uint8_t *hal_storage(void) {
+    return storage;
+}
+
+bool hal_storage_erase(size_t offset, size_t len) {
+    if (offset % HAL_STORAGE_SECTOR || len % HAL_STORAGE_SECTOR || offset + len > HAL_STORAGE_SIZE) return false;
+    memset(&storage[offset], 0xFF, len);
+    storage_writes++;
+    return true;
+}
+
+bool hal_storage_program(size_t offset, const void *data, size_t len) {
+    if (offset % HAL_STORAGE_PAGE || len % HAL_STORAGE_PAGE || offset + len > HAL_STORAGE_SIZE) return false;
+    const uint8_t *src = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) storage[offset + i] &= src[i];
+    storage_writes++;
+    return true;
+}
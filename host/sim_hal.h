@@ -0,0 +1,82 @@
+#ifndef SIM_HAL_H_
+#define SIM_HAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Simulated platform for the host build: a fake microsecond clock, a UART
+// line that delivers bytes at the configured baud rate and a USB host that
+// polls the HID endpoints every poll interval and records what it reads.
+
+#define SIM_HID_INSTANCES 4
+
+typedef struct {
+    uint32_t baud_rate;         // 10 bit times per byte (8N1)
+    uint32_t poll_interval_us;  // HID endpoint bInterval
+    size_t rx_buf_size;         // Receive ring size, bytes beyond are overruns
+    bool boot_protocol;         // Host has selected the boot protocol, like a BIOS
+    bool flow_control;          // Sender honours RTS/CTS driven by the receive ring level
+    uint8_t leds;               // Host lock state (LED_* bits), sent by sim_init()
+} sim_config_t;
+
+#define SIM_CONFIG_DEFAULT { 115200, 5000, 1024, false, false, 0x01 }
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t instance;
+    uint8_t report_id;
+    std::vector<uint8_t> data;
+} sim_report_t;
+
+// Resets the clock, UART and recorded reports
+void sim_init(const sim_config_t *config);
+
+uint64_t sim_now(void);
+
+// Queues bytes behind the ones already sent, they go out back to back at the baud rate
+void sim_uart_send(const uint8_t *data, size_t len);
+
+// Queues one byte that is sent at time_us, or when the line is free
+void sim_uart_send_at(uint64_t time_us, uint8_t ch);
+
+// Same as sim_uart_send() for one of the HAL_UART_CHANNELS inputs, each
+// channel has its own sender and line. Flow control only covers channel 0.
+void sim_uart_send_channel(uint8_t channel, const uint8_t *data, size_t len);
+
+// Same as sim_uart_send_at() for one of the input channels
+void sim_uart_send_channel_at(uint8_t channel, uint64_t time_us, uint8_t ch);
+
+// True while bytes are still on a line or waiting in a receive ring
+bool sim_uart_busy(void);
+
+// Advances the clock, delivers bytes that have arrived and lets the
+// host poll endpoints whose interval has come up
+void sim_advance(uint64_t us);
+
+// Suspends the bus. With remote wakeup allowed, a wakeup request from
+// the bridge resumes it after SIM_RESUME_US.
+void sim_usb_suspend(bool remote_wakeup);
+void sim_usb_resume(void);
+bool sim_usb_suspended(void);
+
+// Time from a remote wakeup request to the host polling again
+#define SIM_RESUME_US 20000
+
+// Host lock state, toggled by the lock keys the host reads
+uint8_t sim_host_leds(void);
+
+// Reports read by the host so far
+const std::vector<sim_report_t> &sim_reports(void);
+
+// Bytes the bridge wrote to its UART
+const std::string &sim_uart_output(void);
+
+uint32_t sim_uart_overruns(void);
+
+// Flash erase and program operations on the storage area
+uint32_t sim_storage_writes(void);
+
+#endif /* SIM_HAL_H_ */
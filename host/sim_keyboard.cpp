@@ -0,0 +1,151 @@
+#include "sim_keyboard.h"
+
+#include <string.h>
+
+#include <map>
+
+#include "hid_keycodes.h"
+#include "keymap.h"
+#include "usb_descriptors.h"
+
+std::vector<uint8_t> sim_report_keys(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> keys;
+    if (data.size() == HID_NKRO_REPORT_LEN) {
+        for (int usage = 1; usage < HID_NKRO_KEYS; usage++) {
+            if (data[1 + usage / 8] & (1 << (usage % 8))) keys.push_back(usage);
+        }
+    } else if (data.size() >= 8) {
+        for (int i = 2; i < 8; i++) {
+            if (data[i]) keys.push_back(data[i]);
+        }
+    }
+    return keys;
+}
+
+void sim_append_char(std::string &text, uint32_t codepoint, bool utf8) {
+    if (!utf8 || codepoint < 0x80) {
+        text += (codepoint < 0x100) ? (char)codepoint : '?';
+    } else if (codepoint < 0x800) {
+        text += (char)(0xC0 | (codepoint >> 6));
+        text += (char)(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        text += (char)(0xE0 | (codepoint >> 12));
+        text += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        text += (char)(0x80 | (codepoint & 0x3F));
+    } else {
+        text += (char)(0xF0 | (codepoint >> 18));
+        text += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        text += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        text += (char)(0x80 | (codepoint & 0x3F));
+    }
+}
+
+// Value of a hex digit key, -1 for other keys
+static int hex_digit(uint8_t key, bool keypad) {
+    if (key >= KC_A && key <= KC_A + 5) return 10 + key - KC_A;
+    if (keypad) {
+        if (key == KC_KEYPAD_0) return 0;
+        if (key >= KC_KEYPAD_1 && key <= KC_KEYPAD_9) return 1 + key - KC_KEYPAD_1;
+    } else {
+        if (key == KC_0) return 0;
+        if (key >= KC_1 && key <= KC_9) return 1 + key - KC_1;
+    }
+    return -1;
+}
+
+// Hex input method being typed
+typedef enum {
+    HEX_NONE,
+    HEX_LINUX,    // Started by Ctrl+Shift+U, ends with Space or Enter
+    HEX_WINDOWS   // Started by Alt and keypad +, ends when Alt goes up
+} hex_input_t;
+
+std::string sim_keyboard_decode(const std::vector<sim_report_t> &reports, uint8_t instance, uint8_t leds, bool utf8) {
+    // Reverse of the active layout, the first character wins for keys that
+    // several characters map to (e.g. '\r' and '\n')
+    std::map<uint16_t, uint32_t> chars;
+    for (uint32_t ch = 0xFFFF; ch >= 0x100; ch--) {
+        keymap_entry_t key = keymap_lookup_wide(ch);
+        if (key.keycode) chars[(key.modifier << 8) | key.keycode] = ch;
+    }
+    for (int ch = 255; ch > 0; ch--) {
+        keymap_entry_t key = keymap_lookup(ch);
+        if (key.keycode) chars[(key.modifier << 8) | key.keycode] = ch;
+    }
+
+    const uint8_t ctrl = MOD_LCTRL | MOD_RCTRL;
+    const uint8_t shift = MOD_LSHIFT | MOD_RSHIFT;
+    const uint8_t alt = MOD_LALT | MOD_RALT;
+    std::string text;
+    std::vector<uint8_t> prev;
+    int dead = -1;
+    hex_input_t hex = HEX_NONE;
+    uint32_t hex_value = 0;
+    for (const sim_report_t &report : reports) {
+        if (report.instance != instance || report.data.empty()) continue;
+        if (hex == HEX_WINDOWS && !(report.data[0] & alt)) {
+            sim_append_char(text, hex_value, utf8);
+            hex = HEX_NONE;
+        }
+        std::vector<uint8_t> keys = sim_report_keys(report.data);
+        for (uint8_t key : keys) {
+            if (memchr(prev.data(), key, prev.size())) continue;
+            if (hex != HEX_NONE) {
+                int digit = hex_digit(key, hex == HEX_WINDOWS);
+                if (digit >= 0) {
+                    hex_value = (hex_value << 4) | digit;
+                } else if (hex == HEX_LINUX && (key == KC_SPACE || key == KC_ENTER)) {
+                    sim_append_char(text, hex_value, utf8);
+                    hex = HEX_NONE;
+                } else {
+                    text += '?';
+                    hex = HEX_NONE;
+                }
+                continue;
+            }
+            if (key == KC_A + ('u' - 'a') && (report.data[0] & ctrl) && (report.data[0] & shift)) {
+                hex = HEX_LINUX;
+                hex_value = 0;
+                continue;
+            }
+            if (key == KC_KEYPAD_PLUS && (report.data[0] & alt)) {
+                hex = HEX_WINDOWS;
+                hex_value = 0;
+                continue;
+            }
+            if (key == KC_NUM_LOCK) {
+                leds ^= LED_NUM_LOCK;
+                continue;
+            }
+            if (key == KC_CAPS_LOCK) {
+                leds ^= LED_CAPS_LOCK;
+                continue;
+            }
+            uint8_t modifier = report.data[0];
+            if (!(leds & LED_NUM_LOCK) && key >= KC_KEYPAD_1 && key <= KC_KEYPAD_PERIOD) {
+                text += '?';
+                continue;
+            }
+            if ((leds & LED_CAPS_LOCK) && keymap_caps_key(key)) {
+                modifier = (modifier & shift) ? (modifier & ~shift) : (modifier | MOD_LSHIFT);
+            }
+            auto it = chars.find((modifier << 8) | key);
+            if (it == chars.end()) {
+                text += '?';
+                continue;
+            }
+            uint32_t ch = it->second;
+            if (dead >= 0) {
+                // Only a dead key followed by space is supported
+                sim_append_char(text, (ch == ' ') ? (uint32_t)dead : '?', utf8);
+                dead = -1;
+            } else if (ch < 0x100 && (keymap_lookup(ch).flags & KEYMAP_DEAD)) {
+                dead = ch;
+            } else {
+                sim_append_char(text, ch, utf8);
+            }
+        }
+        prev = keys;
+    }
+    return text;
+}
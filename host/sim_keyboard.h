@@ -0,0 +1,27 @@
+#ifndef SIM_KEYBOARD_H_
+#define SIM_KEYBOARD_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "sim_hal.h"
+
+// Turns the keyboard reports read by the simulated host back into text, the
+// way a host with the bridge's active layout would see it. Every newly pressed
+// key produces the character it has in the layout, dead keys combine with the
+// following space. leds is the host lock state before the first report: lock
+// keys toggle it, keypad digits type '?' while NumLock is off and CapsLock
+// inverts Shift for the layout's letters. The host also has the hex input methods of
+// unicode.h. The text is UTF-8 with utf8 set, otherwise Latin-1.
+std::string sim_keyboard_decode(const std::vector<sim_report_t> &reports, uint8_t instance = 0, uint8_t leds = 0x01,
+    bool utf8 = false);
+
+// Appends a codepoint as UTF-8, or as Latin-1 ('?' beyond it)
+void sim_append_char(std::string &text, uint32_t codepoint, bool utf8);
+
+// Keys down in a boot report or an NKRO bitmap report, in the order the host handles them
+std::vector<uint8_t> sim_report_keys(const std::vector<uint8_t> &data);
+
+#endif /* SIM_KEYBOARD_H_ */
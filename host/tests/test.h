@@ -0,0 +1,48 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdint.h>
+
+#include "config_store.h"
+#include "hid_engine.h"
+#include "sim_hal.h"
+
+// Unit tests of the bridge core on the simulated platform. bridge_tests runs
+// the case named on its command line, or every case in a process of its own,
+// so the static state of the modules starts fresh for each case.
+
+typedef void (*test_fn_t)(void);
+
+struct test_registrar_t {
+    test_registrar_t(const char *name, test_fn_t fn);
+};
+
+#define TEST(name) \
+    static void test_##name(void); \
+    static test_registrar_t test_registrar_##name(#name, test_##name); \
+    static void test_##name(void)
+
+void test_fail(const char *file, int line, const char *expr);
+void test_fail_eq(const char *file, int line, const char *a, const char *b, long long va, long long vb);
+
+// A failed check ends the test case, or the helper it is in
+#define CHECK(cond) \
+    do { if (!(cond)) { test_fail(__FILE__, __LINE__, #cond); return; } } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long va_ = (long long)(a), vb_ = (long long)(b); \
+        if (va_ != vb_) { test_fail_eq(__FILE__, __LINE__, #a, #b, va_, vb_); return; } \
+    } while (0)
+
+// Build time defaults of the tests: US layout, no diagnostics, no extra inputs
+void test_default_config(bridge_config_t *config, const hid_timing_t *timing, uint8_t pack);
+
+// Resets the simulated platform, loads the config from the empty flash and starts the bridge
+void test_bridge_start(const sim_config_t *sim, const hid_timing_t *timing, uint8_t pack);
+
+// Runs the bridge until the input is typed and the keys are released, then
+// lets the host read the last report
+void test_run_idle(void);
+
+#endif /* TEST_H_ */
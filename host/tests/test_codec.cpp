@@ -0,0 +1,152 @@
+// CRC-16, COBS, the UTF-8 decoder and baud rate detection
+
+#include <string.h>
+
+#include <vector>
+
+#include "autobaud.h"
+#include "cobs.h"
+#include "crc16.h"
+#include "test.h"
+#include "unicode.h"
+
+// Pico system clock, the PIO edge timer counts in its ticks
+#define TICK_HZ 125000000
+
+TEST(crc16_check) {
+    const uint8_t check[] = "123456789";
+    CHECK_EQ(crc16(check, 9), 0x29B1);
+    CHECK_EQ(crc16_update(crc16(check, 4), &check[4], 5), 0x29B1);
+    CHECK_EQ(crc16(check, 0), CRC16_INIT);
+}
+
+static void cobs_roundtrip(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> encoded(COBS_MAX_ENCODED_LEN(data.size()));
+    size_t len = cobs_encode(data.data(), data.size(), encoded.data());
+    CHECK(len <= encoded.size());
+    CHECK(memchr(encoded.data(), 0, len) == NULL);
+    // Decoded in place, like the frame receiver does
+    CHECK_EQ(cobs_decode(encoded.data(), len, encoded.data()), data.size());
+    CHECK(memcmp(encoded.data(), data.data(), data.size()) == 0);
+}
+
+TEST(cobs_roundtrip) {
+    const uint8_t data[] = { 0x11, 0x22, 0x00, 0x33 };
+    const uint8_t expected[] = { 0x03, 0x11, 0x22, 0x02, 0x33 };
+    uint8_t encoded[COBS_MAX_ENCODED_LEN(sizeof(data))];
+    CHECK_EQ(cobs_encode(data, sizeof(data), encoded), sizeof(expected));
+    CHECK(memcmp(encoded, expected, sizeof(expected)) == 0);
+
+    cobs_roundtrip({ 0x00 });
+    cobs_roundtrip({ 0x00, 0x00, 0x00 });
+    cobs_roundtrip({ 0x01, 0x00, 0xFF, 0x00 });
+    // Runs around the 254 byte block length
+    for (size_t len : { 253, 254, 255, 508, 600 }) {
+        std::vector<uint8_t> run(len);
+        for (size_t i = 0; i < len; i++) run[i] = (uint8_t)(i % 255 + 1);
+        cobs_roundtrip(run);
+        run[len / 2] = 0;
+        cobs_roundtrip(run);
+    }
+}
+
+TEST(cobs_malformed) {
+    uint8_t out[16];
+    // A block longer than the input
+    const uint8_t short_block[] = { 0x05, 0x11, 0x22 };
+    CHECK_EQ(cobs_decode(short_block, sizeof(short_block), out), 0);
+    // A zero code byte
+    const uint8_t zero_code[] = { 0x02, 0x11, 0x00, 0x22 };
+    CHECK_EQ(cobs_decode(zero_code, sizeof(zero_code), out), 0);
+}
+
+// Feeds bytes and returns the results for each of them
+static std::vector<uint32_t> utf8_feed(const std::vector<uint8_t> &bytes) {
+    utf8_decoder_t decoder;
+    utf8_reset(&decoder);
+    std::vector<uint32_t> result;
+    for (uint8_t byte : bytes) result.push_back(utf8_decode(&decoder, byte));
+    return result;
+}
+
+TEST(utf8_valid) {
+    CHECK(utf8_feed({ 'A' }) == std::vector<uint32_t>({ 'A' }));
+    CHECK(utf8_feed({ 0xC3, 0xA9 }) == std::vector<uint32_t>({ UTF8_PENDING, 0xE9 }));
+    CHECK(utf8_feed({ 0xE2, 0x82, 0xAC }) == std::vector<uint32_t>({ UTF8_PENDING, UTF8_PENDING, 0x20AC }));
+    CHECK(utf8_feed({ 0xF0, 0x9F, 0x98, 0x80 }) ==
+        std::vector<uint32_t>({ UTF8_PENDING, UTF8_PENDING, UTF8_PENDING, 0x1F600 }));
+    // Last codepoints before and after the surrogates and the last one of Unicode
+    CHECK(utf8_feed({ 0xED, 0x9F, 0xBF }).back() == 0xD7FF);
+    CHECK(utf8_feed({ 0xEE, 0x80, 0x80 }).back() == 0xE000);
+    CHECK(utf8_feed({ 0xF4, 0x8F, 0xBF, 0xBF }).back() == 0x10FFFF);
+}
+
+TEST(utf8_overlong) {
+    // C0 and C1 can only start overlong forms of ASCII
+    CHECK(utf8_feed({ 0xC0, 0x80 }) == std::vector<uint32_t>({ UTF8_INVALID, UTF8_INVALID }));
+    CHECK(utf8_feed({ 0xC1, 0xBF }) == std::vector<uint32_t>({ UTF8_INVALID, UTF8_INVALID }));
+    // '/' and U+07FF in three bytes, U+FFFF in four
+    CHECK(utf8_feed({ 0xE0, 0x80, 0xAF }).back() == UTF8_INVALID);
+    CHECK(utf8_feed({ 0xE0, 0x9F, 0xBF }).back() == UTF8_INVALID);
+    CHECK(utf8_feed({ 0xF0, 0x8F, 0xBF, 0xBF }).back() == UTF8_INVALID);
+}
+
+TEST(utf8_surrogate) {
+    CHECK(utf8_feed({ 0xED, 0xA0, 0x80 }).back() == UTF8_INVALID);
+    CHECK(utf8_feed({ 0xED, 0xBF, 0xBF }).back() == UTF8_INVALID);
+    // Beyond U+10FFFF, and lead bytes that can only start such codepoints
+    CHECK(utf8_feed({ 0xF4, 0x90, 0x80, 0x80 }).back() == UTF8_INVALID);
+    CHECK(utf8_feed({ 0xF5 }) == std::vector<uint32_t>({ UTF8_INVALID }));
+    CHECK(utf8_feed({ 0xFF }) == std::vector<uint32_t>({ UTF8_INVALID }));
+}
+
+TEST(utf8_truncated) {
+    // A sequence cut short is dropped and the new character comes through
+    CHECK(utf8_feed({ 0xE2, 0x82, 'A' }) == std::vector<uint32_t>({ UTF8_PENDING, UTF8_PENDING, 'A' }));
+    CHECK(utf8_feed({ 0xE2, 0xC3, 0xA9 }) == std::vector<uint32_t>({ UTF8_PENDING, UTF8_PENDING, 0xE9 }));
+    // Continuation bytes without a lead byte
+    CHECK(utf8_feed({ 0x80, 0xBF, 'A' }) == std::vector<uint32_t>({ UTF8_INVALID, UTF8_INVALID, 'A' }));
+}
+
+// Low pulses of 'U' characters at a bit time of ticks, with some longer
+// pulses of other characters mixed in
+static uint32_t autobaud_run(uint32_t ticks) {
+    autobaud_t ab;
+    autobaud_reset(&ab, TICK_HZ);
+    uint32_t baud = 0;
+    for (uint32_t i = 0; i < AUTOBAUD_SAMPLES; i++) {
+        uint32_t bits = (i % 4 == 3) ? 1 + i % 3 : 1;
+        // The pulses jitter by a tick
+        baud = autobaud_pulse(&ab, bits * ticks + i % 2);
+        if (i + 1 < AUTOBAUD_SAMPLES && baud) return 0;
+    }
+    return baud;
+}
+
+TEST(autobaud_snap) {
+    // 115200 is 1085.07 ticks per bit
+    CHECK_EQ(autobaud_run(1085), 115200);
+    // Within AUTOBAUD_SNAP_PERMILLE of a standard rate, about 2% fast and slow
+    CHECK_EQ(autobaud_run(1064), 115200);
+    CHECK_EQ(autobaud_run(1102), 115200);
+    CHECK_EQ(autobaud_run(125), 1000000);
+    CHECK_EQ(autobaud_run(104167), 1200);
+    // 5% off is a rate of its own, the mean of the 27 single bit pulses
+    CHECK_EQ(autobaud_run(1033), 120959);
+}
+
+TEST(autobaud_glitch) {
+    autobaud_t ab;
+    autobaud_reset(&ab, TICK_HZ);
+    // Pulses shorter than a bit at AUTOBAUD_MAX_BAUD are not counted
+    for (int i = 0; i < 100; i++) CHECK_EQ(autobaud_pulse(&ab, 10), 0);
+    CHECK_EQ(ab.count, 0);
+
+    // Too few pulses agree with the shortest one, they are taken as glitches
+    uint32_t baud = 0;
+    for (uint32_t i = 0; i < AUTOBAUD_SAMPLES; i++) {
+        baud = autobaud_pulse(&ab, i < AUTOBAUD_MIN_SINGLE - 1 ? 1085 : 2170 + i);
+    }
+    CHECK_EQ(baud, 0);
+    CHECK_EQ(autobaud_run(1085), 115200);
+}
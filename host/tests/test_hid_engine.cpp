@@ -0,0 +1,209 @@
+// Keyboard engine: packing of taps into 6KRO and NKRO reports, hold/gap
+// pacing, and golden runs of the report timing seen by the host
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "hid_keycodes.h"
+#include "key_queue.h"
+#include "sim_keyboard.h"
+#include "test.h"
+#include "usb_descriptors.h"
+
+typedef std::vector<uint8_t> keys_t;
+
+static void engine_start(bool boot, const hid_timing_t &timing, uint8_t pack, uint32_t interval_us = 5000) {
+    sim_config_t sim = SIM_CONFIG_DEFAULT;
+    sim.boot_protocol = boot;
+    sim.poll_interval_us = interval_us;
+    test_bridge_start(&sim, &timing, pack);
+}
+
+static void push_tap(uint8_t modifier, uint8_t keycode) {
+    key_event_t ev = KEY_EVENT_TAP(modifier, keycode);
+    key_queue_push(&ev);
+}
+
+static std::vector<sim_report_t> keyboard_reports(void) {
+    std::vector<sim_report_t> keyboard;
+    for (const sim_report_t &r : sim_reports()) {
+        if (r.instance == HID_INSTANCE_KEYBOARD) keyboard.push_back(r);
+    }
+    return keyboard;
+}
+
+// Time, modifier and keys of a report as the host reads it, e.g. "10000 02 0b 0c"
+static std::string report_line(const sim_report_t &r) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu %02x", (unsigned long long)r.time_us, r.data[0]);
+    std::string line = buf;
+    for (uint8_t key : sim_report_keys(r.data)) {
+        snprintf(buf, sizeof(buf), " %02x", key);
+        line += buf;
+    }
+    return line;
+}
+
+static const uint8_t A = KC_A, B = KC_A + 1, C = KC_A + 2, D = KC_A + 3;
+
+TEST(pack_6kro) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    engine_start(true, fast, HID_PACK_MAX);
+    for (uint8_t i = 0; i < 8; i++) push_tap(0, KC_A + i);
+    test_run_idle();
+
+    // Six keys fill the boot report, the next two replace them right away
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 3);
+    CHECK_EQ(reports[0].data.size(), 8);
+    CHECK(sim_report_keys(reports[0].data) == keys_t({ A, B, C, D, KC_A + 4, KC_A + 5 }));
+    CHECK(sim_report_keys(reports[1].data) == keys_t({ KC_A + 6, KC_A + 7 }));
+    CHECK(sim_report_keys(reports[2].data).empty());
+}
+
+TEST(pack_nkro) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    engine_start(false, fast, HID_PACK_MAX);
+    const uint8_t taps[] = { A, B, C, A, D, C };
+    for (uint8_t key : taps) push_tap(0, key);
+    push_tap(MOD_LSHIFT, D);
+    test_run_idle();
+
+    // A key already down ends a report, so does a key below the previous one
+    // in the bitmap or another modifier
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 6);
+    CHECK_EQ(reports[0].data.size(), HID_NKRO_REPORT_LEN);
+    CHECK(sim_report_keys(reports[0].data) == keys_t({ A, B, C }));
+    CHECK(sim_report_keys(reports[1].data).empty());
+    CHECK(sim_report_keys(reports[2].data) == keys_t({ A, D }));
+    CHECK(sim_report_keys(reports[3].data) == keys_t({ C }));
+    CHECK_EQ(reports[3].data[0], 0);
+    CHECK(sim_report_keys(reports[4].data) == keys_t({ D }));
+    CHECK_EQ(reports[4].data[0], MOD_LSHIFT);
+    CHECK(sim_report_keys(reports[5].data).empty());
+    CHECK_EQ(reports[5].data[0], 0);
+}
+
+TEST(pack_limit) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    engine_start(false, fast, 2);
+    for (uint8_t key : { A, B, C }) push_tap(0, key);
+    test_run_idle();
+
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 3);
+    CHECK(sim_report_keys(reports[0].data) == keys_t({ A, B }));
+    CHECK(sim_report_keys(reports[1].data) == keys_t({ C }));
+}
+
+TEST(pacing_completion) {
+    // One report per poll, and a repeated key needs a release in between
+    hid_timing_t fast = HID_TIMING_FAST;
+    engine_start(false, fast, HID_PACK_MAX);
+    for (int i = 0; i < 3; i++) push_tap(0, A);
+    test_run_idle();
+
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 6);
+    for (size_t i = 0; i < reports.size(); i++) {
+        CHECK_EQ(sim_report_keys(reports[i].data).size(), i % 2 ? 0 : 1);
+        if (i) CHECK_EQ(reports[i].time_us - reports[i - 1].time_us, 5000);
+    }
+}
+
+TEST(pacing_hold_gap) {
+    hid_timing_t safe = HID_TIMING_SAFE;
+    const uint32_t interval = 1000;
+    engine_start(false, safe, HID_PACK_MAX, interval);
+    for (int i = 0; i < 3; i++) push_tap(0, A);
+    test_run_idle();
+
+    // The release goes out hold_us after the press was submitted, the next
+    // press gap_us after the release, each read at the next poll
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 6);
+    for (size_t i = 1; i < reports.size(); i++) {
+        uint64_t min = i % 2 ? safe.hold_us : safe.gap_us;
+        uint64_t elapsed = reports[i].time_us - reports[i - 1].time_us;
+        CHECK(elapsed >= min);
+        CHECK(elapsed <= min + interval);
+    }
+}
+
+TEST(pacing_timed) {
+    // Legacy pacing holds the keys for 100 ms
+    hid_timing_t legacy = HID_TIMING_LEGACY;
+    engine_start(true, legacy, HID_PACK_MAX);
+    for (uint8_t key : { A, B }) push_tap(0, key);
+    test_run_idle();
+
+    std::vector<sim_report_t> reports = keyboard_reports();
+    CHECK_EQ(reports.size(), 2);
+    CHECK(sim_report_keys(reports[0].data) == keys_t({ A, B }));
+    CHECK(reports[1].time_us - reports[0].time_us >= legacy.hold_us);
+    CHECK(reports[1].time_us - reports[0].time_us <= legacy.hold_us + 5000);
+    CHECK(sim_report_keys(reports[1].data).empty());
+}
+
+// Types text through the UART in text mode and compares every keyboard
+// report the host reads, with its time, against a golden run
+static void golden_run(bool boot, const hid_timing_t &timing, const char *text,
+    const std::vector<std::string> &golden) {
+    engine_start(boot, timing, HID_PACK_MAX);
+    sim_uart_send((const uint8_t *)text, strlen(text));
+    test_run_idle();
+
+    std::vector<sim_report_t> reports = keyboard_reports();
+    std::vector<std::string> lines;
+    for (const sim_report_t &r : reports) lines.push_back(report_line(r));
+    for (size_t i = 0; i < lines.size() || i < golden.size(); i++) {
+        const char *got = i < lines.size() ? lines[i].c_str() : "(none)";
+        const char *want = i < golden.size() ? golden[i].c_str() : "(none)";
+        if (strcmp(got, want)) {
+            fprintf(stderr, "report %zu: got \"%s\", golden \"%s\"\n", i, got, want);
+            CHECK(lines == golden);
+        }
+    }
+    CHECK(sim_keyboard_decode(reports, HID_INSTANCE_KEYBOARD, 0x01) == text);
+}
+
+TEST(golden_fast_nkro) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    // Shift+h, then as many keys per poll as packing allows: e l, the
+    // release before the repeated l, l o comma, space below comma in the bitmap
+    golden_run(false, fast, "Hello, Bob!\n", {
+        "5000 02 0b",
+        "10000 00 08 0f",
+        "15000 00",
+        "20000 00 0f 12 36",
+        "25000 00 2c",
+        "30000 02 05",
+        "35000 00 12",
+        "40000 00 05",
+        "45000 02 1e",
+        "50000 00 28",
+        "55000 00",
+    });
+}
+
+TEST(golden_safe_boot) {
+    hid_timing_t safe = HID_TIMING_SAFE;
+    // 20 ms hold and 10 ms gap at a 5 ms poll interval. Boot reports have
+    // no bitmap order, so space joins l o comma.
+    golden_run(true, safe, "Hello, Bob!\n", {
+        "15000 02 0b",
+        "35000 00 08 0f",
+        "55000 00",
+        "65000 00 0f 12 36 2c",
+        "85000 02 05",
+        "105000 00 12",
+        "125000 00 05",
+        "145000 02 1e",
+        "165000 00 28",
+        "185000 00",
+    });
+}
@@ -0,0 +1,73 @@
+// Key event queue between the UART and USB sides
+
+#include "hid_keycodes.h"
+#include "key_queue.h"
+#include "test.h"
+
+static void queue_start(void) {
+    sim_config_t sim = SIM_CONFIG_DEFAULT;
+    sim_init(&sim);
+}
+
+TEST(key_queue_fifo) {
+    queue_start();
+    for (uint8_t i = 0; i < 3; i++) {
+        sim_advance(100);
+        key_event_t ev = KEY_EVENT_TAP(0, (uint8_t)(KC_A + i));
+        CHECK(key_queue_push(&ev));
+    }
+    CHECK_EQ(key_queue_size(), 3);
+    CHECK_EQ(key_queue_peek(2)->keycodes[0], KC_A + 2);
+    CHECK(key_queue_peek(3) == NULL);
+
+    key_event_t ev;
+    CHECK(key_queue_pop(&ev));
+    CHECK_EQ(ev.keycodes[0], KC_A);
+    // Stamped with the time of the push
+    CHECK_EQ(ev.enqueue_time_us, 100);
+    key_queue_discard(1);
+    CHECK(key_queue_pop(&ev));
+    CHECK_EQ(ev.keycodes[0], KC_A + 2);
+    CHECK_EQ(ev.enqueue_time_us, 300);
+    CHECK(!key_queue_pop(&ev));
+    CHECK(key_queue_empty());
+
+    key_queue_stats_t stats;
+    key_queue_get_stats(&stats);
+    CHECK_EQ(stats.enqueued, 3);
+    CHECK_EQ(stats.dequeued, 3);
+    CHECK_EQ(stats.dropped, 0);
+    CHECK_EQ(stats.high_water, 3);
+}
+
+TEST(key_queue_full) {
+    queue_start();
+    key_event_t ev = KEY_EVENT_TAP(0, KC_A);
+    for (int i = 0; i < KEY_QUEUE_SIZE; i++) CHECK(key_queue_push(&ev));
+    CHECK_EQ(key_queue_free(), 0);
+    CHECK(!key_queue_push(&ev));
+
+    key_queue_stats_t stats;
+    key_queue_get_stats(&stats);
+    CHECK_EQ(stats.enqueued, KEY_QUEUE_SIZE);
+    CHECK_EQ(stats.dropped, 1);
+    CHECK_EQ(stats.high_water, KEY_QUEUE_SIZE);
+
+    // Without backpressure the producer is always told there is room
+    key_queue_set_policy(KEY_QUEUE_DROP_NEWEST);
+    CHECK_EQ(key_queue_free(), KEY_QUEUE_SIZE);
+    key_queue_set_policy(KEY_QUEUE_BACKPRESSURE);
+
+    // Indexes stay right across the wrap of the ring
+    key_queue_discard(KEY_QUEUE_SIZE - 2);
+    CHECK_EQ(key_queue_free(), KEY_QUEUE_SIZE - 2);
+    for (uint8_t i = 0; i < 4; i++) {
+        key_event_t tap = KEY_EVENT_TAP(0, (uint8_t)(KC_A + 1 + i));
+        CHECK(key_queue_push(&tap));
+    }
+    CHECK_EQ(key_queue_size(), 6);
+    CHECK_EQ(key_queue_peek(1)->keycodes[0], KC_A);
+    CHECK_EQ(key_queue_peek(5)->keycodes[0], KC_A + 4);
+    key_queue_get_stats(&stats);
+    CHECK_EQ(stats.dequeued, KEY_QUEUE_SIZE - 2);
+}
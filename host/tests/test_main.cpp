@@ -0,0 +1,110 @@
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bridge.h"
+#include "keymap.h"
+#include "log.h"
+
+// Same step as bridge_sim
+#define TEST_TICK_US 10
+
+// Give up when the bridge has not finished this long after starting
+#define TEST_TIMEOUT_US 60000000ull
+
+// Most test cases in one binary
+#define TEST_MAX 64
+
+typedef struct {
+    const char *name;
+    test_fn_t fn;
+} test_case_t;
+
+static test_case_t cases[TEST_MAX];
+static int case_count = 0;
+static bool failed = false;
+static uint32_t poll_interval_us = 0;
+
+test_registrar_t::test_registrar_t(const char *name, test_fn_t fn) {
+    if (case_count < TEST_MAX) cases[case_count++] = { name, fn };
+}
+
+void test_fail(const char *file, int line, const char *expr) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    failed = true;
+}
+
+void test_fail_eq(const char *file, int line, const char *a, const char *b, long long va, long long vb) {
+    fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", file, line, a, b, va, vb);
+    failed = true;
+}
+
+void test_default_config(bridge_config_t *config, const hid_timing_t *timing, uint8_t pack) {
+    *config = bridge_config_t{};
+    config->baud_rate = 115200;
+    config->layout = LAYOUT_US;
+    config->pacing = timing->pacing;
+    config->hold_us = timing->hold_us;
+    config->gap_us = timing->gap_us;
+    config->pack_limit = pack;
+    config->log_level = LOG_LEVEL_NONE;
+    for (uint8_t &pin : config->input_pin) pin = CONFIG_PIN_NONE;
+    for (uint8_t &weight : config->weight) weight = 1;
+}
+
+void test_bridge_start(const sim_config_t *sim, const hid_timing_t *timing, uint8_t pack) {
+    sim_init(sim);
+    poll_interval_us = sim->poll_interval_us;
+    bridge_config_t defaults;
+    test_default_config(&defaults, timing, pack);
+    config_store_init(&defaults);
+    bridge_init();
+}
+
+void test_run_idle(void) {
+    uint64_t start = sim_now();
+    while (sim_uart_busy() || !hid_engine_idle()) {
+        sim_advance(TEST_TICK_US);
+        bridge_uart_task();
+        bridge_hid_task();
+        if (sim_now() - start > TEST_TIMEOUT_US) {
+            test_fail(__FILE__, __LINE__, "bridge did not finish");
+            return;
+        }
+    }
+    // Let the host read the final report
+    sim_advance(poll_interval_us);
+}
+
+static int run_case(const test_case_t *tc) {
+    failed = false;
+    tc->fn();
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 0; i < case_count; i++) {
+            if (!strcmp(cases[i].name, argv[1])) return run_case(&cases[i]);
+        }
+        fprintf(stderr, "unknown test %s\n", argv[1]);
+        return 2;
+    }
+
+    int failures = 0;
+    for (int i = 0; i < case_count; i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) _exit(run_case(&cases[i]));
+        int status = 1;
+        waitpid(pid, &status, 0);
+        bool ok = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        printf("%-28s %s\n", cases[i].name, ok ? "ok" : "FAILED");
+        if (!ok) failures++;
+    }
+    printf("%d of %d failed\n", failures, case_count);
+    return failures ? 1 : 0;
+}
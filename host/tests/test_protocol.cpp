@@ -0,0 +1,193 @@
+// Framed command protocol: checks, all or nothing execution, sequence numbers
+
+#include <string.h>
+
+#include <vector>
+
+#include "cobs.h"
+#include "crc16.h"
+#include "hid_keycodes.h"
+#include "key_queue.h"
+#include "protocol.h"
+#include "test.h"
+
+typedef std::vector<uint8_t> bytes_t;
+
+// Bytes of sim_uart_output() already parsed into replies
+static size_t output_read = 0;
+
+static void protocol_start(void) {
+    sim_config_t sim = SIM_CONFIG_DEFAULT;
+    hid_timing_t timing = HID_TIMING_FAST;
+    test_bridge_start(&sim, &timing, HID_PACK_MAX);
+    protocol_reset();
+    output_read = 0;
+}
+
+// Feeds one frame to the receiver, with a damaged CRC if asked
+static void send_frame(uint8_t seq, const bytes_t &records, bool bad_crc = false) {
+    bytes_t frame(1, seq);
+    frame.insert(frame.end(), records.begin(), records.end());
+    uint16_t crc = crc16(frame.data(), frame.size()) ^ (bad_crc ? 1 : 0);
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+
+    uint8_t encoded[COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX)];
+    size_t len = cobs_encode(frame.data(), frame.size(), encoded);
+    protocol_rx_byte(0, 0);
+    for (size_t i = 0; i < len; i++) protocol_rx_byte(encoded[i], 0);
+    protocol_rx_byte(0, 0);
+}
+
+// Next reply the bridge wrote, [seq] [status] [data]... without the CRC,
+// empty if there is none. Diagnostics between the frames are skipped.
+static bytes_t next_reply(void) {
+    const std::string &out = sim_uart_output();
+    while (true) {
+        while (output_read < out.size() && out[output_read] == 0) output_read++;
+        size_t end = out.find('\0', output_read);
+        if (end == std::string::npos) return bytes_t();
+
+        bytes_t reply(out.begin() + output_read, out.begin() + end);
+        output_read = end;
+        size_t len = cobs_decode(reply.data(), reply.size(), reply.data());
+        if (len < 4 || crc16(reply.data(), len - 2) != (reply[len - 2] | (reply[len - 1] << 8))) continue;
+        reply.resize(len - 2);
+        return reply;
+    }
+}
+
+// Taps of count distinct keys in one record
+static bytes_t taps(uint8_t count) {
+    bytes_t record = { CMD_KEY_TAP, (uint8_t)(2 * count) };
+    for (uint8_t i = 0; i < count; i++) {
+        record.push_back(0);
+        record.push_back((uint8_t)(KC_A + i % 26));
+    }
+    return record;
+}
+
+static bytes_t join(bytes_t a, const bytes_t &b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+static const bytes_t ping = { CMD_PING, 0 };
+
+TEST(protocol_ack) {
+    protocol_start();
+    send_frame(5, taps(2));
+    CHECK(next_reply() == bytes_t({ 5, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 2);
+    CHECK_EQ(key_queue_peek(1)->keycodes[0], KC_A + 1);
+
+    send_frame(6, ping, true);
+    CHECK(next_reply() == bytes_t({ 6, PROTO_NACK_CRC }));
+    // Down and up may be modifier only
+    send_frame(6, { CMD_KEY_DOWN, 2, MOD_LSHIFT, 0, CMD_KEY_UP, 2, MOD_LSHIFT, 0 });
+    CHECK(next_reply() == bytes_t({ 6, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 4);
+
+    protocol_stats_t stats;
+    protocol_get_stats(&stats);
+    CHECK_EQ(stats.frames, 3);
+    CHECK_EQ(stats.acks, 2);
+    CHECK_EQ(stats.crc_errors, 1);
+}
+
+TEST(protocol_all_or_nothing) {
+    protocol_start();
+    // Every record is checked before the first one runs
+    send_frame(0, join(taps(3), { 0x7F, 0 }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_NACK_UNKNOWN }));
+    send_frame(0, join(taps(3), { CMD_KEY_TAP, 2, 0, 0 }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_NACK_MALFORMED }));
+    send_frame(0, join(taps(3), { CMD_DELAY, 3, 1, 2, 3 }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_NACK_MALFORMED }));
+    // A record running past the end of the frame
+    send_frame(0, join(taps(3), { CMD_TEXT, 4, 'a' }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_NACK_MALFORMED }));
+    send_frame(0, join(taps(3), { CMD_MACRO_RUN, 2, 0x34, 0x12 }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_NACK_NOT_FOUND }));
+    CHECK_EQ(key_queue_size(), 0);
+
+    // Refused frames do not use up their seq
+    send_frame(0, join(taps(3), { CMD_DELAY, 4, 1, 2, 3, 4 }));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 4);
+    CHECK_EQ(key_queue_peek(3)->type, KEY_EV_DELAY);
+    CHECK_EQ(key_queue_peek(3)->delay_us, 0x04030201);
+}
+
+TEST(protocol_sequence) {
+    protocol_start();
+    // The first frame sets the sequence
+    send_frame(10, taps(1));
+    CHECK(next_reply() == bytes_t({ 10, PROTO_ACK }));
+    send_frame(12, taps(1));
+    CHECK(next_reply() == bytes_t({ 12, PROTO_NACK_SEQ, 11 }));
+    send_frame(11, taps(1));
+    CHECK(next_reply() == bytes_t({ 11, PROTO_ACK }));
+
+    // A repeat is ACKed without running it again
+    send_frame(10, taps(1));
+    CHECK(next_reply() == bytes_t({ 10, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 2);
+    protocol_stats_t stats;
+    protocol_get_stats(&stats);
+    CHECK_EQ(stats.duplicates, 1);
+
+    // A repeated query gets no data
+    send_frame(12, { CMD_QUERY, 2, QUERY_CLOCK, 0 });
+    CHECK_EQ(next_reply().size(), 2 + 16);
+    send_frame(12, { CMD_QUERY, 2, QUERY_CLOCK, 0 });
+    CHECK(next_reply() == bytes_t({ 12, PROTO_ACK }));
+
+    // Only the last PROTO_DUP_WINDOW frames count as repeats, older ones
+    // learn the expected seq. Executed are 10..31, 32 is next.
+    for (uint8_t seq = 13; seq < 32; seq++) {
+        send_frame(seq, ping);
+        CHECK(next_reply() == bytes_t({ seq, PROTO_ACK }));
+    }
+    send_frame(32 - PROTO_DUP_WINDOW, ping);
+    CHECK(next_reply() == bytes_t({ 32 - PROTO_DUP_WINDOW, PROTO_ACK }));
+    send_frame(31 - PROTO_DUP_WINDOW, ping);
+    CHECK(next_reply() == bytes_t({ 31 - PROTO_DUP_WINDOW, PROTO_NACK_SEQ, 32 }));
+    send_frame(10, taps(1));
+    CHECK(next_reply() == bytes_t({ 10, PROTO_NACK_SEQ, 32 }));
+    CHECK_EQ(key_queue_size(), 2);
+
+    // The seq wraps around
+    for (int i = 32; i < 256 + 2; i++) {
+        send_frame((uint8_t)i, ping);
+        CHECK(next_reply() == bytes_t({ (uint8_t)i, PROTO_ACK }));
+    }
+    send_frame(255, ping);
+    CHECK(next_reply() == bytes_t({ 255, PROTO_ACK }));
+    protocol_get_stats(&stats);
+    CHECK_EQ(stats.duplicates, 4);
+}
+
+TEST(protocol_busy) {
+    protocol_start();
+    send_frame(0, taps(40));
+    CHECK(next_reply() == bytes_t({ 0, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 40);
+
+    // Refused as a whole while the queue has no room for all of it
+    send_frame(1, join(taps(20), taps(20)));
+    CHECK(next_reply() == bytes_t({ 1, PROTO_NACK_BUSY }));
+    CHECK_EQ(key_queue_size(), 40);
+    send_frame(1, taps(KEY_QUEUE_SIZE - 40));
+    CHECK(next_reply() == bytes_t({ 1, PROTO_ACK }));
+    CHECK_EQ(key_queue_free(), 0);
+
+    // Accepted once the keys have been typed
+    send_frame(2, taps(40));
+    CHECK(next_reply() == bytes_t({ 2, PROTO_NACK_BUSY }));
+    test_run_idle();
+    CHECK_EQ(key_queue_size(), 0);
+    send_frame(2, taps(40));
+    CHECK(next_reply() == bytes_t({ 2, PROTO_ACK }));
+    CHECK_EQ(key_queue_size(), 40);
+}
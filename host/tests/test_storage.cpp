@@ -0,0 +1,276 @@
+// Flash stores: the macro log with its compaction and CRCs, and the two
+// config slots with their sequence numbers and sanitizing
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+#include "crc16.h"
+#include "hal.h"
+#include "keymap.h"
+#include "macro_store.h"
+#include "test.h"
+#include "unicode.h"
+
+// Layout of a config slot, as written by config_store.cpp
+#define BLOB_MAGIC 0x47464342u
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;
+    uint32_t sequence;
+    uint16_t crc;
+    uint16_t reserved;
+} blob_header_t;
+
+static void storage_start(void) {
+    sim_config_t sim = SIM_CONFIG_DEFAULT;
+    sim_init(&sim);
+}
+
+// Clears the bits of one byte of flash, which breaks whatever CRC covers it
+static void damage_byte(size_t offset) {
+    uint8_t page[HAL_STORAGE_PAGE];
+    memset(page, 0xFF, sizeof(page));
+    page[offset % HAL_STORAGE_PAGE] = 0;
+    hal_storage_program(offset - offset % HAL_STORAGE_PAGE, page, sizeof(page));
+}
+
+// Steps of a macro, all bytes set to fill except the reserved byte
+static std::vector<uint8_t> macro_data(uint16_t len, uint8_t fill) {
+    std::vector<uint8_t> data(len, fill);
+    for (uint16_t i = 1; i < len; i += MACRO_STEP_LEN) data[i] = 0;
+    return data;
+}
+
+static bool macro_write(uint16_t id, const std::vector<uint8_t> &data) {
+    return macro_store_begin(id, (uint16_t)data.size()) && macro_store_append(data.data(), data.size()) &&
+        macro_store_commit();
+}
+
+// True when the stored macro has the data
+static bool macro_equal(uint16_t id, const std::vector<uint8_t> &data) {
+    for (uint16_t i = 0; i < data.size() / MACRO_STEP_LEN; i++) {
+        const uint8_t *step = macro_store_step(id, i);
+        if (!step || memcmp(step, &data[i * MACRO_STEP_LEN], MACRO_STEP_LEN)) return false;
+    }
+    return macro_store_step(id, (uint16_t)(data.size() / MACRO_STEP_LEN)) == NULL;
+}
+
+TEST(macro_append) {
+    storage_start();
+    macro_store_init();
+    std::vector<uint8_t> data = macro_data(24, 0x11);
+
+    CHECK(macro_store_begin(7, 24));
+    CHECK(macro_store_append(data.data(), 16));
+    // Incomplete, and more than announced
+    CHECK(!macro_store_commit());
+    CHECK(!macro_store_append(data.data(), 16));
+    CHECK(macro_store_append(&data[16], 8));
+    CHECK(macro_store_commit());
+    CHECK(macro_equal(7, data));
+    CHECK(!macro_store_exists(8));
+    CHECK(!macro_store_begin(9, 12));
+
+    macro_store_stats_t stats;
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.count, 1);
+    // Bank header, then the record header and data
+    CHECK_EQ(stats.used, 8 + 8 + 24);
+
+    // The index is rebuilt from flash
+    macro_store_init();
+    CHECK(macro_equal(7, data));
+    CHECK(macro_store_delete(7));
+    CHECK(!macro_store_exists(7));
+    macro_store_init();
+    CHECK(!macro_store_exists(7));
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.count, 0);
+    CHECK_EQ(stats.used, 8 + 8 + 24 + 8);
+}
+
+TEST(macro_compaction) {
+    storage_start();
+    macro_store_init();
+    std::vector<uint8_t> other = macro_data(16, 0x22);
+    CHECK(macro_write(2, other));
+    // The first write sets up bank 0 the same way
+    macro_store_stats_t stats;
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.compactions, 1);
+    CHECK_EQ(stats.bank, 0);
+
+    // Each version of macro 1 is appended until the bank is full, then the
+    // live macros move to the other bank. Seven fit behind macro 2.
+    for (uint8_t version = 1; version <= 10; version++) {
+        CHECK(macro_store_has_room(1, MACRO_MAX_LEN));
+        CHECK(macro_write(1, macro_data(MACRO_MAX_LEN, version)));
+        macro_store_get_stats(&stats);
+        CHECK_EQ(stats.compactions, version < 8 ? 1 : 2);
+    }
+    CHECK_EQ(stats.bank, 1);
+    CHECK_EQ(stats.generation, 2);
+    CHECK_EQ(stats.count, 2);
+    CHECK(macro_equal(1, macro_data(MACRO_MAX_LEN, 10)));
+    CHECK(macro_equal(2, other));
+
+    // The newer generation wins at boot
+    macro_store_init();
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.bank, 1);
+    CHECK_EQ(stats.generation, 2);
+    CHECK(macro_equal(1, macro_data(MACRO_MAX_LEN, 10)));
+    CHECK(macro_equal(2, other));
+}
+
+TEST(macro_crc) {
+    storage_start();
+    macro_store_init();
+    std::vector<uint8_t> first = macro_data(16, 0x33);
+    CHECK(macro_write(1, first));
+    CHECK(macro_write(2, macro_data(16, 0x44)));
+
+    // A record failing its CRC ends the log, like an interrupted write
+    damage_byte(macro_store_step(2, 1) - hal_storage());
+    macro_store_init();
+    CHECK(macro_equal(1, first));
+    CHECK(!macro_store_exists(2));
+    macro_store_stats_t stats;
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.used, MACRO_BANK_SIZE);
+
+    // Nothing is appended behind it, the next write compacts
+    std::vector<uint8_t> third = macro_data(16, 0x55);
+    CHECK(macro_write(3, third));
+    macro_store_get_stats(&stats);
+    CHECK_EQ(stats.bank, 1);
+    macro_store_init();
+    CHECK(macro_equal(1, first));
+    CHECK(macro_equal(3, third));
+    CHECK(!macro_store_exists(2));
+}
+
+static bridge_config_t defaults;
+
+static void config_start(void) {
+    storage_start();
+    hid_timing_t fast = HID_TIMING_FAST;
+    test_default_config(&defaults, &fast, HID_PACK_MAX);
+    defaults.utf8 = 1;
+    config_store_init(&defaults);
+}
+
+static uint32_t config_value(uint8_t key) {
+    uint32_t value = 0;
+    config_get_value(key, &value);
+    return value;
+}
+
+static uint32_t slot_sequence(int slot) {
+    blob_header_t header;
+    memcpy(&header, hal_storage() + CONFIG_STORE_OFFSET + slot * HAL_STORAGE_SECTOR, sizeof(header));
+    return header.magic == BLOB_MAGIC ? header.sequence : 0;
+}
+
+// Writes a config copy the way an older or newer firmware might have
+static void slot_write(int slot, uint32_t sequence, const bridge_config_t *config, uint16_t len) {
+    uint8_t page[HAL_STORAGE_PAGE];
+    memset(page, 0xFF, sizeof(page));
+    blob_header_t header = { BLOB_MAGIC, CONFIG_VERSION, len, sequence, 0, 0xFFFF };
+    memcpy(&page[sizeof(header)], config, len);
+    header.crc = crc16_update(crc16((const uint8_t *)&header.version, 8), &page[sizeof(header)], len);
+    memcpy(page, &header, sizeof(header));
+    size_t offset = CONFIG_STORE_OFFSET + slot * HAL_STORAGE_SECTOR;
+    hal_storage_erase(offset, HAL_STORAGE_SECTOR);
+    hal_storage_program(offset, page, sizeof(page));
+}
+
+TEST(config_slots) {
+    config_start();
+    CHECK(!config_dirty());
+    // Nothing to write
+    CHECK(config_commit());
+    CHECK_EQ(sim_storage_writes(), 0);
+
+    // Commits go to the slot not holding the stored config
+    CHECK(config_set_value(CONFIG_LAYOUT, LAYOUT_FI));
+    CHECK(config_dirty());
+    CHECK(config_commit());
+    CHECK(!config_dirty());
+    CHECK_EQ(slot_sequence(0), 1);
+    CHECK(config_set_value(CONFIG_LAYOUT, LAYOUT_DE));
+    CHECK(config_commit());
+    CHECK_EQ(slot_sequence(1), 2);
+
+    // The higher sequence wins, whichever slot it is in
+    config_store_init(&defaults);
+    CHECK_EQ(config_value(CONFIG_LAYOUT), LAYOUT_DE);
+    CHECK(config_set_value(CONFIG_LAYOUT, LAYOUT_KEYPAD));
+    CHECK(config_commit());
+    CHECK_EQ(slot_sequence(0), 3);
+    config_store_init(&defaults);
+    CHECK_EQ(config_value(CONFIG_LAYOUT), LAYOUT_KEYPAD);
+
+    // A damaged newest copy leaves the previous one in place
+    damage_byte(CONFIG_STORE_OFFSET + sizeof(blob_header_t) + offsetof(bridge_config_t, baud_rate) + 1);
+    config_store_init(&defaults);
+    CHECK_EQ(config_value(CONFIG_LAYOUT), LAYOUT_DE);
+    CHECK(!config_dirty());
+
+    // Back to the defaults until the next commit
+    config_reset();
+    CHECK_EQ(config_value(CONFIG_LAYOUT), LAYOUT_US);
+    CHECK(config_dirty());
+}
+
+TEST(config_sequence_wrap) {
+    config_start();
+    bridge_config_t config = defaults;
+    config.layout = LAYOUT_FI;
+    slot_write(0, 0xFFFFFFFF, &config, sizeof(config));
+    config.layout = LAYOUT_DE;
+    slot_write(1, 0, &config, sizeof(config));
+
+    // 0 follows 0xFFFFFFFF, and the next commit goes to slot 0 as 1
+    config_store_init(&defaults);
+    CHECK_EQ(config_value(CONFIG_LAYOUT), LAYOUT_DE);
+    CHECK(config_set_value(CONFIG_LAYOUT, LAYOUT_US));
+    CHECK(config_commit());
+    CHECK_EQ(slot_sequence(0), 1);
+}
+
+TEST(config_sanitize) {
+    config_start();
+    bridge_config_t config = defaults;
+    config.baud_rate = 5;
+    config.layout = LAYOUT_COUNT;
+    config.pack_limit = 0;
+    config.hold_us = 20000;
+    config.weight[1] = CONFIG_WEIGHT_MAX + 1;
+    config.input_pin[0] = CONFIG_PIN_MAX + 1;
+    config.unicode_method = UNICODE_WINDOWS;
+    config.reserved[0] = 0x5A;
+    // An older firmware's blob ends before the UTF-8 flag
+    config.utf8 = 0;
+    slot_write(1, 7, &config, offsetof(bridge_config_t, utf8));
+
+    // Values this firmware does not accept are replaced with the defaults
+    config_store_init(&defaults);
+    bridge_config_t loaded;
+    config_get(&loaded);
+    CHECK_EQ(loaded.baud_rate, defaults.baud_rate);
+    CHECK_EQ(loaded.layout, defaults.layout);
+    CHECK_EQ(loaded.pack_limit, defaults.pack_limit);
+    CHECK_EQ(loaded.hold_us, 20000);
+    CHECK_EQ(loaded.weight[1], defaults.weight[1]);
+    CHECK_EQ(loaded.input_pin[0], CONFIG_PIN_NONE);
+    CHECK_EQ(loaded.reserved[0], 0);
+    CHECK_EQ(loaded.utf8, 1);
+    // Fields past the end of the blob are taken from the defaults
+    CHECK_EQ(loaded.unicode_method, defaults.unicode_method);
+    CHECK(!config_dirty());
+}
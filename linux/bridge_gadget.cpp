@@ -0,0 +1,160 @@
+// Runs the bridge on a Linux board with a USB device controller: input from
+// a tty or stdin is typed through the configfs HID gadget devices.
+//
+//   bridge_gadget [options]
+//
+//   --keyboard PATH   keyboard gadget device, "none" drops the reports (/dev/hidg0)
+//   --consumer PATH   consumer control gadget device (none)
+//   --mouse PATH      mouse gadget device (none)
+//   --input PATH      bridge UART, a tty or file, "-" is stdin (-)
+//   --input1 PATH     second input channel, receive only (none)
+//   --input2 PATH     third input channel, receive only (none)
+//   --baud N          baud rate of tty inputs (115200)
+//   --flow            RTS/CTS flow control on tty inputs
+//   --layout NAME     keypad, us, fi or de (us)
+//   --timing NAME     fast, safe or legacy (fast)
+//   --utf8            input text is UTF-8 rather than Latin-1
+//   --unicode NAME    host hex input method, none, linux or windows (none)
+//   --log-level N     diagnostics written to the bridge UART, 0 none to 4 debug (0)
+//   --storage FILE    keeps the config and macros, like the Pico flash (in RAM)
+//   --follow          keeps running at the end of the input
+//   --report-desc N   writes the report descriptor of keyboard, consumer or
+//                     mouse to stdout and exits
+//   --function N      prints "<protocol> <report length>" of the function and exits
+//
+// gadget_setup.sh uses the last two to create the gadget functions. Exits
+// once every input has ended and the last key has been released.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bridge.h"
+#include "config_store.h"
+#include "consumer_engine.h"
+#include "gadget_desc.h"
+#include "hal_linux.h"
+#include "hid_engine.h"
+#include "ingest.h"
+#include "keymap.h"
+#include "log.h"
+#include "mouse_engine.h"
+#include "unicode.h"
+
+// Longest sleep of an idle loop, input, reports and alarms wake it earlier
+#define GADGET_IDLE_WAKE_US 1000000
+
+static keymap_layout_t parse_layout(const char *name) {
+    if (!strcmp(name, "keypad")) return LAYOUT_KEYPAD;
+    if (!strcmp(name, "fi")) return LAYOUT_FI;
+    if (!strcmp(name, "de")) return LAYOUT_DE;
+    return LAYOUT_US;
+}
+
+static hid_timing_t parse_timing(const char *name) {
+    hid_timing_t fast = HID_TIMING_FAST;
+    hid_timing_t safe = HID_TIMING_SAFE;
+    hid_timing_t legacy = HID_TIMING_LEGACY;
+    if (!strcmp(name, "safe")) return safe;
+    if (!strcmp(name, "legacy")) return legacy;
+    return fast;
+}
+
+static unicode_method_t parse_unicode(const char *name) {
+    if (!strcmp(name, "linux")) return UNICODE_LINUX;
+    if (!strcmp(name, "windows")) return UNICODE_WINDOWS;
+    return UNICODE_NONE;
+}
+
+static int parse_instance(const char *name) {
+    if (!strcmp(name, "keyboard")) return HID_INSTANCE_KEYBOARD;
+    if (!strcmp(name, "consumer")) return HID_INSTANCE_CONSUMER;
+    if (!strcmp(name, "mouse")) return HID_INSTANCE_MOUSE;
+    return -1;
+}
+
+static const char *parse_path(const char *path) {
+    return strcmp(path, "none") ? path : NULL;
+}
+
+int main(int argc, char **argv) {
+    linux_hal_config_t hal = {};
+    hal.hidg[HID_INSTANCE_KEYBOARD] = "/dev/hidg0";
+    hal.input[0] = "-";
+    hal.baud_rate = 115200;
+    keymap_layout_t layout = LAYOUT_US;
+    hid_timing_t timing = HID_TIMING_FAST;
+    bool utf8 = false;
+    unicode_method_t method = UNICODE_NONE;
+    uint8_t log_level = LOG_LEVEL_NONE;
+    bool follow = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : "";
+        if (!strcmp(arg, "--keyboard")) { hal.hidg[HID_INSTANCE_KEYBOARD] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--consumer")) { hal.hidg[HID_INSTANCE_CONSUMER] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--mouse")) { hal.hidg[HID_INSTANCE_MOUSE] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--input")) { hal.input[0] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--input1") && HAL_UART_CHANNELS > 1) { hal.input[1] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--input2") && HAL_UART_CHANNELS > 2) { hal.input[2] = parse_path(val); i++; }
+        else if (!strcmp(arg, "--baud")) { hal.baud_rate = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--flow")) { hal.flow_control = true; }
+        else if (!strcmp(arg, "--layout")) { layout = parse_layout(val); i++; }
+        else if (!strcmp(arg, "--timing")) { timing = parse_timing(val); i++; }
+        else if (!strcmp(arg, "--utf8")) { utf8 = true; }
+        else if (!strcmp(arg, "--unicode")) { method = parse_unicode(val); i++; }
+        else if (!strcmp(arg, "--log-level")) { log_level = atoi(val); i++; }
+        else if (!strcmp(arg, "--storage")) { hal.storage = val; i++; }
+        else if (!strcmp(arg, "--follow")) { follow = true; }
+        else if (!strcmp(arg, "--report-desc") || !strcmp(arg, "--function")) {
+            int instance = parse_instance(val);
+            if (instance < 0) {
+                fprintf(stderr, "%s: unknown function %s\n", arg, val);
+                return 2;
+            }
+            const gadget_hid_desc_t *desc = gadget_hid_desc(instance);
+            if (!strcmp(arg, "--function")) {
+                printf("%u %u\n", desc->protocol, desc->report_len);
+                return 0;
+            }
+            return write(STDOUT_FILENO, desc->desc, desc->len) == (ssize_t)desc->len ? 0 : 1;
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return 2;
+        }
+    }
+
+    if (!linux_hal_init(&hal)) return 1;
+
+    // The options stand in for the build time defaults, a config in the
+    // storage file replaces them. The ttys keep the rate given here.
+    bridge_config_t defaults = {};
+    defaults.baud_rate = hal.baud_rate;
+    defaults.layout = layout;
+    defaults.pacing = timing.pacing;
+    defaults.hold_us = timing.hold_us;
+    defaults.gap_us = timing.gap_us;
+    defaults.pack_limit = HID_PACK_MAX;
+    defaults.log_level = log_level;
+    defaults.utf8 = utf8;
+    defaults.unicode_method = method;
+    for (uint8_t &pin : defaults.input_pin) pin = CONFIG_PIN_NONE;
+    for (uint8_t &weight : defaults.weight) weight = 1;
+    config_store_init(&defaults);
+    bridge_init();
+
+    while (1) {
+        bridge_uart_task();
+        bridge_hid_task();
+
+        bool done = !linux_hal_active() && ingest_idle() && !log_pending()
+            && hid_engine_idle() && consumer_engine_idle() && mouse_engine_idle();
+        if (done && !follow) break;
+
+        bool idle = bridge_uart_idle() && (bridge_hid_idle() || linux_hal_hid_blocked());
+        linux_hal_poll(idle ? GADGET_IDLE_WAKE_US : 0);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef GADGET_DESC_H_
+#define GADGET_DESC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Report descriptors of the HID instances for the configfs gadget, byte for
+// byte the ones src/usb_descriptors.c builds with the TinyUSB macros, so a
+// host sees the same keyboard from either backend. gadget_setup.sh writes
+// them to the functions' report_desc files.
+
+typedef struct {
+    const uint8_t *desc;
+    size_t len;
+    uint8_t protocol;    // bInterfaceProtocol, 1 keyboard, 2 mouse
+    uint8_t report_len;  // Longest input report
+} gadget_hid_desc_t;
+
+// NULL for an unknown instance
+const gadget_hid_desc_t *gadget_hid_desc(uint8_t instance);
+
+#endif /* GADGET_DESC_H_ */
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Creates the USB HID gadget for bridge_gadget through configfs and binds it
+# to a device controller: keyboard, consumer control and mouse functions,
+# which become /dev/hidg0, /dev/hidg1 and /dev/hidg2.
+#
+#   gadget_setup.sh [BRIDGE_GADGET] [UDC]   create and bind
+#   gadget_setup.sh --remove                unbind and remove
+#
+# BRIDGE_GADGET is the bridge_gadget binary that supplies the report
+# descriptors (./bridge_gadget), UDC the controller, the first one in
+# /sys/class/udc by default. For a test on a PC without a device controller,
+# load dummy_hcd first: its dummy_udc.0 is connected to a local host port.
+
+set -e
+
+CONFIGFS=/sys/kernel/config
+GADGET=$CONFIGFS/usb_gadget/uart_hid_bridge
+FUNCTIONS="keyboard consumer mouse"
+
+remove() {
+    [ -d "$GADGET" ] || return 0
+    echo "" > "$GADGET/UDC" 2>/dev/null || true
+    for f in $FUNCTIONS; do
+        rm -f "$GADGET/configs/c.1/hid.$f"
+    done
+    rmdir "$GADGET/configs/c.1/strings/0x409" "$GADGET/configs/c.1"
+    for f in $FUNCTIONS; do
+        rmdir "$GADGET/functions/hid.$f"
+    done
+    rmdir "$GADGET/strings/0x409" "$GADGET"
+}
+
+if [ "$1" = "--remove" ]; then
+    remove
+    exit 0
+fi
+
+BRIDGE_GADGET=${1:-./bridge_gadget}
+UDC=${2:-$(ls /sys/class/udc | head -n 1)}
+if [ -z "$UDC" ]; then
+    echo "no USB device controller, try: modprobe dummy_hcd" >&2
+    exit 1
+fi
+
+modprobe libcomposite 2>/dev/null || true
+mountpoint -q $CONFIGFS || mount -t configfs none $CONFIGFS
+remove
+
+# Same IDs and strings as src/usb_descriptors.c
+mkdir -p "$GADGET/strings/0x409"
+echo 0x13BA > "$GADGET/idVendor"
+echo 0x0001 > "$GADGET/idProduct"
+echo 0x0100 > "$GADGET/bcdDevice"
+echo 0x0110 > "$GADGET/bcdUSB"
+echo "Logitech" > "$GADGET/strings/0x409/manufacturer"
+echo "Port_#0002.Hub_#0002" > "$GADGET/strings/0x409/product"
+echo "123456" > "$GADGET/strings/0x409/serialnumber"
+
+mkdir -p "$GADGET/configs/c.1/strings/0x409"
+echo "HID bridge" > "$GADGET/configs/c.1/strings/0x409/configuration"
+echo 100 > "$GADGET/configs/c.1/MaxPower"
+echo 0xA0 > "$GADGET/configs/c.1/bmAttributes"
+
+# Created in instance order, so the keyboard gets /dev/hidg0
+for f in $FUNCTIONS; do
+    dir="$GADGET/functions/hid.$f"
+    mkdir -p "$dir"
+    set -- $("$BRIDGE_GADGET" --function $f)
+    echo "$1" > "$dir/protocol"
+    [ "$1" = 0 ] && echo 0 > "$dir/subclass" || echo 1 > "$dir/subclass"
+    echo "$2" > "$dir/report_length"
+    "$BRIDGE_GADGET" --report-desc $f > "$dir/report_desc"
+    ln -s "$dir" "$GADGET/configs/c.1/"
+done
+
+echo "$UDC" > "$GADGET/UDC"
+echo "bound to $UDC"
@@ -0,0 +1,476 @@
+#include "hal_linux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bridge.h"
+#include "ring_buffer.h"
+
+// Received bytes waiting for ingest, per input. A full ring stops reading
+// its input, so the kernel buffer and tty flow control hold the rest back.
+#define LINUX_RX_RING 4096
+
+// Replies and log output waiting for the bridge UART
+#define LINUX_TX_RING 4096
+
+// Bytes read from an input per read() call
+#define LINUX_READ_CHUNK 256
+
+// Longest wait while output is still to be written
+#define LINUX_TX_RETRY_US 1000
+
+// Time between reports offered to a gadget no host has configured. Its
+// device stays writable then, so epoll cannot tell when a host connects.
+#define LINUX_HID_RETRY_US 1000000
+
+#define LINUX_EPOLL_EVENTS 16
+
+typedef struct {
+    uint8_t ch;
+    uint32_t time_us;
+} rx_byte_t;
+
+typedef struct {
+    int fd;          // -1 when unused
+    bool open;       // Until the end of the input
+    bool polled;     // A regular file, epoll cannot watch it and it is always read
+    bool reading;    // EPOLLIN is armed
+    ring_buffer<rx_byte_t, LINUX_RX_RING> rx;
+} input_t;
+
+typedef struct {
+    int fd;          // -1 drops the reports
+    bool in_flight;  // Written and not read by the host yet, EPOLLOUT is armed
+    bool completed;  // Dropped report, completes on the next poll
+    bool blocked;    // The driver refused a report, until EPOLLOUT or retry_at
+    uint64_t retry_at;  // No host, the next report is tried at this time, 0 when waiting for EPOLLOUT
+} hid_dev_t;
+
+// epoll data of each descriptor, kind and index
+enum {
+    TAG_INPUT = 0x100,
+    TAG_HID   = 0x200,
+    TAG_TIMER = 0x300
+};
+
+static input_t inputs[HAL_UART_CHANNELS];
+static hid_dev_t hid_devs[HID_INSTANCE_COUNT];
+static ring_buffer<uint8_t, LINUX_TX_RING> tx_ring;
+static int out_fd = -1;
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static uint64_t alarm_at = 0;
+static struct timespec start;
+
+static uint8_t storage[HAL_STORAGE_SIZE];
+static int storage_fd = -1;
+
+uint64_t hal_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+//--------------------------------------------------------------------+
+// HID gadget
+//--------------------------------------------------------------------+
+
+static void epoll_set(int fd, uint32_t events, uint32_t tag, int op) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = tag;
+    epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+bool hal_hid_ready(uint8_t instance) {
+    if (instance >= HID_INSTANCE_COUNT) return false;
+    const hid_dev_t &dev = hid_devs[instance];
+    return dev.fd < 0 ? !dev.completed : !dev.in_flight && !dev.blocked;
+}
+
+// The gadget driver handles SET_PROTOCOL itself and does not pass it on
+bool hal_hid_boot_protocol(uint8_t instance) {
+    (void)instance;
+    return false;
+}
+
+bool hal_hid_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len) {
+    if (instance >= HID_INSTANCE_COUNT || report_id) return false;
+    hid_dev_t &dev = hid_devs[instance];
+    if (dev.fd < 0) {
+        dev.completed = true;
+        return true;
+    }
+    if (dev.in_flight) return false;
+    // The driver takes one report at a time, and is writable again once the host has read it
+    if (write(dev.fd, report, len) != len) {
+        dev.blocked = true;
+        if (errno == EAGAIN) {
+            // The host has not read the last report yet
+            epoll_set(dev.fd, EPOLLIN | EPOLLOUT, TAG_HID | instance, EPOLL_CTL_MOD);
+        } else {
+            // ESHUTDOWN when no host has the gadget configured
+            dev.retry_at = hal_time_us() + LINUX_HID_RETRY_US;
+        }
+        return false;
+    }
+    dev.in_flight = true;
+    epoll_set(dev.fd, EPOLLIN | EPOLLOUT, TAG_HID | instance, EPOLL_CTL_MOD);
+    return true;
+}
+
+// The gadget gives no bus state, the host side driver suspends it rarely
+bool hal_usb_suspended(void) {
+    return false;
+}
+
+bool hal_usb_remote_wakeup(void) {
+    return false;
+}
+
+// Frames are not visible through the gadget, aligned events go out at their time
+uint64_t hal_usb_frame_time(void) {
+    return 0;
+}
+
+void hal_alarm_at(uint64_t time_us) {
+    alarm_at = time_us;
+}
+
+void hal_busy_wait_until(uint64_t time_us) {
+    while (hal_time_us() < time_us) {}
+}
+
+//--------------------------------------------------------------------+
+// Inputs
+//--------------------------------------------------------------------+
+
+size_t hal_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max) {
+    if (channel >= HAL_UART_CHANNELS) return 0;
+    size_t n = 0;
+    rx_byte_t b;
+    while (n < max && inputs[channel].rx.pop(b)) {
+        dst[n] = b.ch;
+        if (rx_time_us) rx_time_us[n] = b.time_us;
+        n++;
+    }
+    return n;
+}
+
+size_t hal_uart_write(const uint8_t *src, size_t len) {
+    if (out_fd < 0) return len;
+    size_t n = 0;
+    while (n < len && tx_ring.push(src[n])) n++;
+    return n;
+}
+
+size_t hal_uart_tx_free(void) {
+    return tx_ring.free();
+}
+
+size_t hal_uart_rx_available(uint8_t channel) {
+    return channel < HAL_UART_CHANNELS ? inputs[channel].rx.size() : 0;
+}
+
+// Reads are flow controlled, bytes are never lost to a full ring
+void hal_uart_get_errors(uint8_t channel, hal_uart_errors_t *errors) {
+    (void)channel;
+    memset(errors, 0, sizeof(*errors));
+}
+
+unsigned hal_core_num(void) {
+    return 0;
+}
+
+// Ingest and the engines run in the same thread
+void hal_wake(void) {
+}
+
+//--------------------------------------------------------------------+
+// Storage
+//--------------------------------------------------------------------+
+
+const uint8_t *hal_storage(void) {
+    return storage;
+}
+
+static bool storage_sync(size_t offset, size_t len) {
+    if (storage_fd < 0) return true;
+    if (pwrite(storage_fd, &storage[offset], len, offset) != (ssize_t)len) return false;
+    return fdatasync(storage_fd) == 0;
+}
+
+bool hal_storage_erase(size_t offset, size_t len) {
+    if (offset % HAL_STORAGE_SECTOR || len % HAL_STORAGE_SECTOR || offset + len > HAL_STORAGE_SIZE) return false;
+    memset(&storage[offset], 0xFF, len);
+    return storage_sync(offset, len);
+}
+
+bool hal_storage_program(size_t offset, const void *data, size_t len) {
+    if (offset % HAL_STORAGE_PAGE || len % HAL_STORAGE_PAGE || offset + len > HAL_STORAGE_SIZE) return false;
+    // Like flash, programming only clears bits
+    const uint8_t *src = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) storage[offset + i] &= src[i];
+    return storage_sync(offset, len);
+}
+
+//--------------------------------------------------------------------+
+// Event loop
+//--------------------------------------------------------------------+
+
+static speed_t tty_speed(uint32_t baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+        default: return B115200;
+    }
+}
+
+static void tty_setup(int fd, const linux_hal_config_t *config) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) return;
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, tty_speed(config->baud_rate));
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (config->flow_control) tio.c_cflag |= CRTSCTS;
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+static bool open_input(uint8_t channel, const linux_hal_config_t *config) {
+    input_t &in = inputs[channel];
+    const char *path = config->input[channel];
+    in.fd = -1;
+    if (!path) return true;
+    if (!strcmp(path, "-")) {
+        in.fd = STDIN_FILENO;
+    } else {
+        // The bridge UART answers on its tty
+        struct stat st;
+        bool tty = stat(path, &st) == 0 && S_ISCHR(st.st_mode);
+        in.fd = open(path, (channel == 0 && tty ? O_RDWR : O_RDONLY) | O_NOCTTY);
+        if (in.fd < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+    if (isatty(in.fd) && in.fd != STDIN_FILENO) tty_setup(in.fd, config);
+    fcntl(in.fd, F_SETFL, fcntl(in.fd, F_GETFL) | O_NONBLOCK);
+    in.open = true;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = TAG_INPUT | channel;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in.fd, &ev) < 0) {
+        // Regular files are always ready and cannot be watched
+        in.polled = true;
+    } else {
+        in.reading = true;
+    }
+
+    // The bridge UART answers where its input comes from, stdin answers on stdout
+    if (channel == 0) out_fd = (in.fd == STDIN_FILENO || in.polled) ? STDOUT_FILENO : in.fd;
+    return true;
+}
+
+static bool open_storage(const char *path) {
+    memset(storage, 0xFF, sizeof(storage));
+    if (!path) return true;
+    storage_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (storage_fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    ssize_t n = pread(storage_fd, storage, sizeof(storage), 0);
+    // A new or short file reads as erased flash
+    if (n < (ssize_t)sizeof(storage)) {
+        if (n < 0) n = 0;
+        memset(&storage[n], 0xFF, sizeof(storage) - n);
+        return storage_sync(0, sizeof(storage));
+    }
+    return true;
+}
+
+bool linux_hal_init(const linux_hal_config_t *config) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        perror("epoll");
+        return false;
+    }
+    epoll_set(timer_fd, EPOLLIN, TAG_TIMER, EPOLL_CTL_ADD);
+
+    for (uint8_t i = 0; i < HID_INSTANCE_COUNT; i++) {
+        hid_dev_t &dev = hid_devs[i];
+        dev.fd = -1;
+        if (!config->hidg[i]) continue;
+        dev.fd = open(config->hidg[i], O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (dev.fd < 0) {
+            fprintf(stderr, "%s: %s\n", config->hidg[i], strerror(errno));
+            return false;
+        }
+        // Output reports, the LED state of the keyboard
+        epoll_set(dev.fd, EPOLLIN, TAG_HID | i, EPOLL_CTL_ADD);
+    }
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        if (!open_input(channel, config)) return false;
+    }
+    return open_storage(config->storage);
+}
+
+// Reads what an input has, as far as its ring has room
+static void input_read(uint8_t channel) {
+    input_t &in = inputs[channel];
+    uint8_t buf[LINUX_READ_CHUNK];
+    while (in.open && in.rx.free() > 0) {
+        size_t max = in.rx.free() < sizeof(buf) ? in.rx.free() : sizeof(buf);
+        ssize_t n = read(in.fd, buf, max);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) break;
+        if (n <= 0) {
+            in.open = false;
+            if (in.reading) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, in.fd, NULL);
+            in.reading = false;
+            break;
+        }
+        uint32_t now = (uint32_t)hal_time_us();
+        for (ssize_t i = 0; i < n; i++) in.rx.push({ buf[i], now });
+    }
+}
+
+// Watches an input only while its ring has room
+static void input_update(uint8_t channel) {
+    input_t &in = inputs[channel];
+    if (!in.open || in.polled) return;
+    bool want = in.rx.free() > 0;
+    if (want == in.reading) return;
+    epoll_set(in.fd, want ? (uint32_t)EPOLLIN : 0, TAG_INPUT | channel, EPOLL_CTL_MOD);
+    in.reading = want;
+}
+
+static void hid_event(uint8_t instance, uint32_t events) {
+    hid_dev_t &dev = hid_devs[instance];
+    if (events & EPOLLIN) {
+        uint8_t report[64];
+        ssize_t n = read(dev.fd, report, sizeof(report));
+        // The keyboard's only output report is the lock LED state
+        if (n >= 1) bridge_set_leds(instance, report[0]);
+    }
+    if ((events & EPOLLOUT) && (dev.in_flight || (dev.blocked && !dev.retry_at))) {
+        epoll_set(dev.fd, EPOLLIN, TAG_HID | instance, EPOLL_CTL_MOD);
+        dev.blocked = false;
+        if (dev.in_flight) {
+            dev.in_flight = false;
+            bridge_report_complete(instance);
+        }
+    }
+}
+
+static void tx_flush(void) {
+    uint8_t buf[LINUX_READ_CHUNK];
+    while (!tx_ring.empty()) {
+        struct pollfd pfd = { out_fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) <= 0) return;
+        const uint8_t *next;
+        size_t n = 0;
+        while (n < sizeof(buf) && (next = tx_ring.peek(n)) != NULL) buf[n++] = *next;
+        ssize_t written = write(out_fd, buf, n);
+        if (written <= 0) return;
+        tx_ring.discard(written);
+    }
+}
+
+void linux_hal_poll(uint64_t max_wait_us) {
+    uint64_t now = hal_time_us();
+    uint64_t deadline = now + max_wait_us;
+    if (alarm_at && alarm_at < deadline) deadline = alarm_at;
+    if (!tx_ring.empty() && now + LINUX_TX_RETRY_US < deadline) deadline = now + LINUX_TX_RETRY_US;
+    for (const hid_dev_t &dev : hid_devs) {
+        if (dev.retry_at && dev.retry_at < deadline) deadline = dev.retry_at;
+    }
+
+    bool ready = false;
+    for (const hid_dev_t &dev : hid_devs) ready = ready || dev.completed;
+    for (const input_t &in : inputs) ready = ready || (in.open && in.polled && in.rx.free() > 0);
+
+    int timeout = 0;
+    if (!ready && deadline > now) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        uint64_t ns = (uint64_t)start.tv_sec * 1000000000 + start.tv_nsec + deadline * 1000;
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        timeout = -1;
+    }
+
+    struct epoll_event events[LINUX_EPOLL_EVENTS];
+    int n = epoll_wait(epoll_fd, events, LINUX_EPOLL_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+        uint32_t tag = events[i].data.u32;
+        uint8_t index = tag & 0xFF;
+        switch (tag & 0xFF00) {
+            case TAG_INPUT:
+                input_read(index);
+                break;
+            case TAG_HID:
+                hid_event(index, events[i].events);
+                break;
+            case TAG_TIMER: {
+                uint64_t expirations;
+                ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+                (void)r;
+                break;
+            }
+        }
+    }
+    now = hal_time_us();
+    if (alarm_at && now >= alarm_at) alarm_at = 0;
+    for (hid_dev_t &dev : hid_devs) {
+        if (!dev.retry_at || now < dev.retry_at) continue;
+        dev.blocked = false;
+        dev.retry_at = 0;
+    }
+
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        if (inputs[channel].polled) input_read(channel);
+        input_update(channel);
+    }
+    for (uint8_t i = 0; i < HID_INSTANCE_COUNT; i++) {
+        if (!hid_devs[i].completed) continue;
+        hid_devs[i].completed = false;
+        bridge_report_complete(i);
+    }
+    tx_flush();
+}
+
+bool linux_hal_hid_blocked(void) {
+    for (const hid_dev_t &dev : hid_devs) {
+        if (dev.blocked) return true;
+    }
+    return false;
+}
+
+bool linux_hal_active(void) {
+    for (const input_t &in : inputs) {
+        if (in.open) return true;
+    }
+    return !tx_ring.empty();
+}
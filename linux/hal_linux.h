@@ -0,0 +1,37 @@
+#ifndef HAL_LINUX_H_
+#define HAL_LINUX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "usb_descriptors.h"
+
+// hal.h on Linux: HID reports go to the configfs HID gadget devices
+// (/dev/hidgN), input comes from ttys or stdin and the storage area is
+// kept in a file. Everything runs in one thread around an epoll loop.
+
+typedef struct {
+    const char *hidg[HID_INSTANCE_COUNT];  // Gadget device per HID instance, NULL drops its reports
+    const char *input[HAL_UART_CHANNELS];  // tty or file, "-" is stdin (and stdout), NULL unused
+    uint32_t baud_rate;                    // Of tty inputs
+    bool flow_control;                     // RTS/CTS on tty inputs
+    const char *storage;                   // File backing hal_storage(), NULL keeps it in RAM
+} linux_hal_config_t;
+
+// Opens the devices and inputs, false with a message on stderr if one fails
+bool linux_hal_init(const linux_hal_config_t *config);
+
+// Waits at most max_wait_us, or until the alarm, for input, a report the
+// host has read or an LED report, and hands them to the bridge. 0 only
+// takes what is ready.
+void linux_hal_poll(uint64_t max_wait_us);
+
+// True while a gadget device refuses reports, the engines cannot go on
+// until a host reads it or connects and may be waited for like idle ones
+bool linux_hal_hid_blocked(void);
+
+// True while some input can still send bytes or output is waiting to be written
+bool linux_hal_active(void);
+
+#endif /* HAL_LINUX_H_ */
@@ -0,0 +1,160 @@
+// Host side of an end to end test: reads the keyboard reports of the bridge
+// from its hidraw device, measures the report and key rates and can check
+// the typed text against the text that was sent.
+//
+//   hidraw_meter [options] /dev/hidrawN
+//
+//   --idle-ms N       stop this long after the last report (2000)
+//   --count N         stop after N reports
+//   --layout NAME     layout the text is decoded with, keypad, us, fi or de (us)
+//   --utf8            the text is UTF-8 rather than Latin-1
+//   --leds N          host lock LEDs at start, 1 NumLock, 2 CapsLock (1)
+//   --expect FILE     compare the typed text with the file
+//   --reports         print every report
+//
+// The first report starts the clock, so the meter can be started before the
+// bridge. Exits with 1 when the text does not match.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "keymap.h"
+#include "sim_keyboard.h"
+
+static keymap_layout_t parse_layout(const char *name) {
+    if (!strcmp(name, "keypad")) return LAYOUT_KEYPAD;
+    if (!strcmp(name, "fi")) return LAYOUT_FI;
+    if (!strcmp(name, "de")) return LAYOUT_DE;
+    return LAYOUT_US;
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned pct) {
+    if (sorted.empty()) return 0;
+    return sorted[(sorted.size() - 1) * pct / 100];
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    unsigned idle_ms = 2000;
+    unsigned long max_reports = 0;
+    keymap_layout_t layout = LAYOUT_US;
+    bool utf8 = false;
+    uint8_t leds = 0x01;
+    const char *expect = NULL;
+    bool print_reports = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : "";
+        if (!strcmp(arg, "--idle-ms")) { idle_ms = atoi(val); i++; }
+        else if (!strcmp(arg, "--count")) { max_reports = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--layout")) { layout = parse_layout(val); i++; }
+        else if (!strcmp(arg, "--utf8")) { utf8 = true; }
+        else if (!strcmp(arg, "--leds")) { leds = strtoul(val, NULL, 0); i++; }
+        else if (!strcmp(arg, "--expect")) { expect = val; i++; }
+        else if (!strcmp(arg, "--reports")) { print_reports = true; }
+        else { path = arg; }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: hidraw_meter [options] /dev/hidrawN\n");
+        return 2;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    // Times are relative to the first report
+    std::vector<sim_report_t> reports;
+    uint64_t first = 0;
+    while (!max_reports || reports.size() < max_reports) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, reports.empty() ? -1 : (int)idle_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) break;
+        uint8_t buf[64];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        uint64_t now = now_us();
+        if (reports.empty()) first = now;
+        sim_report_t report;
+        report.time_us = now - first;
+        report.instance = 0;
+        report.report_id = 0;
+        report.data.assign(buf, buf + n);
+        reports.push_back(report);
+        if (print_reports) {
+            printf("%10llu us ", (unsigned long long)report.time_us);
+            for (uint8_t b : report.data) printf(" %02X", b);
+            printf("\n");
+        }
+    }
+    close(fd);
+
+    // A key press is a key down that was not down in the previous report
+    unsigned long keys = 0;
+    std::vector<uint8_t> prev;
+    std::vector<uint64_t> intervals;
+    for (size_t i = 0; i < reports.size(); i++) {
+        std::vector<uint8_t> down = sim_report_keys(reports[i].data);
+        for (uint8_t key : down) {
+            if (std::find(prev.begin(), prev.end(), key) == prev.end()) keys++;
+        }
+        prev = down;
+        if (i) intervals.push_back(reports[i].time_us - reports[i - 1].time_us);
+    }
+    uint64_t sum = 0;
+    for (uint64_t gap : intervals) sum += gap;
+    std::sort(intervals.begin(), intervals.end());
+
+    double seconds = reports.empty() ? 0 : reports.back().time_us / 1e6;
+    printf("reports %zu  keys %lu  time %.3f s  %.1f reports/s  %.1f keys/s\n", reports.size(), keys, seconds,
+        seconds > 0 ? (reports.size() - 1) / seconds : 0.0, seconds > 0 ? keys / seconds : 0.0);
+    if (!intervals.empty()) {
+        printf("interval  min %llu  mean %llu  p50 %llu  p99 %llu  max %llu us\n",
+            (unsigned long long)intervals.front(), (unsigned long long)(sum / intervals.size()),
+            (unsigned long long)percentile(intervals, 50), (unsigned long long)percentile(intervals, 99),
+            (unsigned long long)intervals.back());
+    }
+
+    if (!expect) return 0;
+    std::ifstream file(expect, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "%s: cannot read\n", expect);
+        return 2;
+    }
+    std::string expected((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::replace(expected.begin(), expected.end(), '\r', '\n');
+    keymap_set_layout(layout);
+    std::string typed = sim_keyboard_decode(reports, 0, leds, utf8);
+    if (typed != expected) {
+        size_t pos = 0;
+        while (pos < typed.size() && pos < expected.size() && typed[pos] == expected[pos]) pos++;
+        size_t from = pos > 20 ? pos - 20 : 0;
+        printf("MISMATCH at character %zu of %zu (typed %zu)\n  expected: ...%s\n  typed:    ...%s\n",
+            pos, expected.size(), typed.size(),
+            expected.substr(from, 40).c_str(), typed.substr(from, 40).c_str());
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
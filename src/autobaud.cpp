@@ -0,0 +1,43 @@
+#include "autobaud.h"
+
+static const uint32_t standard_rates[] = {
+    1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 250000,
+    460800, 500000, 921600, 1000000, 1500000, 2000000, 3000000, 4000000
+};
+
+static uint32_t snap_rate(uint32_t baud) {
+    for (uint32_t rate : standard_rates) {
+        uint32_t diff = baud > rate ? baud - rate : rate - baud;
+        if ((uint64_t)diff * 1000 <= (uint64_t)rate * AUTOBAUD_SNAP_PERMILLE) return rate;
+    }
+    return baud;
+}
+
+void autobaud_reset(autobaud_t *ab, uint32_t tick_hz) {
+    ab->count = 0;
+    ab->tick_hz = tick_hz;
+}
+
+uint32_t autobaud_pulse(autobaud_t *ab, uint32_t ticks) {
+    if (ticks == 0 || (uint64_t)ticks * AUTOBAUD_MAX_BAUD < ab->tick_hz) return 0;
+    ab->ticks[ab->count++] = ticks;
+    if (ab->count < AUTOBAUD_SAMPLES) return 0;
+    ab->count = 0;
+
+    uint32_t shortest = UINT32_MAX;
+    for (uint32_t t : ab->ticks) {
+        if (t < shortest) shortest = t;
+    }
+
+    // Mean of the single bit pulses, anything up to 1.25 bit times
+    uint64_t sum = 0;
+    uint32_t singles = 0;
+    for (uint32_t t : ab->ticks) {
+        if ((uint64_t)t * 4 <= (uint64_t)shortest * 5) {
+            sum += t;
+            singles++;
+        }
+    }
+    if (singles < AUTOBAUD_MIN_SINGLE) return 0;
+    return snap_rate((uint32_t)((uint64_t)ab->tick_hz * singles / sum));
+}
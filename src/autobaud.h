@@ -0,0 +1,38 @@
+#ifndef AUTOBAUD_H_
+#define AUTOBAUD_H_
+
+#include <stdint.h>
+
+// Baud rate detection from the lengths of the low pulses on an RX line.
+// The shortest pulses of a stream of 8N1 characters are single bits, e.g.
+// a start bit followed by a 1 bit, so the bit time is found as the mean of
+// the pulses close to the shortest one. Sending a few 'U' (0x55), which
+// is all single bits, locks fastest. The characters used for detection are
+// lost.
+
+// Low pulses collected before a rate is picked
+#define AUTOBAUD_SAMPLES 32
+
+// Pulses that must agree with the shortest one, fewer means it was a glitch
+#define AUTOBAUD_MIN_SINGLE 6
+
+// Rates within this many per mille of a standard rate are snapped to it
+#define AUTOBAUD_SNAP_PERMILLE 30
+
+// Fastest rate detected, shorter pulses are treated as glitches
+#define AUTOBAUD_MAX_BAUD 8000000
+
+typedef struct {
+    uint32_t ticks[AUTOBAUD_SAMPLES];
+    uint32_t count;
+    uint32_t tick_hz;
+} autobaud_t;
+
+// Starts a detection with pulse lengths counted in ticks of tick_hz
+void autobaud_reset(autobaud_t *ab, uint32_t tick_hz);
+
+// Feeds the length of one low pulse. Returns the detected baud rate once
+// enough pulses have been seen, 0 while it still needs more.
+uint32_t autobaud_pulse(autobaud_t *ab, uint32_t ticks);
+
+#endif /* AUTOBAUD_H_ */
@@ -0,0 +1,114 @@
+#include "bridge.h"
+
+#include "config_store.h"
+#include "consumer_engine.h"
+#include "hal.h"
+#include "hid_engine.h"
+#include "ingest.h"
+#include "keymap.h"
+#include "log.h"
+#include "macro_store.h"
+#include "mouse_engine.h"
+#include "trace.h"
+#include "unicode.h"
+#include "usb_descriptors.h"
+
+// Set once a remote wakeup has been sent for the current suspend
+static bool wakeup_sent = false;
+
+// Config generation each side has applied. Each side applies the settings
+// of the modules it runs, so a config change never races with them.
+static uint32_t uart_config_gen = 0;
+static uint32_t hid_config_gen = 0;
+
+static bool engines_idle(void) {
+    return hid_engine_idle() && consumer_engine_idle() && mouse_engine_idle();
+}
+
+static void apply_uart_config(void) {
+    bridge_config_t config;
+    uart_config_gen = config_get(&config);
+    keymap_set_layout((keymap_layout_t)config.layout);
+    log_set_level(config.log_level);
+    ingest_set_utf8(config.utf8);
+    unicode_set_method((unicode_method_t)config.unicode_method);
+    trace_set_enabled(config.trace);
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        ingest_set_weight(channel, config.weight[channel]);
+    }
+}
+
+static void apply_hid_config(void) {
+    bridge_config_t config;
+    hid_config_gen = config_get(&config);
+    hid_timing_t timing = { (hid_pacing_t)config.pacing, config.hold_us, config.gap_us };
+    hid_engine_set_timing(&timing);
+    hid_engine_set_pack_limit(config.pack_limit);
+}
+
+void bridge_init(void) {
+    hid_engine_init();
+    consumer_engine_init();
+    mouse_engine_init();
+    macro_store_init();
+    ingest_init();
+    apply_uart_config();
+    apply_hid_config();
+}
+
+void bridge_uart_task(void) {
+    if (config_generation() != uart_config_gen) apply_uart_config();
+
+    // New events for the USB side, which may be asleep on the other core
+    if (ingest_task()) hal_wake();
+
+    // Format pending diagnostics into the UART transmit ring
+    log_task();
+}
+
+void bridge_hid_task(void) {
+    if (hal_usb_suspended()) {
+        if (!wakeup_sent && !engines_idle()) {
+            wakeup_sent = hal_usb_remote_wakeup();
+            if (wakeup_sent) LOG_INFO("Input while suspended, waking the host");
+        }
+        return;
+    }
+    wakeup_sent = false;
+    if (config_generation() != hid_config_gen) apply_hid_config();
+
+    // Each interface has its own endpoint and queue, so the streams run side by side
+    send_sequence_task();
+    consumer_engine_task();
+    mouse_engine_task();
+}
+
+bool bridge_uart_idle(void) {
+    return ingest_idle() && !log_pending();
+}
+
+bool bridge_hid_idle(void) {
+    if (hal_usb_suspended()) return wakeup_sent || engines_idle();
+    return hid_engine_waiting() && consumer_engine_waiting() && mouse_engine_waiting();
+}
+
+void bridge_report_complete(uint8_t instance) {
+    switch (instance) {
+        case HID_INSTANCE_KEYBOARD:
+            hid_engine_report_complete();
+            break;
+        case HID_INSTANCE_CONSUMER:
+            consumer_engine_report_complete();
+            break;
+        case HID_INSTANCE_MOUSE:
+            mouse_engine_report_complete();
+            break;
+    }
+}
+
+void bridge_set_leds(uint8_t instance, uint8_t leds) {
+    if (instance == HID_INSTANCE_KEYBOARD) {
+        LOG_DEBUG("Host LEDs 0x%02X", leds);
+        hid_engine_set_leds(leds);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef BRIDGE_H_
+#define BRIDGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Platform independent top level of the bridge. The platform main loop
+// calls the tasks, with BRIDGE_MULTICORE on the core that runs each side.
+
+// Resets the engines and ingest state and applies the config, which
+// config_store_init() must have loaded
+void bridge_init(void);
+
+// UART side: receive, parse and translate input, write diagnostics
+void bridge_uart_task(void);
+
+// USB side: run the keyboard, consumer control and mouse engines. While the
+// host is suspended, input keeps being queued and a remote wakeup is sent
+// as soon as there is something to type.
+void bridge_hid_task(void);
+
+// True when a side has nothing to do before the next interrupt, so the
+// platform loop may sleep
+bool bridge_uart_idle(void);
+bool bridge_hid_idle(void);
+
+// Called by the platform when the host has read a report of a HID instance
+void bridge_report_complete(uint8_t instance);
+
+// Called by the platform when the host sets the LEDs of a HID instance
+void bridge_set_leds(uint8_t instance, uint8_t leds);
+
+#endif /* BRIDGE_H_ */
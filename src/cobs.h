@@ -0,0 +1,20 @@
+#ifndef COBS_H_
+#define COBS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Consistent Overhead Byte Stuffing. Encoded data contains no zero bytes,
+// so a zero byte can delimit frames on the UART.
+
+// Worst case encoded size of len bytes, not counting the delimiter
+#define COBS_MAX_ENCODED_LEN(len) ((len) + (len) / 254 + 1)
+
+// Encodes len bytes from src into dst, returns the encoded length
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+// Decodes len bytes from src into dst (may be the same buffer),
+// returns the decoded length or 0 if the input is malformed
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#endif /* COBS_H_ */
@@ -0,0 +1,276 @@
+#include "config_store.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#include "crc16.h"
+#include "hal.h"
+#include "hid_engine.h"
+#include "keymap.h"
+#include "log.h"
+#include "macro_store.h"
+#include "unicode.h"
+
+// Each copy is one page at the start of its own sector
+#define BLOB_MAGIC 0x47464342u  // "BCFG"
+#define CONFIG_SLOTS 2
+
+// uart_flow_t lives in the Pico UART driver, its last value
+#define CONFIG_FLOW_MAX 2
+
+// Longest hold or gap time
+#define CONFIG_TIME_MAX 10000000
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;       // Of the config that follows
+    uint32_t sequence;  // Higher is newer
+    uint16_t crc;       // Over version, len, sequence and the config
+    uint16_t reserved;
+} blob_header_t;
+
+static_assert(CONFIG_STORE_SIZE == CONFIG_SLOTS * HAL_STORAGE_SECTOR, "one sector per config copy");
+static_assert(CONFIG_STORE_OFFSET + CONFIG_STORE_SIZE <= MACRO_STORE_OFFSET, "config overlaps the macro store");
+static_assert(sizeof(blob_header_t) + sizeof(bridge_config_t) <= HAL_STORAGE_PAGE, "config does not fit a page");
+static_assert(HAL_UART_CHANNELS == 3, "config keys cover two input channels");
+
+static bridge_config_t defaults;
+static bridge_config_t stored;   // As in flash, or the defaults if nothing is stored
+static bridge_config_t current;
+static int stored_slot = -1;
+static uint32_t stored_sequence = 0;
+
+// Odd while current is being changed. Only the UART core changes the
+// config, the other core copies it with config_get() and retries when
+// the copy overlapped a change.
+static std::atomic<uint32_t> generation{0};
+
+static uint32_t slot_offset(int slot) {
+    return CONFIG_STORE_OFFSET + (uint32_t)slot * HAL_STORAGE_SECTOR;
+}
+
+static uint16_t blob_crc(const blob_header_t *header, const uint8_t *data) {
+    uint16_t crc = crc16_update(CRC16_INIT, (const uint8_t *)&header->version, 8);
+    return crc16_update(crc, data, header->len);
+}
+
+// Reads the header of a slot, true if it holds a valid config
+static bool slot_read(int slot, blob_header_t *header) {
+    const uint8_t *base = hal_storage() + slot_offset(slot);
+    memcpy(header, base, sizeof(*header));
+    if (header->magic != BLOB_MAGIC || header->version != CONFIG_VERSION) return false;
+    if (header->len > HAL_STORAGE_PAGE - sizeof(*header)) return false;
+    return blob_crc(header, base + sizeof(*header)) == header->crc;
+}
+
+static bool get_field(const bridge_config_t *config, uint8_t key, uint32_t *value) {
+    switch (key) {
+        case CONFIG_BAUD_RATE:   *value = config->baud_rate; break;
+        case CONFIG_TX_PIN:      *value = config->tx_pin; break;
+        case CONFIG_RX_PIN:      *value = config->rx_pin; break;
+        case CONFIG_FLOW:        *value = config->flow; break;
+        case CONFIG_CTS_PIN:     *value = config->cts_pin; break;
+        case CONFIG_RTS_PIN:     *value = config->rts_pin; break;
+        case CONFIG_LAYOUT:      *value = config->layout; break;
+        case CONFIG_PACING:      *value = config->pacing; break;
+        case CONFIG_HOLD_US:     *value = config->hold_us; break;
+        case CONFIG_GAP_US:      *value = config->gap_us; break;
+        case CONFIG_PACK_LIMIT:  *value = config->pack_limit; break;
+        case CONFIG_LOG_LEVEL:   *value = config->log_level; break;
+        case CONFIG_INPUT1_PIN:  *value = config->input_pin[0]; break;
+        case CONFIG_INPUT1_BAUD: *value = config->input_baud[0]; break;
+        case CONFIG_INPUT2_PIN:  *value = config->input_pin[1]; break;
+        case CONFIG_INPUT2_BAUD: *value = config->input_baud[1]; break;
+        case CONFIG_WEIGHT0:     *value = config->weight[0]; break;
+        case CONFIG_WEIGHT1:     *value = config->weight[1]; break;
+        case CONFIG_WEIGHT2:     *value = config->weight[2]; break;
+        case CONFIG_UTF8:        *value = config->utf8; break;
+        case CONFIG_UNICODE:     *value = config->unicode_method; break;
+        case CONFIG_TRACE:       *value = config->trace; break;
+        default: return false;
+    }
+    return true;
+}
+
+// value must have passed config_check()
+static void set_field(bridge_config_t *config, uint8_t key, uint32_t value) {
+    switch (key) {
+        case CONFIG_BAUD_RATE:   config->baud_rate = value; break;
+        case CONFIG_TX_PIN:      config->tx_pin = value; break;
+        case CONFIG_RX_PIN:      config->rx_pin = value; break;
+        case CONFIG_FLOW:        config->flow = value; break;
+        case CONFIG_CTS_PIN:     config->cts_pin = value; break;
+        case CONFIG_RTS_PIN:     config->rts_pin = value; break;
+        case CONFIG_LAYOUT:      config->layout = value; break;
+        case CONFIG_PACING:      config->pacing = value; break;
+        case CONFIG_HOLD_US:     config->hold_us = value; break;
+        case CONFIG_GAP_US:      config->gap_us = value; break;
+        case CONFIG_PACK_LIMIT:  config->pack_limit = value; break;
+        case CONFIG_LOG_LEVEL:   config->log_level = value; break;
+        case CONFIG_INPUT1_PIN:  config->input_pin[0] = value; break;
+        case CONFIG_INPUT1_BAUD: config->input_baud[0] = value; break;
+        case CONFIG_INPUT2_PIN:  config->input_pin[1] = value; break;
+        case CONFIG_INPUT2_BAUD: config->input_baud[1] = value; break;
+        case CONFIG_WEIGHT0:     config->weight[0] = value; break;
+        case CONFIG_WEIGHT1:     config->weight[1] = value; break;
+        case CONFIG_WEIGHT2:     config->weight[2] = value; break;
+        case CONFIG_UTF8:        config->utf8 = value; break;
+        case CONFIG_UNICODE:     config->unicode_method = value; break;
+        case CONFIG_TRACE:       config->trace = value; break;
+    }
+}
+
+bool config_check(uint8_t key, uint32_t value) {
+    switch (key) {
+        case CONFIG_BAUD_RATE:
+        case CONFIG_INPUT1_BAUD:
+        case CONFIG_INPUT2_BAUD:
+            return value == 0 || (value >= CONFIG_BAUD_MIN && value <= CONFIG_BAUD_MAX);
+        case CONFIG_INPUT1_PIN:
+        case CONFIG_INPUT2_PIN:
+            return value <= CONFIG_PIN_MAX || value == CONFIG_PIN_NONE;
+        case CONFIG_WEIGHT0:
+        case CONFIG_WEIGHT1:
+        case CONFIG_WEIGHT2:
+            return value >= 1 && value <= CONFIG_WEIGHT_MAX;
+        case CONFIG_TX_PIN:
+        case CONFIG_RX_PIN:
+        case CONFIG_CTS_PIN:
+        case CONFIG_RTS_PIN:
+            return value <= CONFIG_PIN_MAX;
+        case CONFIG_FLOW:
+            return value <= CONFIG_FLOW_MAX;
+        case CONFIG_LAYOUT:
+            return value < LAYOUT_COUNT;
+        case CONFIG_PACING:
+            return value <= PACING_COMPLETION;
+        case CONFIG_HOLD_US:
+        case CONFIG_GAP_US:
+            return value <= CONFIG_TIME_MAX;
+        case CONFIG_PACK_LIMIT:
+            return value >= 1 && value <= HID_PACK_MAX;
+        case CONFIG_LOG_LEVEL:
+            return value <= LOG_LEVEL_DEBUG;
+        case CONFIG_UTF8:
+        case CONFIG_TRACE:
+            return value <= 1;
+        case CONFIG_UNICODE:
+            return value < UNICODE_METHOD_COUNT;
+        default:
+            return false;
+    }
+}
+
+// Replaces fields this firmware does not accept with their defaults
+static void sanitize(bridge_config_t *config) {
+    for (uint8_t key = 1; key < CONFIG_KEY_COUNT; key++) {
+        uint32_t value;
+        get_field(config, key, &value);
+        if (!config_check(key, value)) {
+            get_field(&defaults, key, &value);
+            set_field(config, key, value);
+        }
+    }
+    memset(config->reserved, 0, sizeof(config->reserved));
+}
+
+static void change_begin(void) {
+    generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void change_end(void) {
+    generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void config_store_init(const bridge_config_t *config_defaults) {
+    defaults = *config_defaults;
+    memset(defaults.reserved, 0, sizeof(defaults.reserved));
+    stored = defaults;
+    stored_slot = -1;
+    stored_sequence = 0;
+
+    blob_header_t header;
+    for (int slot = 0; slot < CONFIG_SLOTS; slot++) {
+        if (!slot_read(slot, &header)) continue;
+        if (stored_slot < 0 || (int32_t)(header.sequence - stored_sequence) > 0) {
+            stored_slot = slot;
+            stored_sequence = header.sequence;
+        }
+    }
+    if (stored_slot >= 0) {
+        slot_read(stored_slot, &header);
+        size_t len = header.len < sizeof(stored) ? header.len : sizeof(stored);
+        memcpy(&stored, hal_storage() + slot_offset(stored_slot) + sizeof(header), len);
+        sanitize(&stored);
+        LOG_INFO("Config %u loaded from slot %u", stored_sequence, stored_slot);
+    }
+
+    change_begin();
+    current = stored;
+    change_end();
+}
+
+uint32_t config_get(bridge_config_t *config) {
+    uint32_t gen;
+    do {
+        gen = generation.load(std::memory_order_acquire);
+        memcpy(config, &current, sizeof(*config));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((gen & 1) || gen != generation.load(std::memory_order_relaxed));
+    return gen;
+}
+
+uint32_t config_generation(void) {
+    return generation.load(std::memory_order_acquire);
+}
+
+bool config_get_value(uint8_t key, uint32_t *value) {
+    return get_field(&current, key, value);
+}
+
+bool config_set_value(uint8_t key, uint32_t value) {
+    if (!config_check(key, value)) return false;
+    change_begin();
+    set_field(&current, key, value);
+    change_end();
+    return true;
+}
+
+void config_reset(void) {
+    change_begin();
+    current = defaults;
+    change_end();
+}
+
+bool config_dirty(void) {
+    return memcmp(&current, &stored, sizeof(current)) != 0;
+}
+
+bool config_commit(void) {
+    if (!config_dirty()) return true;
+
+    // Write the slot not holding the stored config, that one stays valid
+    // until the new copy is complete
+    int target = (stored_slot == 0) ? 1 : 0;
+    static uint8_t page[HAL_STORAGE_PAGE];
+    blob_header_t header = { BLOB_MAGIC, CONFIG_VERSION, sizeof(bridge_config_t), stored_sequence + 1, 0, 0xFFFF };
+    memset(page, 0xFF, sizeof(page));
+    memcpy(&page[sizeof(header)], &current, sizeof(current));
+    header.crc = blob_crc(&header, &page[sizeof(header)]);
+    memcpy(page, &header, sizeof(header));
+
+    if (!hal_storage_erase(slot_offset(target), HAL_STORAGE_SECTOR) ||
+        !hal_storage_program(slot_offset(target), page, sizeof(page)) ||
+        !slot_read(target, &header)) {
+        LOG_ERROR("Config write to slot %u failed", target);
+        return false;
+    }
+    stored = current;
+    stored_slot = target;
+    stored_sequence++;
+    LOG_INFO("Config %u written to slot %u", stored_sequence, target);
+    return true;
+}
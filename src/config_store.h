@@ -0,0 +1,107 @@
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// Runtime configuration kept in the flash storage area, so baud rate, pins,
+// layout and pacing can be tuned per site without rebuilding the firmware.
+//
+// The config is a small versioned blob with a CRC, written alternately to
+// two sectors with a sequence number. The newest valid copy wins at boot,
+// so a power failure during a write leaves the previous config in place.
+// Settings changed over the UART take effect right away where that is safe
+// and are kept across resets once committed. The UART settings only take
+// effect at the next boot.
+
+#define CONFIG_STORE_OFFSET 0
+#define CONFIG_STORE_SIZE (2 * 4096)
+
+// Bumped when the meaning of a field changes. Fields are only appended,
+// a shorter blob of the same version gets defaults for the missing ones.
+#define CONFIG_VERSION 1
+
+typedef struct {
+    uint32_t baud_rate;
+    uint8_t tx_pin;
+    uint8_t rx_pin;
+    uint8_t flow;        // uart_flow_t
+    uint8_t cts_pin;
+    uint8_t rts_pin;
+    uint8_t layout;      // keymap_layout_t
+    uint8_t pacing;      // hid_pacing_t
+    uint8_t pack_limit;
+    uint32_t hold_us;
+    uint32_t gap_us;
+    uint8_t log_level;
+    uint8_t reserved[3];
+    // Receive-only input channels 1.., PIO UARTs on the Pico
+    uint32_t input_baud[HAL_UART_CHANNELS - 1];  // 0 detects the rate
+    uint8_t input_pin[HAL_UART_CHANNELS - 1];    // CONFIG_PIN_NONE when unused
+    uint8_t weight[HAL_UART_CHANNELS];           // Lines a channel types per turn
+    uint8_t utf8;            // Text is UTF-8 rather than Latin-1
+    uint8_t unicode_method;  // unicode_method_t
+    uint8_t trace;           // Record a trace, see trace.h
+} bridge_config_t;
+
+// Keys of the config fields in the protocol, values are all u32
+enum {
+    CONFIG_BAUD_RATE   = 0x01,
+    CONFIG_TX_PIN      = 0x02,
+    CONFIG_RX_PIN      = 0x03,
+    CONFIG_FLOW        = 0x04,
+    CONFIG_CTS_PIN     = 0x05,
+    CONFIG_RTS_PIN     = 0x06,
+    CONFIG_LAYOUT      = 0x07,
+    CONFIG_PACING      = 0x08,
+    CONFIG_HOLD_US     = 0x09,
+    CONFIG_GAP_US      = 0x0A,
+    CONFIG_PACK_LIMIT  = 0x0B,
+    CONFIG_LOG_LEVEL   = 0x0C,
+    CONFIG_INPUT1_PIN  = 0x0D,
+    CONFIG_INPUT1_BAUD = 0x0E,
+    CONFIG_INPUT2_PIN  = 0x0F,
+    CONFIG_INPUT2_BAUD = 0x10,
+    CONFIG_WEIGHT0     = 0x11,
+    CONFIG_WEIGHT1     = 0x12,
+    CONFIG_WEIGHT2     = 0x13,
+    CONFIG_UTF8        = 0x14,
+    CONFIG_UNICODE     = 0x15,
+    CONFIG_TRACE       = 0x16,
+    CONFIG_KEY_COUNT
+};
+
+// A baud rate of 0 detects the rate
+#define CONFIG_BAUD_MIN 1200
+#define CONFIG_BAUD_MAX 4000000
+#define CONFIG_PIN_MAX  29
+#define CONFIG_PIN_NONE 0xFF
+#define CONFIG_WEIGHT_MAX 16
+
+// Loads the newest valid config from flash, or uses the defaults when
+// there is none. Only reads flash, so it is quick enough for boot.
+void config_store_init(const bridge_config_t *defaults);
+
+// Copies the current config. The returned generation changes with every
+// set, so a core can tell when it has to apply the config again.
+uint32_t config_get(bridge_config_t *config);
+uint32_t config_generation(void);
+
+// Field access by key. config_check() validates without changing anything.
+bool config_check(uint8_t key, uint32_t value);
+bool config_get_value(uint8_t key, uint32_t *value);
+bool config_set_value(uint8_t key, uint32_t value);
+
+// Goes back to the built-in defaults, the stored config is only replaced on commit
+void config_reset(void);
+
+// Writes the current config to flash unless it is already stored there
+bool config_commit(void);
+
+// True when the current config differs from the stored one
+bool config_dirty(void);
+
+#endif /* CONFIG_STORE_H_ */
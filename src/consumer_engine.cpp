@@ -0,0 +1,67 @@
+#include "consumer_engine.h"
+
+#include "hal.h"
+#include "hid_common.h"
+#include "log.h"
+#include "ring_buffer.h"
+#include "usb_descriptors.h"
+
+static ring_buffer<uint16_t, CONSUMER_QUEUE_SIZE> queue;
+static bool pressed = false;
+static bool report_in_flight = false;
+static uint64_t sent_at = 0;
+
+// Report: one 16 bit usage, 0 when nothing is pressed
+static bool send_usage(uint16_t usage) {
+    uint8_t report[2] = { (uint8_t)usage, (uint8_t)(usage >> 8) };
+    if (!hal_hid_report(HID_INSTANCE_CONSUMER, 0, report, sizeof(report))) return false;
+    report_in_flight = true;
+    sent_at = hal_time_us();
+    return true;
+}
+
+void consumer_engine_init(void) {
+    pressed = false;
+    report_in_flight = false;
+}
+
+bool consumer_engine_push(uint16_t usage) {
+    return usage != 0 && queue.push(usage);
+}
+
+size_t consumer_engine_free(void) {
+    return queue.free();
+}
+
+void consumer_engine_task(void) {
+    if (!hal_hid_ready(HID_INSTANCE_CONSUMER)) return;
+    if (report_in_flight) {
+        // The endpoint is free but the completion never came, as after a bus reset
+        if (hal_time_us() - sent_at < HID_REPORT_TIMEOUT_US) return;
+        LOG_WARN("Consumer report not read within %u ms", (unsigned)(HID_REPORT_TIMEOUT_US / 1000));
+        report_in_flight = false;
+    }
+
+    if (pressed) {
+        if (send_usage(0)) pressed = false;
+        return;
+    }
+    const uint16_t *usage = queue.peek(0);
+    if (usage && send_usage(*usage)) {
+        queue.discard(1);
+        pressed = true;
+    }
+}
+
+void consumer_engine_report_complete(void) {
+    report_in_flight = false;
+    consumer_engine_task();
+}
+
+bool consumer_engine_idle(void) {
+    return !pressed && queue.empty();
+}
+
+bool consumer_engine_waiting(void) {
+    return report_in_flight || consumer_engine_idle();
+}
@@ -0,0 +1,43 @@
+#ifndef CONSUMER_ENGINE_H_
+#define CONSUMER_ENGINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Consumer control (media key) taps on their own HID interface. They have a
+// separate queue and endpoint, so they never wait behind queued keystrokes.
+
+// Size of the usage queue, must be a power of two
+#define CONSUMER_QUEUE_SIZE 32
+
+// Common consumer page usages
+enum : uint16_t {
+    CC_PLAY_PAUSE  = 0x00CD,
+    CC_SCAN_NEXT   = 0x00B5,
+    CC_SCAN_PREV   = 0x00B6,
+    CC_STOP        = 0x00B7,
+    CC_MUTE        = 0x00E2,
+    CC_VOLUME_UP   = 0x00E9,
+    CC_VOLUME_DOWN = 0x00EA
+};
+
+void consumer_engine_init(void);
+
+// Queues a press and release of a consumer page usage, false if the queue is full
+bool consumer_engine_push(uint16_t usage);
+size_t consumer_engine_free(void);
+
+// Sends the next press or release when the endpoint is free, a report not
+// read within HID_REPORT_TIMEOUT_US counts as read
+void consumer_engine_task(void);
+
+// Called when the host has read a consumer report
+void consumer_engine_report_complete(void);
+
+bool consumer_engine_idle(void);
+
+// True when nothing can be sent before a report completes or new events arrive
+bool consumer_engine_waiting(void);
+
+#endif /* CONSUMER_ENGINE_H_ */
@@ -0,0 +1,26 @@
+#include "crc16.h"
+
+typedef struct {
+    uint16_t entry[256];
+} crc16_table_t;
+
+static constexpr crc16_table_t build_table(void) {
+    crc16_table_t table = {};
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+        table.entry[i] = crc;
+    }
+    return table;
+}
+
+static constexpr crc16_table_t crc_table = build_table();
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 8) ^ crc_table.entry[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
@@ -0,0 +1,16 @@
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, no reflection
+#define CRC16_INIT 0xFFFF
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+
+static inline uint16_t crc16(const uint8_t *data, size_t len) {
+    return crc16_update(CRC16_INIT, data, len);
+}
+
+#endif /* CRC16_H_ */
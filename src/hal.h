@@ -0,0 +1,81 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Platform services used by the bridge core (engine, ingest, protocol, log).
+// hal_pico.cpp implements them with the Pico SDK and TinyUSB, the host build
+// in host/ implements them with a simulated clock, UART and USB host.
+
+// Microseconds since boot
+uint64_t hal_time_us(void);
+
+// True when the HID interface can take a new report
+bool hal_hid_ready(uint8_t instance);
+
+// True when the host has switched the interface to the boot protocol
+bool hal_hid_boot_protocol(uint8_t instance);
+
+// Submits one input report, returns false if the endpoint is busy
+bool hal_hid_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+
+// USB bus state. A suspended host can be asked to resume if it has
+// enabled remote wakeup, hal_usb_remote_wakeup() returns false otherwise.
+bool hal_usb_suspended(void);
+bool hal_usb_remote_wakeup(void);
+
+// Start of the latest USB frame in hal_time_us() time, 0 while unknown.
+// Frames start every HAL_USB_FRAME_US.
+#define HAL_USB_FRAME_US 1000
+uint64_t hal_usb_frame_time(void);
+
+// Makes sure the HID core runs its loop at time_us, even if it is asleep.
+// A later call replaces the alarm.
+void hal_alarm_at(uint64_t time_us);
+
+// Spins until time_us, for the last microseconds before a scheduled report
+void hal_busy_wait_until(uint64_t time_us);
+
+// Input channels. Channel 0 is the bridge UART, the only one that also
+// transmits; the others are receive-only inputs (PIO UARTs on the Pico).
+#define HAL_UART_CHANNELS 3
+
+// Bridge UART and input channels, never blocking. rx_time_us, if not NULL,
+// gets the arrival time of each byte read (low 32 bits of hal_time_us()).
+size_t hal_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max);
+size_t hal_uart_write(const uint8_t *src, size_t len);
+size_t hal_uart_tx_free(void);
+size_t hal_uart_rx_available(uint8_t channel);
+
+// Receive errors of a channel since boot. Damaged bytes are dropped.
+typedef struct {
+    uint32_t overruns;  // Bytes lost because a FIFO or the receive ring was full
+    uint32_t framing;   // Bad stop bit
+    uint32_t parity;
+    uint32_t breaks;
+} hal_uart_errors_t;
+
+void hal_uart_get_errors(uint8_t channel, hal_uart_errors_t *errors);
+
+// Index of the calling core
+unsigned hal_core_num(void);
+
+// Wakes the other core if it is waiting for an event
+void hal_wake(void);
+
+// Persistent storage area reserved at the end of flash. It is read in place
+// through hal_storage(); erase works on whole sectors and programming on
+// whole pages, and programming can only clear bits, so 0xFF bytes in the
+// data leave the flash as it is.
+#define HAL_STORAGE_SIZE   (40 * 1024)
+#define HAL_STORAGE_SECTOR 4096
+#define HAL_STORAGE_PAGE   256
+
+const uint8_t *hal_storage(void);
+bool hal_storage_erase(size_t offset, size_t len);
+// data must be in RAM, not in the storage area itself
+bool hal_storage_program(size_t offset, const void *data, size_t len);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,173 @@
+#include "hal.h"
+
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "pio_uart.h"
+#include "tusb.h"
+#include "uart_io.h"
+
+uint64_t hal_time_us(void) {
+    return time_us_64();
+}
+
+bool hal_hid_ready(uint8_t instance) {
+    return tud_hid_n_ready(instance);
+}
+
+bool hal_hid_boot_protocol(uint8_t instance) {
+    return tud_hid_n_get_protocol(instance) == HID_PROTOCOL_BOOT;
+}
+
+bool hal_hid_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len) {
+    return tud_hid_n_report(instance, report_id, report, len);
+}
+
+bool hal_usb_suspended(void) {
+    return tud_suspended();
+}
+
+bool hal_usb_remote_wakeup(void) {
+    return tud_remote_wakeup();
+}
+
+//--------------------------------------------------------------------+
+// Scheduling
+//--------------------------------------------------------------------+
+
+// Estimated start of the latest frame and its number. tud_sof_cb() runs
+// from tud_task(), a little after the frame started, so the estimate
+// follows the earliest callbacks. It creeps 1 us per frame towards later
+// ones, to follow a host clock that is slower than ours.
+static uint64_t frame_time = 0;
+static uint32_t frame_number = 0;
+static bool sof_enabled = false;
+
+void tud_sof_cb(uint32_t frame_count) {
+    uint64_t now = time_us_64();
+    uint64_t predicted = frame_time + (uint64_t)((frame_count - frame_number) & 0x7FF) * HAL_USB_FRAME_US;
+    if (!frame_time || now < predicted || now - predicted > HAL_USB_FRAME_US) {
+        // First frame, or frames were missed while the bus was suspended
+        frame_time = now;
+    } else {
+        frame_time = (now > predicted) ? predicted + 1 : predicted;
+    }
+    frame_number = frame_count;
+}
+
+uint64_t hal_usb_frame_time(void) {
+    // Frame callbacks wake the loop every millisecond, so they are only
+    // turned on once something asks for frame times
+    if (!sof_enabled) {
+        tud_sof_cb_enable(true);
+        sof_enabled = true;
+    }
+    return frame_time;
+}
+
+static alarm_id_t alarm = 0;
+
+// Waking the core from __wfe() is all it has to do
+static int64_t on_alarm(alarm_id_t id, void *user_data) {
+    (void)id;
+    (void)user_data;
+    return 0;
+}
+
+void hal_alarm_at(uint64_t time_us) {
+    if (alarm > 0) cancel_alarm(alarm);
+    alarm = add_alarm_at(from_us_since_boot(time_us), on_alarm, NULL, true);
+}
+
+void hal_busy_wait_until(uint64_t time_us) {
+    busy_wait_until(from_us_since_boot(time_us));
+}
+
+static_assert(HAL_UART_CHANNELS == 1 + PIO_UART_CHANNELS, "channels 1.. are the PIO UARTs");
+
+size_t hal_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max) {
+    if (channel == 0) return uart_io_read(dst, rx_time_us, max);
+    return pio_uart_read(channel - 1, dst, rx_time_us, max);
+}
+
+size_t hal_uart_write(const uint8_t *src, size_t len) {
+    return uart_io_write(src, len);
+}
+
+size_t hal_uart_tx_free(void) {
+    return uart_io_tx_free();
+}
+
+size_t hal_uart_rx_available(uint8_t channel) {
+    if (channel == 0) return uart_io_rx_available();
+    return pio_uart_rx_available(channel - 1);
+}
+
+void hal_uart_get_errors(uint8_t channel, hal_uart_errors_t *errors) {
+    if (channel == 0) {
+        uart_io_errors_t uart;
+        uart_io_get_errors(&uart);
+        errors->overruns = uart.rx_overruns + uart.fifo_overruns;
+        errors->framing = uart.framing;
+        errors->parity = uart.parity;
+        errors->breaks = uart.breaks;
+    } else {
+        // The PIO receiver has no parity and sees a break as a framing error
+        errors->overruns = pio_uart_rx_overruns(channel - 1);
+        errors->framing = pio_uart_framing_errors(channel - 1);
+        errors->parity = 0;
+        errors->breaks = 0;
+    }
+}
+
+unsigned hal_core_num(void) {
+    return get_core_num();
+}
+
+void hal_wake(void) {
+    __sev();
+}
+
+//--------------------------------------------------------------------+
+// Storage
+//--------------------------------------------------------------------+
+
+#define STORAGE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - HAL_STORAGE_SIZE)
+
+// Longest wait for the other core to park itself before a flash operation
+#define STORAGE_LOCKOUT_TIMEOUT_MS 100
+
+typedef struct {
+    size_t offset;
+    const void *data;
+    size_t len;
+} storage_op_t;
+
+// Both run with XIP disabled, interrupts off and the other core parked
+static void storage_erase_locked(void *param) {
+    const storage_op_t *op = (const storage_op_t *)param;
+    flash_range_erase(STORAGE_FLASH_OFFSET + op->offset, op->len);
+}
+
+static void storage_program_locked(void *param) {
+    const storage_op_t *op = (const storage_op_t *)param;
+    flash_range_program(STORAGE_FLASH_OFFSET + op->offset, (const uint8_t *)op->data, op->len);
+}
+
+const uint8_t *hal_storage(void) {
+    return (const uint8_t *)(XIP_BASE + STORAGE_FLASH_OFFSET);
+}
+
+bool hal_storage_erase(size_t offset, size_t len) {
+    if (offset % HAL_STORAGE_SECTOR || len % HAL_STORAGE_SECTOR || offset + len > HAL_STORAGE_SIZE) return false;
+    storage_op_t op = { offset, NULL, len };
+    return flash_safe_execute(storage_erase_locked, &op, STORAGE_LOCKOUT_TIMEOUT_MS) == PICO_OK;
+}
+
+bool hal_storage_program(size_t offset, const void *data, size_t len) {
+    if (offset % HAL_STORAGE_PAGE || len % HAL_STORAGE_PAGE || offset + len > HAL_STORAGE_SIZE) return false;
+    storage_op_t op = { offset, data, len };
+    return flash_safe_execute(storage_program_locked, &op, STORAGE_LOCKOUT_TIMEOUT_MS) == PICO_OK;
+}
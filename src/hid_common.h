@@ -0,0 +1,13 @@
+#ifndef HID_COMMON_H_
+#define HID_COMMON_H_
+
+// Settings shared by the keyboard, consumer control and mouse engines
+
+// A report the host has not read after HID_REPORT_TIMEOUT_US counts as
+// lost, as after a bus reset that drops the completion, and the engine
+// goes on with the next report
+#ifndef HID_REPORT_TIMEOUT_US
+#define HID_REPORT_TIMEOUT_US 250000
+#endif
+
+#endif /* HID_COMMON_H_ */
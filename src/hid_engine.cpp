@@ -0,0 +1,488 @@
+#include "hid_engine.h"
+
+#include <string.h>
+
+#include "hal.h"
+#include "hid_keycodes.h"
+#include "key_queue.h"
+#include "keymap.h"
+#include "latency.h"
+#include "log.h"
+#include "macro_store.h"
+#include "trace.h"
+
+// Sequence engine states
+typedef enum {
+    SEQ_IDLE,    // Only held keys are down, the next event waits for the gap time
+    SEQ_PRESSED, // Tapped keys are down, the next report waits for the hold time
+    SEQ_MACRO    // Playing a stored macro, one step per report
+} seq_state_t;
+
+// Keyboard state as last sent to the host
+typedef struct {
+    uint8_t modifier;
+    uint8_t count;
+    uint8_t keycodes[HID_PACK_MAX];
+} kb_report_t;
+
+static hid_timing_t timing = HID_TIMING_DEFAULT;
+static uint8_t pack_limit = HID_PACK_MAX;
+
+static kb_report_t current = {0, 0, {0}};
+static kb_report_t held = {0, 0, {0}};
+static seq_state_t seq_state = SEQ_IDLE;
+static uint64_t seq_timer = 0;
+static uint64_t delay_until = 0;
+static hid_engine_stats_t stats = {0, 0, 0, 0, 0, 0};
+
+// Host lock state. The engine flips NumLock here as soon as it taps it,
+// the host's LED report confirming that comes later.
+static uint8_t host_leds = 0;
+static bool leds_known = false;
+// NumLock was turned on for keypad keys and is to be turned off again
+static bool numlock_changed = false;
+
+// Macro being played and its next step, the steps are read from flash as they are sent
+static uint16_t macro_id = 0;
+static uint16_t macro_step = 0;
+
+// Wakeup requested for the end of the current delay, 0 if none
+static uint64_t alarm_at = 0;
+
+// Set while a submitted report has not been read by the host yet
+static bool report_in_flight = false;
+// Set while a due report waits for a busy endpoint, counted once per stall
+static bool stalled = false;
+
+// Timestamps of the queued events carried by the report in flight
+typedef struct {
+    uint32_t rx_time_us;
+    uint32_t enqueue_time_us;
+} key_stamp_t;
+
+static key_stamp_t in_flight_keys[HID_PACK_MAX];
+static uint8_t in_flight_count = 0;
+static uint32_t in_flight_submit = 0;
+
+// True when reports go out as NKRO bitmaps
+static bool nkro_active(void) {
+    return BRIDGE_NKRO && !hal_hid_boot_protocol(HID_INSTANCE_KEYBOARD);
+}
+
+// Keys that can be down at once in the report format in use
+static uint8_t key_slots(void) {
+    return nkro_active() ? HID_PACK_MAX : HID_BOOT_KEYS;
+}
+
+static bool report_has_key(const kb_report_t *report, uint8_t keycode) {
+    return memchr(report->keycodes, keycode, report->count) != NULL;
+}
+
+static bool report_equal(const kb_report_t *a, const kb_report_t *b) {
+    return a->modifier == b->modifier && a->count == b->count && memcmp(a->keycodes, b->keycodes, a->count) == 0;
+}
+
+static void report_add_key(kb_report_t *report, uint8_t keycode) {
+    if (keycode && report->count < key_slots() && !report_has_key(report, keycode)) {
+        report->keycodes[report->count++] = keycode;
+    }
+}
+
+static void report_remove_key(kb_report_t *report, uint8_t keycode) {
+    for (uint8_t i = 0; i < report->count; i++) {
+        if (report->keycodes[i] == keycode) {
+            memmove(&report->keycodes[i], &report->keycodes[i + 1], report->count - i - 1);
+            report->count--;
+            return;
+        }
+    }
+}
+
+// Keypad keys that type navigation keys while NumLock is off
+static bool is_numlock_key(uint8_t keycode) {
+    return keycode >= KC_KEYPAD_1 && keycode <= KC_KEYPAD_PERIOD;
+}
+
+// Modifier a tap is sent with. While CapsLock is on, Shift is inverted
+// for the letters of the layout typed without other modifiers.
+static uint8_t tap_modifier(const key_event_t *ev) {
+    const uint8_t shift = MOD_LSHIFT | MOD_RSHIFT;
+    uint8_t modifier = ev->modifier;
+    if (leds_known && (host_leds & LED_CAPS_LOCK) && keymap_caps_key(ev->keycodes[0]) && !(modifier & ~shift)) {
+        modifier = (modifier & shift) ? 0 : MOD_LSHIFT;
+    }
+    return modifier;
+}
+
+// True when NumLock has to be tapped before this event. Alt with keypad +
+// starts a Windows hex code with keypad digits, which needs NumLock before
+// Alt goes down.
+static bool needs_numlock(const key_event_t *ev) {
+    if (ev->type != KEY_EV_TAP || !leds_known || (host_leds & LED_NUM_LOCK)) return false;
+    uint8_t keycode = ev->keycodes[0];
+    return is_numlock_key(keycode) || (keycode == KC_KEYPAD_PLUS && (ev->modifier & (MOD_LALT | MOD_RALT)));
+}
+
+// Collects the longest run of queued taps that can go out in one report on
+// top of the held keys. Taps in a report must share the modifier byte and
+// be distinct. A key that is down in the current report ends the run,
+// because the host only sees it again after a report in which it is released.
+// The host handles newly pressed keys in report order, so typing order holds.
+// A bitmap has no order, the host walks it by usage, so in NKRO mode the taps
+// of one report must also have ascending keycodes.
+static uint8_t build_next_report(kb_report_t *next) {
+    uint8_t slots = key_slots();
+    uint8_t limit = held.count < slots ? slots - held.count : 0;
+    if (limit > pack_limit) limit = pack_limit;
+    bool ordered = nkro_active();
+
+    uint8_t taps = 0;
+    *next = held;
+    for (size_t i = 0; taps < limit; i++) {
+        const key_event_t *ev = key_queue_peek(i);
+        if (!ev || ev->type != KEY_EV_TAP || needs_numlock(ev)) break;
+        uint8_t keycode = ev->keycodes[0];
+        uint8_t modifier = held.modifier | tap_modifier(ev);
+        if (taps == 0) {
+            next->modifier = modifier;
+        } else if (modifier != next->modifier) {
+            break;
+        }
+        if (report_has_key(next, keycode) || report_has_key(&current, keycode)) break;
+        if (ordered && taps > 0 && keycode < next->keycodes[next->count - 1]) break;
+        next->keycodes[next->count++] = keycode;
+        taps++;
+    }
+    return taps;
+}
+
+// Submits one keyboard report, returns false if the endpoint is busy
+static bool send_report(const kb_report_t *report, uint64_t now) {
+    bool sent;
+    if (nkro_active()) {
+        // NKRO report: modifier, then one bit per keyboard usage
+        uint8_t bitmap[HID_NKRO_REPORT_LEN] = {0};
+        bitmap[0] = report->modifier;
+        for (uint8_t i = 0; i < report->count; i++) {
+            uint8_t keycode = report->keycodes[i];
+            if (keycode < HID_NKRO_KEYS) bitmap[1 + keycode / 8] |= 1 << (keycode % 8);
+        }
+        sent = hal_hid_report(HID_INSTANCE_KEYBOARD, 0, bitmap, sizeof(bitmap));
+    } else {
+        // Boot keyboard report: modifier, reserved, six keycodes
+        uint8_t boot[8] = {0};
+        boot[0] = report->modifier;
+        memcpy(&boot[2], report->keycodes, report->count < HID_BOOT_KEYS ? report->count : HID_BOOT_KEYS);
+        sent = hal_hid_report(HID_INSTANCE_KEYBOARD, 0, boot, sizeof(boot));
+    }
+    if (!sent) {
+        stats.retries++;
+        return false;
+    }
+    trace_report(report->modifier, report->keycodes, report->count, (uint32_t)now);
+    current = *report;
+    report_in_flight = true;
+    seq_timer = now;
+    in_flight_count = 0;
+    in_flight_submit = (uint32_t)now;
+    stats.reports++;
+    return true;
+}
+
+// Notes the first n queued events as sent, call before discarding them
+static void track_keys(uint8_t n) {
+    for (uint8_t i = 0; i < n && in_flight_count < HID_PACK_MAX; i++) {
+        const key_event_t *ev = key_queue_peek(i);
+        if (!ev) break;
+        in_flight_keys[in_flight_count].rx_time_us = ev->rx_time_us;
+        in_flight_keys[in_flight_count].enqueue_time_us = ev->enqueue_time_us;
+        in_flight_count++;
+    }
+}
+
+// Taps NumLock on top of the held keys, the release follows like for any tap
+static bool send_numlock_tap(uint64_t now) {
+    kb_report_t next = held;
+    report_add_key(&next, KC_NUM_LOCK);
+    if (!send_report(&next, now)) return false;
+    host_leds ^= LED_NUM_LOCK;
+    seq_state = SEQ_PRESSED;
+    return true;
+}
+
+// Time the report after a KEY_EV_AT event is submitted. Without a known
+// frame time an aligned event goes out at its target time.
+static uint64_t schedule_time(const key_event_t *ev, uint64_t now) {
+    uint64_t at = now + (int32_t)(ev->at_us - (uint32_t)now);
+    uint64_t frame = hal_usb_frame_time();
+    if (!(ev->keycodes[0] & KEY_AT_FRAME) || !frame) return at;
+    if (at > frame) frame += (at - frame + HAL_USB_FRAME_US - 1) / HAL_USB_FRAME_US * HAL_USB_FRAME_US;
+    return frame > HID_FRAME_LEAD_US ? frame - HID_FRAME_LEAD_US : frame;
+}
+
+// True once delay_until has passed. Until the last HID_SPIN_US an alarm
+// brings the core back, those are spun so the next report is on time.
+static bool delay_passed(uint64_t *now) {
+    if (*now >= delay_until) return true;
+    if (delay_until - *now > HID_SPIN_US) {
+        if (alarm_at != delay_until - HID_SPIN_US) {
+            alarm_at = delay_until - HID_SPIN_US;
+            hal_alarm_at(alarm_at);
+        }
+        return false;
+    }
+    hal_busy_wait_until(delay_until);
+    *now = hal_time_us();
+    return true;
+}
+
+// Applies a queued event that is not a tap while no taps are down
+static void handle_event(const key_event_t *ev, uint64_t now) {
+    kb_report_t next = held;
+    switch (ev->type) {
+        case KEY_EV_DELAY:
+            delay_until = now + ev->delay_us;
+            key_queue_discard(1);
+            return;
+        case KEY_EV_AT:
+            delay_until = schedule_time(ev, now);
+            key_queue_discard(1);
+            return;
+        case KEY_EV_MACRO:
+            macro_id = ev->macro_id;
+            macro_step = 0;
+            seq_state = SEQ_MACRO;
+            key_queue_discard(1);
+            return;
+        case KEY_EV_DOWN:
+            next.modifier |= ev->modifier;
+            report_add_key(&next, ev->keycodes[0]);
+            break;
+        case KEY_EV_UP:
+            next.modifier &= ~ev->modifier;
+            report_remove_key(&next, ev->keycodes[0]);
+            break;
+        case KEY_EV_RAW:
+            next.modifier = ev->modifier;
+            next.count = 0;
+            for (uint8_t i = 0; i < 6; i++) report_add_key(&next, ev->keycodes[i]);
+            break;
+        default:
+            // A tap that cannot be sent, its key is held or all key slots are in use
+            LOG_WARN("Tap of key 0x%02X dropped, %u keys held", ev->keycodes[0], held.count);
+            key_queue_discard(1);
+            return;
+    }
+    if (send_report(&next, now)) {
+        held = next;
+        track_keys(1);
+        key_queue_discard(1);
+    }
+}
+
+// Releases keys left held by a sender that has gone quiet
+static void release_held(uint64_t now) {
+    kb_report_t none = {0, 0, {0}};
+    if (!send_report(&none, now)) return;
+    LOG_WARN("%u held keys released after %u ms without input", held.count, (unsigned)(HID_HOLD_TIMEOUT_US / 1000));
+    held = none;
+    stats.hold_releases++;
+}
+
+// Sends the next step of the macro being played, then returns to the held keys
+static void macro_step_next(uint64_t now) {
+    kb_report_t next = held;
+    const uint8_t *step = macro_store_step(macro_id, macro_step);
+    if (!step) {
+        if (report_equal(&current, &held) || send_report(&held, now)) {
+            seq_state = SEQ_IDLE;
+        }
+        return;
+    }
+    if (step[1] == MACRO_STEP_DELAY) {
+        delay_until = now + (step[2] | (step[3] << 8) | (step[4] << 16) | ((uint32_t)step[5] << 24));
+        macro_step++;
+        return;
+    }
+    next.modifier = step[0];
+    next.count = 0;
+    for (uint8_t i = 0; i < 6; i++) report_add_key(&next, step[2 + i]);
+    if (send_report(&next, now)) macro_step++;
+}
+
+// Advances the state machine as far as timing and the endpoint allow
+static void sequence_step(void) {
+    uint64_t now = hal_time_us();
+    uint64_t elapsed = now - seq_timer;
+    bool overdue = report_in_flight && elapsed >= HID_REPORT_TIMEOUT_US;
+
+    if (!hal_hid_ready(HID_INSTANCE_KEYBOARD)) {
+        // The endpoint is busy with our own report until the host polls, a
+        // stall is when it stays busy although nothing of ours is pending
+        if (!stalled && (overdue || !report_in_flight) && !hid_engine_idle()) {
+            stalled = true;
+            stats.busy_stalls++;
+        }
+        return;
+    }
+    stalled = false;
+    if (overdue) {
+        // The endpoint is free but the completion never came
+        LOG_WARN("Keyboard report not read within %u ms", (unsigned)(HID_REPORT_TIMEOUT_US / 1000));
+        report_in_flight = false;
+        in_flight_count = 0;
+        stats.lost_reports++;
+    }
+    if (timing.pacing == PACING_COMPLETION && report_in_flight) return;
+
+    kb_report_t next;
+
+    switch (seq_state) {
+        case SEQ_IDLE: {
+            // Start the next queued event, if any
+            if (elapsed < timing.gap_us) break;
+            if (!delay_passed(&now)) break;
+            elapsed = now - seq_timer;
+            const key_event_t *ev = key_queue_peek(0);
+            if (!ev) {
+                if ((held.count || held.modifier) && HID_HOLD_TIMEOUT_US && elapsed >= HID_HOLD_TIMEOUT_US) {
+                    release_held(now);
+                    break;
+                }
+                if (numlock_changed && HID_LOCK_RESTORE_US && elapsed >= HID_LOCK_RESTORE_US) {
+                    if (send_numlock_tap(now)) numlock_changed = false;
+                }
+                break;
+            }
+            if (needs_numlock(ev)) {
+                if (send_numlock_tap(now)) numlock_changed = !numlock_changed;
+                break;
+            }
+            uint8_t taps = (ev->type == KEY_EV_TAP) ? build_next_report(&next) : 0;
+            if (taps) {
+                if (send_report(&next, now)) {
+                    track_keys(taps);
+                    key_queue_discard(taps);
+                    stats.keys += taps;
+                    seq_state = SEQ_PRESSED;
+                }
+            } else {
+                handle_event(ev, now);
+            }
+            break;
+        }
+        case SEQ_PRESSED: {
+            if (elapsed < timing.hold_us) break;
+            const key_event_t *ev = key_queue_peek(0);
+            if (ev && needs_numlock(ev)) {
+                if (send_numlock_tap(now)) numlock_changed = !numlock_changed;
+                break;
+            }
+            uint8_t taps = build_next_report(&next);
+            if (taps) {
+                // Go straight from the current keys to the next ones, the
+                // host sees the old keys released and the new ones pressed
+                if (send_report(&next, now)) {
+                    track_keys(taps);
+                    key_queue_discard(taps);
+                    stats.keys += taps;
+                }
+            } else {
+                // Release the tapped keys. The modifier stays down if the
+                // next key, a repeat of a current one, needs it too.
+                next = held;
+                if (ev && ev->type == KEY_EV_TAP && (held.modifier | tap_modifier(ev)) == current.modifier) {
+                    next.modifier = current.modifier;
+                }
+                if (send_report(&next, now)) {
+                    seq_state = SEQ_IDLE;
+                }
+            }
+            break;
+        }
+        case SEQ_MACRO:
+            if (elapsed < timing.hold_us) break;
+            if (!delay_passed(&now)) break;
+            macro_step_next(now);
+            break;
+    }
+}
+
+void hid_engine_init(void) {
+    seq_state = SEQ_IDLE;
+    memset(&current, 0, sizeof(current));
+    memset(&held, 0, sizeof(held));
+    seq_timer = 0;
+    delay_until = 0;
+    alarm_at = 0;
+    report_in_flight = false;
+    stalled = false;
+    in_flight_count = 0;
+    numlock_changed = false;
+}
+
+void send_sequence_task(void) {
+    sequence_step();
+}
+
+void hid_engine_report_complete(void) {
+    report_in_flight = false;
+
+    uint32_t now = (uint32_t)hal_time_us();
+    for (uint8_t i = 0; i < in_flight_count; i++) {
+        latency_record(in_flight_keys[i].rx_time_us, in_flight_keys[i].enqueue_time_us, in_flight_submit, now);
+    }
+    in_flight_count = 0;
+
+    // Queue the next report right away instead of waiting for the main loop
+    if (timing.pacing == PACING_COMPLETION) {
+        sequence_step();
+    }
+}
+
+// Nothing queued and no key down, though NumLock may still be restored
+static bool drained(void) {
+    return seq_state == SEQ_IDLE && current.modifier == 0 && current.count == 0 && key_queue_empty();
+}
+
+bool hid_engine_idle(void) {
+    return drained() && !numlock_changed;
+}
+
+bool hid_engine_waiting(void) {
+    // The NumLock restore is not urgent, it can wait for the next wakeup.
+    // A delay with an alarm set can be slept through.
+    if (alarm_at && hal_time_us() < alarm_at) return true;
+    return (report_in_flight && timing.pacing == PACING_COMPLETION) || drained();
+}
+
+void hid_engine_set_leds(uint8_t leds) {
+    host_leds = leds;
+    leds_known = true;
+}
+
+uint8_t hid_engine_get_leds(void) {
+    return host_leds;
+}
+
+void hid_engine_set_timing(const hid_timing_t *new_timing) {
+    timing = *new_timing;
+}
+
+void hid_engine_get_timing(hid_timing_t *out) {
+    *out = timing;
+}
+
+void hid_engine_set_pack_limit(uint8_t limit) {
+    if (limit < 1) limit = 1;
+    if (limit > HID_PACK_MAX) limit = HID_PACK_MAX;
+    pack_limit = limit;
+}
+
+uint8_t hid_engine_get_pack_limit(void) {
+    return pack_limit;
+}
+
+void hid_engine_get_stats(hid_engine_stats_t *out) {
+    *out = stats;
+}
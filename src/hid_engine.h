@@ -0,0 +1,111 @@
+#ifndef HID_ENGINE_H_
+#define HID_ENGINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_common.h"
+#include "usb_descriptors.h"
+
+// How the engine decides when to send the next report
+typedef enum {
+    PACING_TIMED,      // Wait out the hold/gap times only (legacy behaviour)
+    PACING_COMPLETION  // Also wait until the host has read the previous report
+} hid_pacing_t;
+
+// Minimum times a key is held down and the keyboard stays released between keys
+typedef struct {
+    hid_pacing_t pacing;
+    uint32_t hold_us;
+    uint32_t gap_us;
+} hid_timing_t;
+
+// Fastest pacing, one report per host poll
+#define HID_TIMING_FAST   { PACING_COMPLETION, 0, 0 }
+// Tolerant hosts that still need a visible key press, e.g. KVM switches
+#define HID_TIMING_SAFE   { PACING_COMPLETION, 20000, 10000 }
+// Fixed 100 ms hold of the original firmware
+#define HID_TIMING_LEGACY { PACING_TIMED, 100000, 0 }
+
+#ifndef HID_TIMING_DEFAULT
+#define HID_TIMING_DEFAULT HID_TIMING_FAST
+#endif
+
+// Keypad digits need NumLock, so the engine taps NumLock before them when
+// the host has it off, and taps it again once the keyboard has been idle
+// this long. 0 leaves NumLock on.
+#ifndef HID_LOCK_RESTORE_US
+#define HID_LOCK_RESTORE_US 500000
+#endif
+
+// Stuck key watchdog. A report not read within HID_REPORT_TIMEOUT_US of
+// hid_common.h counts as lost and the engine moves on to the release. Keys
+// held down by key down or raw report events are released when no event has
+// come for HID_HOLD_TIMEOUT_US, e.g. because the sender went away. 0 holds
+// them forever.
+#ifndef HID_HOLD_TIMEOUT_US
+#define HID_HOLD_TIMEOUT_US 10000000
+#endif
+
+// Scheduled events. The engine sets an alarm this long before a scheduled
+// event or the end of a delay and spins through the rest, so the report is
+// submitted within a few microseconds of its time. Reports aligned to a USB
+// frame are submitted HID_FRAME_LEAD_US before the frame starts, ready for
+// the host's poll in that frame.
+#ifndef HID_SPIN_US
+#define HID_SPIN_US 100
+#endif
+#ifndef HID_FRAME_LEAD_US
+#define HID_FRAME_LEAD_US 50
+#endif
+
+// Key slots of the boot keyboard report
+#define HID_BOOT_KEYS 6
+
+// Most distinct keys down in one keyboard report. The NKRO bitmap has no
+// slot limit, this only bounds the engine's own bookkeeping.
+#if BRIDGE_NKRO
+#define HID_PACK_MAX 16
+#else
+#define HID_PACK_MAX HID_BOOT_KEYS
+#endif
+
+typedef struct {
+    uint32_t reports;       // Keyboard reports submitted, including releases
+    uint32_t keys;          // Key events typed
+    uint32_t busy_stalls;   // Times a report was due but the endpoint stayed busy
+    uint32_t retries;       // Reports the endpoint refused, sent again later
+    uint32_t lost_reports;  // Reports not read within HID_REPORT_TIMEOUT_US
+    uint32_t hold_releases; // Held keys released after HID_HOLD_TIMEOUT_US
+} hid_engine_stats_t;
+
+// Resets the sequence engine, pending key events are kept
+void hid_engine_init(void);
+
+// Handles sending HID key press/release for queued key events
+void send_sequence_task(void);
+
+// Called from tud_hid_report_complete_cb() when the host has read a report
+void hid_engine_report_complete(void);
+
+// True when no key is held and nothing is queued
+bool hid_engine_idle(void);
+
+// True when the engine can do nothing before a report completes or new events arrive
+bool hid_engine_waiting(void);
+
+// Host lock state from its LED output report (LED_* bits). Until the host
+// has sent one, taps are sent as they are.
+void hid_engine_set_leds(uint8_t leds);
+uint8_t hid_engine_get_leds(void);
+
+void hid_engine_set_timing(const hid_timing_t *timing);
+void hid_engine_get_timing(hid_timing_t *timing);
+
+// Sets how many queued keys may be pressed together in one report (1..HID_PACK_MAX)
+void hid_engine_set_pack_limit(uint8_t limit);
+uint8_t hid_engine_get_pack_limit(void);
+
+void hid_engine_get_stats(hid_engine_stats_t *stats);
+
+#endif /* HID_ENGINE_H_ */
@@ -0,0 +1,83 @@
+#ifndef HID_KEYCODES_H_
+#define HID_KEYCODES_H_
+
+#include <stdint.h>
+
+// HID keyboard/keypad usage IDs (HID Usage Tables, page 0x07).
+// Named after the key position on a US keyboard, the character a key
+// produces depends on the layout selected on the host.
+enum : uint8_t {
+    KC_NONE         = 0x00,
+    KC_A            = 0x04,
+    KC_Z            = 0x1D,
+    KC_1            = 0x1E,
+    KC_2            = 0x1F,
+    KC_3            = 0x20,
+    KC_4            = 0x21,
+    KC_5            = 0x22,
+    KC_6            = 0x23,
+    KC_7            = 0x24,
+    KC_8            = 0x25,
+    KC_9            = 0x26,
+    KC_0            = 0x27,
+    KC_ENTER        = 0x28,
+    KC_ESCAPE       = 0x29,
+    KC_BACKSPACE    = 0x2A,
+    KC_TAB          = 0x2B,
+    KC_SPACE        = 0x2C,
+    KC_MINUS        = 0x2D,
+    KC_EQUAL        = 0x2E,
+    KC_LEFT_BRACKET = 0x2F,
+    KC_RIGHT_BRACKET= 0x30,
+    KC_BACKSLASH    = 0x31,
+    KC_NON_US_HASH  = 0x32,
+    KC_SEMICOLON    = 0x33,
+    KC_APOSTROPHE   = 0x34,
+    KC_GRAVE        = 0x35,
+    KC_COMMA        = 0x36,
+    KC_PERIOD       = 0x37,
+    KC_SLASH        = 0x38,
+    KC_CAPS_LOCK    = 0x39,
+    KC_DELETE       = 0x4C,
+    KC_NUM_LOCK     = 0x53,
+    KC_KEYPAD_SLASH = 0x54,
+    KC_KEYPAD_ASTERISK = 0x55,
+    KC_KEYPAD_MINUS = 0x56,
+    KC_KEYPAD_PLUS  = 0x57,
+    KC_KEYPAD_ENTER = 0x58,
+    KC_KEYPAD_1     = 0x59,
+    KC_KEYPAD_2     = 0x5A,
+    KC_KEYPAD_3     = 0x5B,
+    KC_KEYPAD_4     = 0x5C,
+    KC_KEYPAD_5     = 0x5D,
+    KC_KEYPAD_6     = 0x5E,
+    KC_KEYPAD_7     = 0x5F,
+    KC_KEYPAD_8     = 0x60,
+    KC_KEYPAD_9     = 0x61,
+    KC_KEYPAD_0     = 0x62,
+    KC_KEYPAD_PERIOD= 0x63,
+    KC_NON_US_BACKSLASH = 0x64
+};
+
+// Modifier byte bits of the keyboard report
+enum : uint8_t {
+    MOD_LCTRL  = 0x01,
+    MOD_LSHIFT = 0x02,
+    MOD_LALT   = 0x04,
+    MOD_LGUI   = 0x08,
+    MOD_RCTRL  = 0x10,
+    MOD_RSHIFT = 0x20,
+    MOD_RALT   = 0x40, // AltGr on European layouts
+    MOD_RGUI   = 0x80
+};
+
+// Bits of the LED output report the host sends
+enum : uint8_t {
+    LED_NUM_LOCK    = 0x01,
+    LED_CAPS_LOCK   = 0x02,
+    LED_SCROLL_LOCK = 0x04,
+    LED_COMPOSE     = 0x08,
+    LED_KANA        = 0x10
+};
+
+#endif /* HID_KEYCODES_H_ */
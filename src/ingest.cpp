@@ -0,0 +1,208 @@
+#include "ingest.h"
+
+#include "hal.h"
+#include "key_queue.h"
+#include "log.h"
+#include "protocol.h"
+#include "trace.h"
+
+// Received bytes of one channel, taken from the HAL in batches so that a
+// turn can end in the middle of a batch
+typedef struct {
+    uint8_t data[INGEST_RX_BATCH];
+    uint32_t time[INGEST_RX_BATCH];
+    uint8_t pos;
+    uint8_t len;
+    uint8_t weight;
+    utf8_decoder_t utf8;
+} channel_t;
+
+static ingest_mode_t mode = INGEST_DEFAULT_MODE;  // Of the bridge UART
+static bool utf8_text = INGEST_DEFAULT_UTF8;
+static channel_t channels[HAL_UART_CHANNELS];
+
+// Channel being typed, the lines it may still type in this turn and how far
+// into the current line it is
+static uint8_t turn = 0;
+static uint8_t lines_left = 1;
+static uint16_t line_len = 0;
+static uint64_t turn_rx_us = 0;  // When the turn last took a byte
+
+void ingest_init(void) {
+    ingest_set_mode(INGEST_DEFAULT_MODE);
+    for (channel_t &ch : channels) {
+        ch.pos = 0;
+        ch.len = 0;
+        if (!ch.weight) ch.weight = 1;
+        utf8_reset(&ch.utf8);
+    }
+    turn = 0;
+    lines_left = channels[0].weight;
+    line_len = 0;
+}
+
+void ingest_set_weight(uint8_t channel, uint8_t weight) {
+    if (channel < HAL_UART_CHANNELS) channels[channel].weight = weight ? weight : 1;
+}
+
+void ingest_set_mode(ingest_mode_t new_mode) {
+    if (new_mode == INGEST_FRAMED && mode != INGEST_FRAMED) {
+        protocol_reset();
+    }
+    mode = new_mode;
+}
+
+ingest_mode_t ingest_get_mode(void) {
+    return mode;
+}
+
+void ingest_set_utf8(bool utf8) {
+    if (utf8 == utf8_text) return;
+    utf8_text = utf8;
+    for (channel_t &ch : channels) utf8_reset(&ch.utf8);
+}
+
+bool ingest_get_utf8(void) {
+    return utf8_text;
+}
+
+// Expands one received character into key taps and queues them
+void ingest_text_codepoint(uint32_t codepoint, uint32_t rx_time_us) {
+    const unicode_seq_t *seq = unicode_sequence(codepoint);
+
+    LOG_DEBUG("Received character U+%04X ('%c'), %u keys",
+        codepoint, (codepoint >= 32 && codepoint <= 126) ? (char)codepoint : '.', seq->count);
+
+    for (uint8_t i = 0; i < seq->count; i++) {
+        const unicode_key_t &key = seq->keys[i];
+        key_event_t ev = KEY_EVENT_TAP(key.modifier, key.keycode);
+        // An empty release ends a sequence that holds a modifier over its taps
+        if (!key.keycode) ev.type = KEY_EV_UP;
+        ev.rx_time_us = rx_time_us;
+        key_queue_push(&ev);
+    }
+}
+
+// Codepoint of the next byte of a stream, UTF8_PENDING or UTF8_INVALID if none
+static uint32_t decode_byte(utf8_decoder_t *decoder, uint8_t ch) {
+    if (!utf8_text) return ch;
+    uint32_t codepoint = utf8_decode(decoder, ch);
+    if (codepoint == UTF8_INVALID) LOG_DEBUG("Invalid UTF-8 byte 0x%02X dropped", ch);
+    return codepoint;
+}
+
+void ingest_text(const uint8_t *text, size_t len, uint32_t rx_time_us) {
+    // A record holds whole characters
+    utf8_decoder_t decoder = {0, 0, 0};
+    for (size_t i = 0; i < len; i++) {
+        uint32_t codepoint = decode_byte(&decoder, text[i]);
+        if (codepoint < UTF8_INVALID) ingest_text_codepoint(codepoint, rx_time_us);
+    }
+}
+
+size_t ingest_text_events(const uint8_t *text, size_t len) {
+    utf8_decoder_t decoder = {0, 0, 0};
+    size_t events = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t codepoint = utf8_text ? utf8_decode(&decoder, text[i]) : text[i];
+        if (codepoint < UTF8_INVALID) events += unicode_sequence(codepoint)->count;
+    }
+    return events;
+}
+
+// Handles one byte of a channel, returns true when it ends a line or frame
+static bool handle_byte(uint8_t channel, uint8_t ch, uint32_t rx_time_us) {
+    trace_rx(channel, ch, rx_time_us);
+    if (channel == 0 && mode == INGEST_FRAMED) {
+        protocol_rx_byte(ch, rx_time_us);
+        return ch == 0;
+    }
+    if (ch == 0) {
+        // The zero byte also starts the first frame. Only the bridge UART
+        // can send replies, the other channels ignore it.
+        if (channel == 0) {
+            LOG_INFO("Switching to framed input");
+            ingest_set_mode(INGEST_FRAMED);
+        }
+        return true;
+    }
+    uint32_t codepoint = decode_byte(&channels[channel].utf8, ch);
+    if (codepoint < UTF8_INVALID) ingest_text_codepoint(codepoint, rx_time_us);
+    return ch == '\n' || ch == '\r';
+}
+
+// True when the next byte of a channel can be handled without dropping input.
+// Frames are refused with a busy reply when the key queue is full, so the
+// bridge UART can always be drained in framed mode.
+static bool can_take(uint8_t channel) {
+    if (channel == 0 && mode == INGEST_FRAMED) return true;
+    return key_queue_free() >= INGEST_EVENTS_PER_CHAR;
+}
+
+static bool channel_pending(uint8_t channel) {
+    const channel_t &ch = channels[channel];
+    return ch.pos < ch.len || hal_uart_rx_available(channel) > 0;
+}
+
+// Takes the next byte of a channel into its batch, false if there is none
+static bool channel_fill(uint8_t channel) {
+    channel_t &ch = channels[channel];
+    if (ch.pos < ch.len) return true;
+    ch.pos = 0;
+    ch.len = hal_uart_read(channel, ch.data, ch.time, INGEST_RX_BATCH);
+    return ch.len > 0;
+}
+
+// Gives the turn to the next channel with input, round robin
+static void next_turn(void) {
+    for (uint8_t i = 1; i <= HAL_UART_CHANNELS; i++) {
+        uint8_t channel = (turn + i) % HAL_UART_CHANNELS;
+        if (channel_pending(channel)) {
+            turn = channel;
+            break;
+        }
+    }
+    lines_left = channels[turn].weight;
+    line_len = 0;
+}
+
+size_t ingest_task(void) {
+    uint64_t now = hal_time_us();
+    size_t taken = 0;
+    while (taken < INGEST_RX_BATCH) {
+        if (!channel_fill(turn)) {
+            // Pass the turn at a line end right away, in the middle of a
+            // line only once the channel has been quiet for a while
+            uint8_t old_turn = turn;
+            if (line_len == 0 || now - turn_rx_us >= INGEST_TURN_IDLE_US) next_turn();
+            if (turn == old_turn) break;
+            continue;
+        }
+        if (!can_take(turn)) break;
+
+        channel_t &ch = channels[turn];
+        bool line_end = handle_byte(turn, ch.data[ch.pos], ch.time[ch.pos]);
+        ch.pos++;
+        taken++;
+        turn_rx_us = now;
+
+        // Keep a CR LF pair together
+        if (line_end && ch.data[ch.pos - 1] == '\r' && ch.pos < ch.len && ch.data[ch.pos] == '\n' && can_take(turn)) {
+            handle_byte(turn, ch.data[ch.pos], ch.time[ch.pos]);
+            ch.pos++;
+            taken++;
+        }
+
+        if (!line_end && ++line_len < INGEST_LINE_MAX) continue;
+        line_len = 0;
+        if (--lines_left == 0) next_turn();
+    }
+    return taken;
+}
+
+bool ingest_idle(void) {
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        if (channel_pending(channel)) return false;
+    }
+    return true;
+}
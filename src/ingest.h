@@ -0,0 +1,78 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "unicode.h"
+
+// Turns received bytes into key events.
+// In text mode every byte is one Latin-1 character, or with UTF-8 text
+// enabled the bytes are decoded as UTF-8. Characters are typed as
+// unicode.h expands them for the active layout and host input method.
+// A zero byte, which no layout maps, switches the bridge UART to framed mode
+// where the bytes carry COBS framed commands (see protocol.h). The other
+// input channels cannot answer frames and only carry text.
+//
+// Input from several channels is typed a line at a time, so lines from
+// different senders never mix. The channel holding the turn keeps it for
+// its weight in lines, or frames on the bridge UART, then the next channel
+// with input gets it, round robin. A channel that stops in the middle of a
+// line loses the turn after INGEST_TURN_IDLE_US.
+typedef enum {
+    INGEST_TEXT,
+    INGEST_FRAMED
+} ingest_mode_t;
+
+#ifndef INGEST_DEFAULT_MODE
+#define INGEST_DEFAULT_MODE INGEST_TEXT
+#endif
+
+// Text encoding at boot, 1 for UTF-8
+#ifndef INGEST_DEFAULT_UTF8
+#define INGEST_DEFAULT_UTF8 0
+#endif
+
+// Most key events a single text character can turn into
+#define INGEST_EVENTS_PER_CHAR UNICODE_SEQ_MAX
+
+// Max bytes taken from the receive rings per ingest_task() call
+#define INGEST_RX_BATCH 32
+
+// Quiet time after which a channel in the middle of a line passes the turn
+#define INGEST_TURN_IDLE_US 20000
+
+// Longest line, a channel that sends no line ends passes the turn after this many characters
+#define INGEST_LINE_MAX 256
+
+void ingest_init(void);
+
+// Takes received bytes from the input channels and turns them into key
+// events, returns the number of bytes taken. Must run on the core that owns the UART.
+size_t ingest_task(void);
+
+// True when no input is waiting on any channel
+bool ingest_idle(void);
+
+// Lines, or frames, a channel gets per turn, at least 1
+void ingest_set_weight(uint8_t channel, uint8_t weight);
+
+// Mode of the bridge UART
+void ingest_set_mode(ingest_mode_t mode);
+ingest_mode_t ingest_get_mode(void);
+
+// Decodes text as UTF-8 instead of Latin-1, on all channels and in CMD_TEXT
+void ingest_set_utf8(bool utf8);
+bool ingest_get_utf8(void);
+
+// Queues the key events for one character, the caller makes sure
+// INGEST_EVENTS_PER_CHAR events fit
+void ingest_text_codepoint(uint32_t codepoint, uint32_t rx_time_us);
+
+// Text of one CMD_TEXT record, in the current encoding. ingest_text_events()
+// tells how many key events ingest_text() is going to queue.
+void ingest_text(const uint8_t *text, size_t len, uint32_t rx_time_us);
+size_t ingest_text_events(const uint8_t *text, size_t len);
+
+#endif /* INGEST_H_ */
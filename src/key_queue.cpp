@@ -0,0 +1,63 @@
+#include "key_queue.h"
+
+#include "hal.h"
+#include "ring_buffer.h"
+
+static ring_buffer<key_event_t, KEY_QUEUE_SIZE> queue;
+static key_queue_policy_t policy = KEY_QUEUE_BACKPRESSURE;
+static key_queue_stats_t stats = {0, 0, 0, 0};
+
+bool key_queue_push(const key_event_t *ev) {
+    key_event_t stamped = *ev;
+    stamped.enqueue_time_us = (uint32_t)hal_time_us();
+
+    // With backpressure the producer is expected to have checked key_queue_free(),
+    // so a full queue here is a drop either way
+    if (!queue.push(stamped)) {
+        stats.dropped++;
+        return false;
+    }
+    stats.enqueued++;
+    size_t size = queue.size();
+    if (size > stats.high_water) stats.high_water = size;
+    return true;
+}
+
+size_t key_queue_free(void) {
+    // Without backpressure the producer never waits for room
+    return policy == KEY_QUEUE_BACKPRESSURE ? queue.free() : queue.capacity();
+}
+
+bool key_queue_pop(key_event_t *ev) {
+    if (!queue.pop(*ev)) return false;
+    stats.dequeued++;
+    return true;
+}
+
+const key_event_t *key_queue_peek(size_t i) {
+    return queue.peek(i);
+}
+
+void key_queue_discard(size_t n) {
+    stats.dequeued += queue.discard(n);
+}
+
+bool key_queue_empty(void) {
+    return queue.empty();
+}
+
+size_t key_queue_size(void) {
+    return queue.size();
+}
+
+void key_queue_set_policy(key_queue_policy_t new_policy) {
+    policy = new_policy;
+}
+
+key_queue_policy_t key_queue_get_policy(void) {
+    return policy;
+}
+
+void key_queue_get_stats(key_queue_stats_t *out) {
+    *out = stats;
+}
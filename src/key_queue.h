@@ -0,0 +1,67 @@
+#ifndef KEY_QUEUE_H_
+#define KEY_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of pending key events, must be a power of two
+#define KEY_QUEUE_SIZE 64
+
+// What happens to an event offered to a full queue
+typedef enum {
+    KEY_QUEUE_BACKPRESSURE, // Producer checks key_queue_free() and leaves input unread
+    KEY_QUEUE_DROP_NEWEST   // Event is discarded and counted as dropped
+} key_queue_policy_t;
+
+// Key event types
+typedef enum {
+    KEY_EV_TAP,   // Press and release keycodes[0] with modifier
+    KEY_EV_DOWN,  // Press keycodes[0] and modifier and keep them held
+    KEY_EV_UP,    // Release held keycodes[0] and modifier
+    KEY_EV_RAW,   // Send modifier and keycodes as they are, they stay held
+    KEY_EV_DELAY, // Wait delay_us before the next event
+    KEY_EV_MACRO, // Play the stored macro macro_id
+    KEY_EV_AT     // Hold the next event until at_us, low 32 bits of hal_time_us()
+} key_event_type_t;
+
+// KEY_EV_AT flags, in keycodes[0]
+#define KEY_AT_FRAME 0x01  // Submit the next report so the host reads it in the frame starting at or after at_us
+
+typedef struct {
+    uint8_t type;
+    uint8_t modifier;
+    uint8_t keycodes[6];
+    union {
+        uint32_t delay_us;
+        uint32_t macro_id;
+        uint32_t at_us;
+    };
+    uint32_t rx_time_us;      // Arrival of the input byte, set by the producer
+    uint32_t enqueue_time_us; // Set by key_queue_push()
+} key_event_t;
+
+#define KEY_EVENT_TAP(mod, key) { KEY_EV_TAP, (mod), { (key), 0, 0, 0, 0, 0 }, 0, 0, 0 }
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t dequeued;
+    uint32_t dropped;
+    uint32_t high_water;
+} key_queue_stats_t;
+
+// Producer side
+bool key_queue_push(const key_event_t *ev);
+size_t key_queue_free(void);
+
+// Consumer side
+bool key_queue_pop(key_event_t *ev);
+const key_event_t *key_queue_peek(size_t i);
+void key_queue_discard(size_t n);
+bool key_queue_empty(void);
+
+size_t key_queue_size(void);
+void key_queue_set_policy(key_queue_policy_t policy);
+key_queue_policy_t key_queue_get_policy(void);
+void key_queue_get_stats(key_queue_stats_t *stats);
+
+#endif /* KEY_QUEUE_H_ */
@@ -0,0 +1,216 @@
+#include "keymap.h"
+
+#include <stddef.h>
+
+#include "hid_keycodes.h"
+
+// One character of a layout definition
+typedef struct {
+    uint8_t ch;
+    uint8_t modifier;
+    uint8_t keycode;
+    uint8_t flags;
+} keymap_def_t;
+
+typedef struct {
+    keymap_entry_t entry[256];
+    uint8_t caps_keys[32];  // Bit per keycode of the KEYMAP_LETTER entries
+} keymap_table_t;
+
+#define S MOD_LSHIFT
+#define G MOD_RALT
+#define D KEYMAP_DEAD
+#define L KEYMAP_LETTER
+
+// Control characters shared by all text layouts
+static constexpr keymap_def_t defs_common[] = {
+    { '\b', 0, KC_BACKSPACE, 0 },
+    { '\t', 0, KC_TAB, 0 },
+    { '\n', 0, KC_ENTER, 0 },
+    { '\r', 0, KC_ENTER, 0 },
+    { 0x1B, 0, KC_ESCAPE, 0 },
+    { ' ',  0, KC_SPACE, 0 },
+};
+
+// The original keypad-only mapping
+static constexpr keymap_def_t defs_keypad[] = {
+    { '0', 0, KC_KEYPAD_0, 0 },
+    { '1', 0, KC_KEYPAD_1, 0 },
+    { '2', 0, KC_KEYPAD_2, 0 },
+    { '3', 0, KC_KEYPAD_3, 0 },
+    { '4', 0, KC_KEYPAD_4, 0 },
+    { '5', 0, KC_KEYPAD_5, 0 },
+    { '6', 0, KC_KEYPAD_6, 0 },
+    { '7', 0, KC_KEYPAD_7, 0 },
+    { '8', 0, KC_KEYPAD_8, 0 },
+    { '9', 0, KC_KEYPAD_9, 0 },
+    { '*', 0, KC_KEYPAD_ASTERISK, 0 },
+    { '/', 0, KC_KEYPAD_SLASH, 0 },
+    { '-', 0, KC_KEYPAD_MINUS, 0 },
+    { '+', 0, KC_KEYPAD_PLUS, 0 },
+    { '\b', 0, KC_BACKSPACE, 0 },
+    { '\r', 0, KC_KEYPAD_ENTER, 0 },
+    { '\n', 0, KC_KEYPAD_ENTER, 0 },
+};
+
+static constexpr keymap_def_t defs_us[] = {
+    { '1', 0, KC_1, 0 }, { '!', S, KC_1, 0 },
+    { '2', 0, KC_2, 0 }, { '@', S, KC_2, 0 },
+    { '3', 0, KC_3, 0 }, { '#', S, KC_3, 0 },
+    { '4', 0, KC_4, 0 }, { '$', S, KC_4, 0 },
+    { '5', 0, KC_5, 0 }, { '%', S, KC_5, 0 },
+    { '6', 0, KC_6, 0 }, { '^', S, KC_6, 0 },
+    { '7', 0, KC_7, 0 }, { '&', S, KC_7, 0 },
+    { '8', 0, KC_8, 0 }, { '*', S, KC_8, 0 },
+    { '9', 0, KC_9, 0 }, { '(', S, KC_9, 0 },
+    { '0', 0, KC_0, 0 }, { ')', S, KC_0, 0 },
+    { '-', 0, KC_MINUS, 0 }, { '_', S, KC_MINUS, 0 },
+    { '=', 0, KC_EQUAL, 0 }, { '+', S, KC_EQUAL, 0 },
+    { '[', 0, KC_LEFT_BRACKET, 0 }, { '{', S, KC_LEFT_BRACKET, 0 },
+    { ']', 0, KC_RIGHT_BRACKET, 0 }, { '}', S, KC_RIGHT_BRACKET, 0 },
+    { '\\', 0, KC_BACKSLASH, 0 }, { '|', S, KC_BACKSLASH, 0 },
+    { ';', 0, KC_SEMICOLON, 0 }, { ':', S, KC_SEMICOLON, 0 },
+    { '\'', 0, KC_APOSTROPHE, 0 }, { '"', S, KC_APOSTROPHE, 0 },
+    { '`', 0, KC_GRAVE, 0 }, { '~', S, KC_GRAVE, 0 },
+    { ',', 0, KC_COMMA, 0 }, { '<', S, KC_COMMA, 0 },
+    { '.', 0, KC_PERIOD, 0 }, { '>', S, KC_PERIOD, 0 },
+    { '/', 0, KC_SLASH, 0 }, { '?', S, KC_SLASH, 0 },
+};
+
+// Finnish/Swedish ISO layout
+static constexpr keymap_def_t defs_fi[] = {
+    { '1', 0, KC_1, 0 }, { '!', S, KC_1, 0 },
+    { '2', 0, KC_2, 0 }, { '"', S, KC_2, 0 }, { '@', G, KC_2, 0 },
+    { '3', 0, KC_3, 0 }, { '#', S, KC_3, 0 }, { 0xA3, G, KC_3, 0 },   // £
+    { '4', 0, KC_4, 0 }, { 0xA4, S, KC_4, 0 }, { '$', G, KC_4, 0 },   // ¤
+    { '5', 0, KC_5, 0 }, { '%', S, KC_5, 0 },
+    { '6', 0, KC_6, 0 }, { '&', S, KC_6, 0 },
+    { '7', 0, KC_7, 0 }, { '/', S, KC_7, 0 }, { '{', G, KC_7, 0 },
+    { '8', 0, KC_8, 0 }, { '(', S, KC_8, 0 }, { '[', G, KC_8, 0 },
+    { '9', 0, KC_9, 0 }, { ')', S, KC_9, 0 }, { ']', G, KC_9, 0 },
+    { '0', 0, KC_0, 0 }, { '=', S, KC_0, 0 }, { '}', G, KC_0, 0 },
+    { '+', 0, KC_MINUS, 0 }, { '?', S, KC_MINUS, 0 }, { '\\', G, KC_MINUS, 0 },
+    { 0xB4, 0, KC_EQUAL, D }, { '`', S, KC_EQUAL, D },                // ´
+    { 0xE5, 0, KC_LEFT_BRACKET, L }, { 0xC5, S, KC_LEFT_BRACKET, L }, // å Å
+    { 0xA8, 0, KC_RIGHT_BRACKET, D }, { '^', S, KC_RIGHT_BRACKET, D }, { '~', G, KC_RIGHT_BRACKET, D }, // ¨
+    { '\'', 0, KC_NON_US_HASH, 0 }, { '*', S, KC_NON_US_HASH, 0 },
+    { 0xF6, 0, KC_SEMICOLON, L }, { 0xD6, S, KC_SEMICOLON, L },       // ö Ö
+    { 0xE4, 0, KC_APOSTROPHE, L }, { 0xC4, S, KC_APOSTROPHE, L },     // ä Ä
+    { 0xA7, 0, KC_GRAVE, 0 }, { 0xBD, S, KC_GRAVE, 0 },               // § ½
+    { ',', 0, KC_COMMA, 0 }, { ';', S, KC_COMMA, 0 },
+    { '.', 0, KC_PERIOD, 0 }, { ':', S, KC_PERIOD, 0 },
+    { '-', 0, KC_SLASH, 0 }, { '_', S, KC_SLASH, 0 },
+    { '<', 0, KC_NON_US_BACKSLASH, 0 }, { '>', S, KC_NON_US_BACKSLASH, 0 }, { '|', G, KC_NON_US_BACKSLASH, 0 },
+    { 0xB5, G, KC_A + ('m' - 'a'), 0 },                               // µ
+};
+
+// German QWERTZ layout, the y/z swap is applied by the table builder
+static constexpr keymap_def_t defs_de[] = {
+    { '1', 0, KC_1, 0 }, { '!', S, KC_1, 0 },
+    { '2', 0, KC_2, 0 }, { '"', S, KC_2, 0 }, { 0xB2, G, KC_2, 0 },   // ²
+    { '3', 0, KC_3, 0 }, { 0xA7, S, KC_3, 0 }, { 0xB3, G, KC_3, 0 },  // § ³
+    { '4', 0, KC_4, 0 }, { '$', S, KC_4, 0 },
+    { '5', 0, KC_5, 0 }, { '%', S, KC_5, 0 },
+    { '6', 0, KC_6, 0 }, { '&', S, KC_6, 0 },
+    { '7', 0, KC_7, 0 }, { '/', S, KC_7, 0 }, { '{', G, KC_7, 0 },
+    { '8', 0, KC_8, 0 }, { '(', S, KC_8, 0 }, { '[', G, KC_8, 0 },
+    { '9', 0, KC_9, 0 }, { ')', S, KC_9, 0 }, { ']', G, KC_9, 0 },
+    { '0', 0, KC_0, 0 }, { '=', S, KC_0, 0 }, { '}', G, KC_0, 0 },
+    { 0xDF, 0, KC_MINUS, 0 }, { '?', S, KC_MINUS, 0 }, { '\\', G, KC_MINUS, 0 }, // ß
+    { 0xB4, 0, KC_EQUAL, D }, { '`', S, KC_EQUAL, D },                // ´
+    { 0xFC, 0, KC_LEFT_BRACKET, L }, { 0xDC, S, KC_LEFT_BRACKET, L }, // ü Ü
+    { '+', 0, KC_RIGHT_BRACKET, 0 }, { '*', S, KC_RIGHT_BRACKET, 0 }, { '~', G, KC_RIGHT_BRACKET, 0 },
+    { '#', 0, KC_NON_US_HASH, 0 }, { '\'', S, KC_NON_US_HASH, 0 },
+    { 0xF6, 0, KC_SEMICOLON, L }, { 0xD6, S, KC_SEMICOLON, L },       // ö Ö
+    { 0xE4, 0, KC_APOSTROPHE, L }, { 0xC4, S, KC_APOSTROPHE, L },     // ä Ä
+    { '^', 0, KC_GRAVE, D }, { 0xB0, S, KC_GRAVE, 0 },                // °
+    { ',', 0, KC_COMMA, 0 }, { ';', S, KC_COMMA, 0 },
+    { '.', 0, KC_PERIOD, 0 }, { ':', S, KC_PERIOD, 0 },
+    { '-', 0, KC_SLASH, 0 }, { '_', S, KC_SLASH, 0 },
+    { '<', 0, KC_NON_US_BACKSLASH, 0 }, { '>', S, KC_NON_US_BACKSLASH, 0 }, { '|', G, KC_NON_US_BACKSLASH, 0 },
+    { '@', G, KC_A + ('q' - 'a'), 0 },
+    { 0xB5, G, KC_A + ('m' - 'a'), 0 },                               // µ
+};
+
+// Characters beyond Latin-1 the layouts have keys for
+typedef struct {
+    uint8_t layout;
+    uint32_t codepoint;
+    keymap_entry_t entry;
+} keymap_wide_t;
+
+static constexpr keymap_wide_t defs_wide[] = {
+    { LAYOUT_FI, 0x20AC, { G, KC_A + ('e' - 'a'), 0 } },  // €
+    { LAYOUT_DE, 0x20AC, { G, KC_A + ('e' - 'a'), 0 } },  // €
+};
+
+#undef S
+#undef G
+#undef D
+#undef L
+
+template <size_t N>
+static constexpr void apply_defs(keymap_table_t &table, const keymap_def_t (&defs)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        table.entry[defs[i].ch] = { defs[i].modifier, defs[i].keycode, defs[i].flags };
+        if (defs[i].flags & KEYMAP_LETTER) table.caps_keys[defs[i].keycode / 8] |= 1 << (defs[i].keycode % 8);
+    }
+}
+
+// Builds a full 256 entry table at compile time. Text layouts get the
+// control characters and the letters a-z/A-Z, swap_yz moves y and z for QWERTZ.
+// The letter keys are CapsLock keys in every layout, also for key taps sent
+// with the keypad layout.
+template <size_t N>
+static constexpr keymap_table_t build_table(const keymap_def_t (&defs)[N], bool text, bool swap_yz) {
+    keymap_table_t table = {};
+    for (int i = 0; i < 26; i++) table.caps_keys[(KC_A + i) / 8] |= 1 << ((KC_A + i) % 8);
+    if (text) {
+        apply_defs(table, defs_common);
+        for (int i = 0; i < 26; i++) {
+            uint8_t keycode = KC_A + i;
+            if (swap_yz && i == 'y' - 'a') keycode = KC_Z;
+            if (swap_yz && i == 'z' - 'a') keycode = KC_Z - 1;
+            table.entry['a' + i] = { 0, keycode, KEYMAP_LETTER };
+            table.entry['A' + i] = { MOD_LSHIFT, keycode, KEYMAP_LETTER };
+        }
+    }
+    apply_defs(table, defs);
+    return table;
+}
+
+static constexpr keymap_table_t keymap_tables[LAYOUT_COUNT] = {
+    build_table(defs_keypad, false, false),
+    build_table(defs_us, true, false),
+    build_table(defs_fi, true, false),
+    build_table(defs_de, true, true),
+};
+
+static_assert(keymap_tables[LAYOUT_US].entry['A'].modifier == MOD_LSHIFT, "US table");
+static_assert(keymap_tables[LAYOUT_DE].entry['z'].keycode == KC_A + ('y' - 'a'), "QWERTZ swap");
+static_assert(keymap_tables[LAYOUT_KEYPAD].entry['a'].keycode == KC_NONE, "keypad table");
+static_assert(keymap_tables[LAYOUT_FI].caps_keys[KC_APOSTROPHE / 8] & (1 << (KC_APOSTROPHE % 8)), "FI letters");
+
+static keymap_layout_t active_layout = KEYMAP_DEFAULT_LAYOUT;
+const keymap_entry_t *keymap_active = keymap_tables[KEYMAP_DEFAULT_LAYOUT].entry;
+
+void keymap_set_layout(keymap_layout_t layout) {
+    if (layout >= LAYOUT_COUNT) return;
+    active_layout = layout;
+    keymap_active = keymap_tables[layout].entry;
+}
+
+keymap_layout_t keymap_get_layout(void) {
+    return active_layout;
+}
+
+bool keymap_caps_key(uint8_t keycode) {
+    return keymap_tables[active_layout].caps_keys[keycode / 8] & (1 << (keycode % 8));
+}
+
+keymap_entry_t keymap_lookup_wide(uint32_t codepoint) {
+    for (const keymap_wide_t &def : defs_wide) {
+        if (def.layout == active_layout && def.codepoint == codepoint) return def.entry;
+    }
+    return keymap_entry_t{ 0, 0, 0 };
+}
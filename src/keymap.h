@@ -0,0 +1,47 @@
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <stdint.h>
+
+// Character to key translation for the text input mode.
+// Tables are indexed by the received byte, bytes 0x80..0xFF are Latin-1.
+
+typedef enum {
+    LAYOUT_KEYPAD, // Digits, + - * / and Enter on the numeric keypad (layout independent)
+    LAYOUT_US,
+    LAYOUT_FI,     // Finnish/Swedish, also fits Norwegian and Danish letters
+    LAYOUT_DE,
+    LAYOUT_COUNT
+} keymap_layout_t;
+
+#ifndef KEYMAP_DEFAULT_LAYOUT
+#define KEYMAP_DEFAULT_LAYOUT LAYOUT_KEYPAD
+#endif
+
+// Entry flags
+#define KEYMAP_DEAD   0x01 // Dead key, a space must follow to produce the character itself
+#define KEYMAP_LETTER 0x02 // Letter, CapsLock on the host inverts Shift for its key
+
+typedef struct {
+    uint8_t modifier;
+    uint8_t keycode; // 0 when the character has no key in this layout
+    uint8_t flags;
+} keymap_entry_t;
+
+extern const keymap_entry_t *keymap_active;
+
+void keymap_set_layout(keymap_layout_t layout);
+keymap_layout_t keymap_get_layout(void);
+
+static inline keymap_entry_t keymap_lookup(uint8_t ch) {
+    return keymap_active[ch];
+}
+
+// True when CapsLock affects the key in the active layout: a-z and the
+// layout's own letters such as ä
+bool keymap_caps_key(uint8_t keycode);
+
+// Key of a character beyond Latin-1 in the active layout, e.g. the euro sign
+keymap_entry_t keymap_lookup_wide(uint32_t codepoint);
+
+#endif /* KEYMAP_H_ */
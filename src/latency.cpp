@@ -0,0 +1,47 @@
+#include "latency.h"
+
+#include <string.h>
+
+static latency_hist_t hists[LAT_STAGE_COUNT];
+
+static uint8_t bucket_of(uint32_t us) {
+    uint8_t bits = us ? 32 - __builtin_clz(us) : 0;
+    return bits < LATENCY_BUCKETS ? bits : LATENCY_BUCKETS - 1;
+}
+
+static void hist_add(latency_hist_t *hist, uint32_t us) {
+    if (hist->count == 0 || us < hist->min_us) hist->min_us = us;
+    if (us > hist->max_us) hist->max_us = us;
+    hist->count++;
+    hist->sum_us += us;
+    hist->buckets[bucket_of(us)]++;
+}
+
+void latency_record(uint32_t rx_us, uint32_t enqueue_us, uint32_t submit_us, uint32_t complete_us) {
+    hist_add(&hists[LAT_PARSE], enqueue_us - rx_us);
+    hist_add(&hists[LAT_PACING], submit_us - enqueue_us);
+    hist_add(&hists[LAT_USB], complete_us - submit_us);
+    hist_add(&hists[LAT_TOTAL], complete_us - rx_us);
+}
+
+void latency_get(latency_stage_t stage, latency_hist_t *hist) {
+    *hist = hists[stage];
+}
+
+void latency_reset(void) {
+    memset(hists, 0, sizeof(hists));
+}
+
+uint32_t latency_percentile(const latency_hist_t *hist, uint32_t percent) {
+    if (hist->count == 0) return 0;
+    uint64_t target = ((uint64_t)hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= target) {
+            uint32_t upper = (b == 0) ? 0 : (b >= 31 ? UINT32_MAX : (1u << b) - 1);
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
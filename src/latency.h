@@ -0,0 +1,40 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+// End-to-end key latency statistics. Every key event is stamped when its
+// byte arrived on the UART, when it entered the key queue, when its report
+// was submitted and when the host read that report. Each stage keeps a
+// log2 bucketed histogram plus min/max.
+
+typedef enum {
+    LAT_PARSE,   // UART arrival to key queue: receive ring, parsing, backpressure
+    LAT_PACING,  // Key queue to report submission: queueing and pacing
+    LAT_USB,     // Submission to the host reading the report: endpoint polling
+    LAT_TOTAL,   // UART arrival to the host reading the report
+    LAT_STAGE_COUNT
+} latency_stage_t;
+
+// Bucket b counts latencies of b significant bits, [2^(b-1), 2^b) us,
+// the last bucket also takes everything longer
+#define LATENCY_BUCKETS 24
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+// Records one key, all times are low 32 bits of hal_time_us()
+void latency_record(uint32_t rx_us, uint32_t enqueue_us, uint32_t submit_us, uint32_t complete_us);
+
+void latency_get(latency_stage_t stage, latency_hist_t *hist);
+void latency_reset(void);
+
+// Upper bound of the bucket holding the given percentile, capped at max_us
+uint32_t latency_percentile(const latency_hist_t *hist, uint32_t percent);
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,66 @@
+#include "log.h"
+
+#include <stdio.h>
+
+#include "hal.h"
+#include "ring_buffer.h"
+
+typedef struct {
+    const char *fmt;
+    uint32_t args[3];
+} log_record_t;
+
+// One record queue per core keeps each queue single producer, so both cores
+// can log without locking. log_task() empties them in core order.
+static ring_buffer<log_record_t, LOG_QUEUE_SIZE> records[2];
+static volatile uint8_t log_level = LOG_LEVEL_DEFAULT;
+static uint32_t dropped[2] = {0, 0};
+
+void log_set_level(uint8_t level) {
+    log_level = level;
+}
+
+uint8_t log_get_level(void) {
+    return log_level;
+}
+
+void log_write(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2) {
+    if (level > log_level) return;
+    log_record_t rec = { fmt, { a0, a1, a2 } };
+    unsigned core = hal_core_num();
+    if (!records[core].push(rec)) dropped[core]++;
+}
+
+// Formats the records of one core, returns false when the UART is full
+static bool log_drain(ring_buffer<log_record_t, LOG_QUEUE_SIZE> &queue) {
+    const log_record_t *rec;
+    while ((rec = queue.peek(0)) != NULL) {
+        char line[96];
+        int len = snprintf(line, sizeof(line) - 2, rec->fmt,
+            (unsigned)rec->args[0], (unsigned)rec->args[1], (unsigned)rec->args[2]);
+        if (len < 0) len = 0;
+        if (len > (int)sizeof(line) - 3) len = sizeof(line) - 3;
+        line[len++] = '\r';
+        line[len++] = '\n';
+
+        // Leave the record queued until the whole line fits
+        if (hal_uart_tx_free() < (size_t)len) return false;
+        hal_uart_write((const uint8_t *)line, len);
+        queue.discard(1);
+    }
+    return true;
+}
+
+void log_task(void) {
+    if (log_drain(records[0])) {
+        log_drain(records[1]);
+    }
+}
+
+bool log_pending(void) {
+    return !records[0].empty() || !records[1].empty();
+}
+
+uint32_t log_dropped(void) {
+    return dropped[0] + dropped[1];
+}
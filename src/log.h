@@ -0,0 +1,58 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Diagnostic output on the bridge UART.
+// Logging only stores the format string and up to three integer arguments,
+// log_task() formats the records later and hands them to the interrupt driven
+// UART transmitter. Nothing here ever waits for the UART, records that do not
+// fit are dropped and counted. Formats must not use %s.
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out, LOG_LEVEL_NONE gives a quiet build
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_LEVEL_DEBUG
+#endif
+
+// Initial runtime level
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_DEBUG
+#endif
+
+// Number of buffered log records, must be a power of two
+#define LOG_QUEUE_SIZE 32
+
+void log_set_level(uint8_t level);
+uint8_t log_get_level(void);
+
+// Queues one record, use the LOG_* macros instead
+void log_write(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2);
+
+// Formats queued records while the UART transmit ring has room.
+// Must run on the core that owns the UART.
+void log_task(void);
+
+// True while records wait to be formatted
+bool log_pending(void);
+
+// Records lost because the record queue was full
+uint32_t log_dropped(void);
+
+static inline void log_msg(uint8_t level, const char *fmt, uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0) {
+    log_write(level, fmt, a0, a1, a2);
+}
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL_MAX) log_msg((level), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif /* LOG_H_ */
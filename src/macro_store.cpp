@@ -0,0 +1,331 @@
+#include "macro_store.h"
+
+#include <string.h>
+
+#include "crc16.h"
+#include "hal.h"
+#include "log.h"
+
+// Bank layout: header, then records back to back, erased flash after the last one
+#define BANK_MAGIC 0x4D41434Du  // "MACM"
+#define BANK_HEADER_LEN 8
+#define RECORD_MAGIC 0xA55A
+#define RECORD_HEADER_LEN 8
+
+static_assert(MACRO_STORE_OFFSET + 2 * MACRO_BANK_SIZE <= HAL_STORAGE_SIZE, "macro banks do not fit the storage area");
+static_assert(MACRO_BANK_SIZE % HAL_STORAGE_SECTOR == 0, "macro banks must be whole sectors");
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+} bank_header_t;
+
+// len 0 deletes the macro
+typedef struct {
+    uint16_t magic;
+    uint16_t id;
+    uint16_t len;
+    uint16_t crc;  // Over id, len and the data
+} record_header_t;
+
+// Open addressing hash table from macro id to its record
+#define INDEX_SLOTS 128
+#define INDEX_EMPTY 0xFFFF
+
+static_assert(INDEX_SLOTS >= 2 * MACRO_MAX_COUNT, "macro index too small");
+
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+    uint32_t offset;  // Of the data in the storage area
+} index_slot_t;
+
+static index_slot_t slots[INDEX_SLOTS];
+static int active_bank = -1;
+static uint32_t append_pos = 0;  // Within the active bank
+static macro_store_stats_t stats = {0, 0, 0, 0, 0, 0};
+
+// Upload in progress
+static uint8_t staging[MACRO_MAX_LEN];
+static uint16_t staging_id = 0;
+static uint16_t staging_len = 0;
+static uint16_t staging_received = 0;
+static bool staging_active = false;
+
+static uint32_t record_size(uint16_t len) {
+    return (RECORD_HEADER_LEN + len + 3) & ~3u;
+}
+
+static uint32_t bank_offset(int bank) {
+    return MACRO_STORE_OFFSET + (uint32_t)bank * MACRO_BANK_SIZE;
+}
+
+//--------------------------------------------------------------------+
+// Index
+//--------------------------------------------------------------------+
+
+static uint32_t index_hash(uint16_t id) {
+    // Fibonacci hashing, the top bits of id * 2^32 / phi
+    return ((uint32_t)id * 2654435769u) >> 25;
+}
+
+static int index_find(uint16_t id) {
+    for (uint32_t i = index_hash(id), n = 0; n < INDEX_SLOTS; i = (i + 1) % INDEX_SLOTS, n++) {
+        if (slots[i].id == id) return (int)i;
+        if (slots[i].id == INDEX_EMPTY) return -1;
+    }
+    return -1;
+}
+
+static bool index_put(uint16_t id, uint16_t len, uint32_t offset) {
+    uint32_t i = index_hash(id);
+    for (uint32_t n = 0; n < INDEX_SLOTS; i = (i + 1) % INDEX_SLOTS, n++) {
+        if (slots[i].id == id) break;
+        if (slots[i].id == INDEX_EMPTY) {
+            if (stats.count >= MACRO_MAX_COUNT) return false;
+            stats.count++;
+            break;
+        }
+    }
+    slots[i] = { id, len, offset };
+    return true;
+}
+
+static void index_remove(uint16_t id) {
+    int i = index_find(id);
+    if (i < 0) return;
+    slots[i].id = INDEX_EMPTY;
+    stats.count--;
+
+    // Reinsert the rest of the probe run so lookups do not stop at the hole
+    for (uint32_t j = (i + 1) % INDEX_SLOTS; slots[j].id != INDEX_EMPTY; j = (j + 1) % INDEX_SLOTS) {
+        index_slot_t moved = slots[j];
+        slots[j].id = INDEX_EMPTY;
+        stats.count--;
+        index_put(moved.id, moved.len, moved.offset);
+    }
+}
+
+static uint32_t live_bytes(void) {
+    uint32_t bytes = BANK_HEADER_LEN;
+    for (const index_slot_t &slot : slots) {
+        if (slot.id != INDEX_EMPTY) bytes += record_size(slot.len);
+    }
+    return bytes;
+}
+
+//--------------------------------------------------------------------+
+// Flash
+//--------------------------------------------------------------------+
+
+// Programs any byte range one page at a time, bytes around it in the
+// page are written as 0xFF and keep their contents. src may point into
+// the storage area, it is copied to RAM before each page is programmed.
+static bool program_bytes(uint32_t offset, const uint8_t *src, size_t len) {
+    static uint8_t page[HAL_STORAGE_PAGE];
+    while (len > 0) {
+        uint32_t page_start = offset - offset % HAL_STORAGE_PAGE;
+        size_t in_page = offset - page_start;
+        size_t chunk = HAL_STORAGE_PAGE - in_page;
+        if (chunk > len) chunk = len;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(&page[in_page], src, chunk);
+        if (!hal_storage_program(page_start, page, sizeof(page))) return false;
+        offset += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+static uint16_t record_crc(const record_header_t *header, const uint8_t *data) {
+    uint8_t head[4] = { (uint8_t)header->id, (uint8_t)(header->id >> 8), (uint8_t)header->len, (uint8_t)(header->len >> 8) };
+    return crc16_update(crc16(head, sizeof(head)), data, header->len);
+}
+
+// Indexes the records of a bank, returns the append position
+static uint32_t scan_bank(int bank) {
+    const uint8_t *base = hal_storage() + bank_offset(bank);
+    uint32_t pos = BANK_HEADER_LEN;
+    while (pos + RECORD_HEADER_LEN <= MACRO_BANK_SIZE) {
+        record_header_t header;
+        memcpy(&header, base + pos, sizeof(header));
+        if (header.magic == 0xFFFF && header.id == 0xFFFF) break;  // Erased, end of the log
+
+        const uint8_t *data = base + pos + RECORD_HEADER_LEN;
+        if (header.magic != RECORD_MAGIC || pos + record_size(header.len) > MACRO_BANK_SIZE ||
+            record_crc(&header, data) != header.crc) {
+            // Interrupted write, append nothing after it until the next compaction
+            LOG_WARN("Macro bank %u damaged at %u", bank, pos);
+            return MACRO_BANK_SIZE;
+        }
+        if (header.len == 0) {
+            index_remove(header.id);
+        } else {
+            index_put(header.id, header.len, bank_offset(bank) + pos + RECORD_HEADER_LEN);
+        }
+        pos += record_size(header.len);
+    }
+    return pos;
+}
+
+// Finds the active bank and rebuilds the index from its log
+static void load(void) {
+    for (index_slot_t &slot : slots) slot.id = INDEX_EMPTY;
+    stats.count = 0;
+    stats.generation = 0;
+    active_bank = -1;
+    append_pos = 0;
+
+    // The bank with a valid header and the newest generation is active
+    for (int bank = 0; bank < 2; bank++) {
+        bank_header_t header;
+        memcpy(&header, hal_storage() + bank_offset(bank), sizeof(header));
+        if (header.magic != BANK_MAGIC) continue;
+        if (active_bank < 0 || header.generation > stats.generation) {
+            active_bank = bank;
+            stats.generation = header.generation;
+        }
+    }
+    if (active_bank >= 0) append_pos = scan_bank(active_bank);
+}
+
+static bool write_bank_header(int bank, uint32_t generation) {
+    bank_header_t header = { BANK_MAGIC, generation };
+    return program_bytes(bank_offset(bank), (const uint8_t *)&header, sizeof(header));
+}
+
+// Copies the live macros except skip_id into the other bank. Its header is
+// written last, so a reset or a failed write leaves the old bank active;
+// the caller then reloads the index from it.
+static bool compact(uint16_t skip_id) {
+    int target = active_bank < 0 ? 0 : 1 - active_bank;
+    if (!hal_storage_erase(bank_offset(target), MACRO_BANK_SIZE)) return false;
+
+    index_remove(skip_id);
+    uint32_t pos = BANK_HEADER_LEN;
+    for (index_slot_t &slot : slots) {
+        if (slot.id == INDEX_EMPTY) continue;
+        const uint8_t *record = hal_storage() + slot.offset - RECORD_HEADER_LEN;
+        if (!program_bytes(bank_offset(target) + pos, record, RECORD_HEADER_LEN + slot.len)) return false;
+        slot.offset = bank_offset(target) + pos + RECORD_HEADER_LEN;
+        pos += record_size(slot.len);
+    }
+    if (!write_bank_header(target, stats.generation + 1)) return false;
+
+    active_bank = target;
+    append_pos = pos;
+    stats.generation++;
+    stats.compactions++;
+    LOG_INFO("Macro store compacted into bank %u, %u bytes live", target, pos);
+    return true;
+}
+
+static bool write_record(uint16_t id, const uint8_t *data, uint16_t len) {
+    uint32_t size = record_size(len);
+    if (active_bank < 0 || append_pos + size > MACRO_BANK_SIZE) {
+        // The old version of the macro is left behind, which is all a delete needs
+        if (!compact(id)) {
+            load();
+            return false;
+        }
+        if (append_pos + size > MACRO_BANK_SIZE) return false;
+        if (len == 0) return true;
+    }
+
+    record_header_t header = { RECORD_MAGIC, id, len, 0 };
+    header.crc = record_crc(&header, data);
+    uint32_t offset = bank_offset(active_bank) + append_pos;
+    if (!program_bytes(offset, (const uint8_t *)&header, sizeof(header)) ||
+        (len && !program_bytes(offset + RECORD_HEADER_LEN, data, len))) {
+        // Whatever got written fails its CRC, stop appending to this bank
+        append_pos = MACRO_BANK_SIZE;
+        return false;
+    }
+    append_pos += size;
+
+    if (len == 0) {
+        index_remove(id);
+    } else {
+        index_put(id, len, offset + RECORD_HEADER_LEN);
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void macro_store_init(void) {
+    staging_active = false;
+    load();
+    if (active_bank >= 0) {
+        LOG_INFO("Macro store bank %u, %u macros", active_bank, stats.count);
+    }
+}
+
+const uint8_t *macro_store_step(uint16_t id, uint16_t index) {
+    int i = index_find(id);
+    if (i < 0 || ((uint32_t)index + 1) * MACRO_STEP_LEN > slots[i].len) return NULL;
+    return hal_storage() + slots[i].offset + (uint32_t)index * MACRO_STEP_LEN;
+}
+
+bool macro_store_exists(uint16_t id) {
+    return index_find(id) >= 0;
+}
+
+bool macro_store_begin(uint16_t id, uint16_t len) {
+    if (id > MACRO_ID_MAX || len == 0 || len > MACRO_MAX_LEN || len % MACRO_STEP_LEN) return false;
+    staging_id = id;
+    staging_len = len;
+    staging_received = 0;
+    staging_active = true;
+    return true;
+}
+
+bool macro_store_append(const uint8_t *data, size_t len) {
+    if (!staging_active || staging_received + len > staging_len) return false;
+    memcpy(&staging[staging_received], data, len);
+    staging_received += len;
+    return true;
+}
+
+bool macro_store_staging(uint16_t *id, uint16_t *len, uint16_t *received) {
+    *id = staging_id;
+    *len = staging_len;
+    *received = staging_received;
+    return staging_active;
+}
+
+bool macro_store_commit(void) {
+    if (!staging_active || staging_received != staging_len) return false;
+    staging_active = false;
+    if (!write_record(staging_id, staging, staging_len)) {
+        stats.write_errors++;
+        return false;
+    }
+    return true;
+}
+
+bool macro_store_delete(uint16_t id) {
+    if (!macro_store_exists(id)) return true;
+    if (!write_record(id, NULL, 0)) {
+        stats.write_errors++;
+        return false;
+    }
+    return true;
+}
+
+bool macro_store_has_room(uint16_t id, uint16_t len) {
+    int i = index_find(id);
+    if (i < 0 && stats.count >= MACRO_MAX_COUNT) return false;
+    if (active_bank >= 0 && append_pos + record_size(len) <= MACRO_BANK_SIZE) return true;
+    uint32_t replaced = (i >= 0) ? record_size(slots[i].len) : 0;
+    return live_bytes() - replaced + record_size(len) <= MACRO_BANK_SIZE;
+}
+
+void macro_store_get_stats(macro_store_stats_t *out) {
+    *out = stats;
+    out->bank = active_bank < 0 ? 0 : active_bank;
+    out->used = append_pos;
+}
@@ -0,0 +1,72 @@
+#ifndef MACRO_STORE_H_
+#define MACRO_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Macro library in the flash storage area. A macro is a precompiled list of
+// 8 byte steps addressed by a 16 bit id. The HID engine plays a macro by
+// reading its steps in place through XIP, so a one frame command can type
+// a long login string without resending it over the UART.
+//
+// The store is a log of records in one of two banks. Rewriting or deleting
+// a macro appends a record; when the bank is full the live macros are copied
+// to the other bank, which is erased only then. A RAM hash table maps ids
+// to records and is rebuilt from the log at boot.
+
+// Start of the banks in the storage area, behind the config sectors
+#define MACRO_STORE_OFFSET (2 * 4096)
+
+// Each bank is this many flash sectors
+#define MACRO_BANK_SIZE (4 * 4096)
+
+// Most macros stored at once
+#define MACRO_MAX_COUNT 64
+
+// Longest macro, macros are staged in RAM while they are uploaded
+#define MACRO_MAX_LEN 2048
+
+// A step is a boot keyboard report: modifier, reserved, six keycodes.
+// A step with MACRO_STEP_DELAY in the reserved byte instead waits for the
+// little endian u32 microseconds in bytes 2..5.
+#define MACRO_STEP_LEN 8
+#define MACRO_STEP_DELAY 0x01
+
+// Ids are 0..MACRO_ID_MAX
+#define MACRO_ID_MAX 0xFFFE
+
+typedef struct {
+    uint32_t count;        // Live macros
+    uint32_t bank;         // Active bank
+    uint32_t generation;   // Bumped on every compaction
+    uint32_t used;         // Bytes of the active bank in use, including dead records
+    uint32_t compactions;
+    uint32_t write_errors;
+} macro_store_stats_t;
+
+// Finds the active bank and indexes its macros
+void macro_store_init(void);
+
+// Step i of a macro, read in place from flash, NULL past the end or if the macro does not exist
+const uint8_t *macro_store_step(uint16_t id, uint16_t index);
+
+bool macro_store_exists(uint16_t id);
+
+// Upload: begin with the id and total length, append the data in order, commit.
+// Commit fails if the data is incomplete or the store is full.
+bool macro_store_begin(uint16_t id, uint16_t len);
+bool macro_store_append(const uint8_t *data, size_t len);
+bool macro_store_commit(void);
+
+// True while an upload is open, with its id, length and the bytes received so far
+bool macro_store_staging(uint16_t *id, uint16_t *len, uint16_t *received);
+
+bool macro_store_delete(uint16_t id);
+
+// True if a macro of len bytes fits, possibly after a compaction
+bool macro_store_has_room(uint16_t id, uint16_t len);
+
+void macro_store_get_stats(macro_store_stats_t *stats);
+
+#endif /* MACRO_STORE_H_ */
@@ -23,182 +23,235 @@
  *
  */
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
+#include <atomic>
 
 #include "bsp/board.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
-#include "hardware/gpio.h"
+#include "hardware/structs/scb.h"
 #include "hardware/uart.h"
+#include "pico/time.h"
+#if BRIDGE_MULTICORE
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#endif
+#include "pio_uart.h"
+#include "uart_io.h"
+#include "bridge.h"
+#include "config_store.h"
+#include "hid_engine.h"
+#include "ingest.h"
+#include "keymap.h"
+#include "log.h"
+#include "trace.h"
+#include "unicode.h"
 
-// UART configuration
+// UART configuration. Baud rate, pins and flow control below are the
+// defaults, a config committed to flash over the UART replaces them.
+// A baud rate of 0 detects the rate from the first characters received,
+// diagnostics are sent at BAUD_RATE_TX until it is known.
 #define UART_ID uart0
 #define BAUD_RATE 9600
+#define BAUD_RATE_TX 9600
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
 
-// HID keycodes for keypad and special keys
-#define HID_KEYPAD_0        0x62
-#define HID_KEYPAD_1        0x59
-#define HID_KEYPAD_2        0x5A
-#define HID_KEYPAD_3        0x5B
-#define HID_KEYPAD_4        0x5C
-#define HID_KEYPAD_5        0x5D
-#define HID_KEYPAD_6        0x5E
-#define HID_KEYPAD_7        0x5F
-#define HID_KEYPAD_8        0x60
-#define HID_KEYPAD_9        0x61
-#define HID_KEYPAD_ASTERISK 0x55
-#define HID_KEYPAD_ENTER    0x58
-#define HID_KEYPAD_SLASH    0x54
-#define HID_KEYPAD_MINUS    0x56
-#define HID_KEYPAD_PLUS     0x57
-#define HID_KEY_BACKSPACE   0x2A
-
-// Sequence engine states
-typedef enum {
-    SEQ_IDLE,
-    SEQ_PRESS,
-    SEQ_RELEASE
-} seq_state_t;
-
-// Sequence structure for HID key(s)
-typedef struct {
-    const uint8_t* seq;
-    size_t len;
-} keyseq_t;
-
-// Single-key sequence buffer
-static uint8_t single_seq[2] = {0, 0};
-static keyseq_t sequences[1] = {
-    { single_seq, 1 }
-};
-
-static int current_sequence = 0;
-static size_t key_idx = 0;
-static seq_state_t seq_state = SEQ_IDLE;
-static absolute_time_t seq_timer = {0};
-
-// Handles sending HID key press/release using the sequence engine
-void send_sequence_task(void) {
-    if (!tud_hid_ready()) return;
-
-    absolute_time_t now = get_absolute_time();
-
-    switch (seq_state) {
-        case SEQ_IDLE:
-            // Do nothing, wait for UART to trigger a sequence
-            break;
-        case SEQ_PRESS:
-            // Send HID key press
-            if (key_idx < sequences[current_sequence].len) {
-                uint8_t key = sequences[current_sequence].seq[key_idx];
-                uint8_t keycodes[6] = {0};
-                keycodes[0] = key;
-                tud_hid_keyboard_report(0, 0, keycodes);
-                seq_state = SEQ_RELEASE;
-                seq_timer = now;
-            } else {
-                seq_state = SEQ_IDLE;
-            }
-            break;
-        case SEQ_RELEASE:
-            // Release HID key after 100ms
-            if (absolute_time_diff_us(seq_timer, now) > 100000) { // 100ms
-                tud_hid_keyboard_report(0, 0, NULL);
-                key_idx++;
-                seq_state = SEQ_PRESS;
-                seq_timer = now;
-            }
-            break;
+// Flow control towards the sender. UART_FLOW_RTS_CTS needs the sender's CTS
+// on UART_RTS_PIN and its RTS on UART_CTS_PIN. UART_FLOW_XON_XOFF works
+// with TX/RX only, but only for text input, the framed mode carries binary data.
+#ifndef UART_FLOW
+#define UART_FLOW UART_FLOW_NONE
+#endif
+#define UART_CTS_PIN 2
+#define UART_RTS_PIN 3
+
+// Extra receive-only inputs on PIO state machines, CONFIG_PIN_NONE when unused.
+// INPUT_BAUD 0 detects the rate of each sender.
+#define INPUT1_RX_PIN CONFIG_PIN_NONE
+#define INPUT2_RX_PIN CONFIG_PIN_NONE
+#define INPUT_BAUD 0
+
+static_assert(UART_FLOW_XON_XOFF == 2, "config_store.cpp checks flow values against this");
+
+// With BRIDGE_MULTICORE core1 owns the UART: receive, parsing, keymap
+// lookup and diagnostics output. It hands key events to core0 through the
+// lock-free key queue, and core0 only services USB and the HID engine.
+#ifndef BRIDGE_MULTICORE
+#define BRIDGE_MULTICORE 0
+#endif
+
+// Longest sleep of an idle loop, a safety net in case a wakeup event is missed
+#define IDLE_WAKE_US 10000
+
+// Lets any interrupt that becomes pending wake __wfe(), also one that fires
+// between the idle check and the wait, so the loops can sleep without a race
+static void idle_init(void) {
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+}
+
+static void idle_wait(void) {
+    best_effort_wfe_or_timeout(make_timeout_time_us(IDLE_WAKE_US));
+}
+
+// Build time settings, used until a config is committed to flash
+static void config_setup(void) {
+    static const hid_timing_t timing = HID_TIMING_DEFAULT;
+    bridge_config_t defaults = {};
+    defaults.baud_rate = BAUD_RATE;
+    defaults.tx_pin = UART_TX_PIN;
+    defaults.rx_pin = UART_RX_PIN;
+    defaults.flow = UART_FLOW;
+    defaults.cts_pin = UART_CTS_PIN;
+    defaults.rts_pin = UART_RTS_PIN;
+    defaults.layout = KEYMAP_DEFAULT_LAYOUT;
+    defaults.pacing = timing.pacing;
+    defaults.hold_us = timing.hold_us;
+    defaults.gap_us = timing.gap_us;
+    defaults.pack_limit = HID_PACK_MAX;
+    defaults.log_level = LOG_LEVEL_DEFAULT;
+    defaults.utf8 = INGEST_DEFAULT_UTF8;
+    defaults.unicode_method = UNICODE_DEFAULT_METHOD;
+    defaults.trace = TRACE_DEFAULT_ENABLED;
+    defaults.input_pin[0] = INPUT1_RX_PIN;
+    defaults.input_pin[1] = INPUT2_RX_PIN;
+    for (uint32_t &baud : defaults.input_baud) baud = INPUT_BAUD;
+    for (uint8_t &weight : defaults.weight) weight = 1;
+    config_store_init(&defaults);
+}
+
+// Rate found by the detector, logged by the UART loop. The interrupt must
+// not log itself, the log ring of a core has the loop as its only producer.
+static std::atomic<uint32_t> detected_baud{0};
+
+// Called from the PIO interrupt once the rate of the bridge UART is known
+static void on_uart_rate(uint32_t baud) {
+    uart_io_set_baud(baud);
+    uart_io_set_rx_enabled(true);
+    detected_baud.store(baud, std::memory_order_release);
+}
+
+static void log_uart_rate(void) {
+    uint32_t baud = detected_baud.exchange(0, std::memory_order_acquire);
+    if (baud) LOG_INFO("UART rate detected, %u baud", baud);
+}
+
+// UART instance a GPIO can be routed to: pins 0-3 go to UART0, 4-11 to
+// UART1 and so on in blocks of eight. TX is the first pin of a group of
+// four, RX the second, CTS the third and RTS the fourth.
+static bool uart_pin_ok(uint pin, uint function) {
+    return uart_get_index(UART_ID) == (((pin + 4) >> 3) & 1) && pin % 4 == function;
+}
+
+// Initialize UART at 8N1, received bytes are collected by the UART IRQ
+// of the core that calls this
+static void uart_setup(void) {
+    bridge_config_t config;
+    config_get(&config);
+    // A config with pins this UART cannot use would leave no way to fix it
+    if (!uart_pin_ok(config.tx_pin, 0) || !uart_pin_ok(config.rx_pin, 1)) {
+        LOG_WARN("Configured UART pins %u/%u unusable, using the defaults", config.tx_pin, config.rx_pin);
+        config.tx_pin = UART_TX_PIN;
+        config.rx_pin = UART_RX_PIN;
+    }
+    if (config.flow == UART_FLOW_RTS_CTS && !uart_pin_ok(config.cts_pin, 2)) {
+        LOG_WARN("Configured CTS pin %u unusable, flow control off", config.cts_pin);
+        config.flow = UART_FLOW_NONE;
+    }
+
+    uart_io_init(UART_ID, config.baud_rate ? config.baud_rate : BAUD_RATE_TX, config.tx_pin, config.rx_pin);
+    uart_io_set_flow((uart_flow_t)config.flow, config.rts_pin, config.cts_pin);
+    if (config.baud_rate == 0) {
+        // Drop what arrives at the wrong rate until the detector has locked
+        uart_io_set_rx_enabled(false);
+        pio_uart_detect(config.rx_pin, on_uart_rate);
+    }
+    LOG_INFO("UART HID bridge ready, %u baud, %u core(s)", config.baud_rate, BRIDGE_MULTICORE ? 2 : 1);
+
+    for (uint8_t i = 0; i < PIO_UART_CHANNELS; i++) {
+        if (config.input_pin[i] == CONFIG_PIN_NONE) continue;
+        pio_uart_init(i, config.input_pin[i], config.input_baud[i]);
+        LOG_INFO("Input %u on GPIO %u, %u baud", i + 1, config.input_pin[i], config.input_baud[i]);
     }
 }
 
-// Starts a new single-key HID sequence (called from UART handler)
-void start_single_key_sequence(uint8_t keycode) {
-    single_seq[0] = keycode;
-    single_seq[1] = 0; // End marker (not used)
-    sequences[0].seq = single_seq;
-    sequences[0].len = 1;
-    current_sequence = 0;
-    key_idx = 0;
-    seq_state = SEQ_PRESS;
-    seq_timer = get_absolute_time();
+#if BRIDGE_MULTICORE
+static void core1_main(void) {
+    idle_init();
+    uart_setup();
+    while (1) {
+        log_uart_rate();
+        bridge_uart_task();
+        if (bridge_uart_idle()) idle_wait();
+    }
 }
+#endif
 
 int main(void)
 {
     board_init();
     tusb_init();
+    idle_init();
 
-    // Initialize UART at 9600 8N1
-    uart_init(UART_ID, BAUD_RATE);
-    gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
-    gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+    // Only reads flash, before the UART is set up with the loaded settings
+    config_setup();
+    bridge_init();
 
-    seq_state = SEQ_IDLE;
+#if BRIDGE_MULTICORE
+    // Core1 writes the macro store, and core0 has to be parked while it does
+    flash_safe_execute_core_init();
+    multicore_launch_core1(core1_main);
+#else
+    uart_setup();
+#endif
 
     while (1)
     {
         tud_task();
 
-        // UART receive and HID trigger
-        if (uart_is_readable(UART_ID)) {
-            uint8_t ch = uart_getc(UART_ID);
-            uart_putc(UART_ID, ch); // Echo received character
-
-            // Map UART character to HID keycode
-            uint8_t keycode = 0;
-            switch (ch) {
-                case '0': keycode = HID_KEYPAD_0; break;
-                case '1': keycode = HID_KEYPAD_1; break;
-                case '2': keycode = HID_KEYPAD_2; break;
-                case '3': keycode = HID_KEYPAD_3; break;
-                case '4': keycode = HID_KEYPAD_4; break;
-                case '5': keycode = HID_KEYPAD_5; break;
-                case '6': keycode = HID_KEYPAD_6; break;
-                case '7': keycode = HID_KEYPAD_7; break;
-                case '8': keycode = HID_KEYPAD_8; break;
-                case '9': keycode = HID_KEYPAD_9; break;
-                case '*': keycode = HID_KEYPAD_ASTERISK; break;
-                case '/': keycode = HID_KEYPAD_SLASH; break;
-                case '-': keycode = HID_KEYPAD_MINUS; break;
-                case '+': keycode = HID_KEYPAD_PLUS; break;
-                case '\b': keycode = HID_KEY_BACKSPACE; break;
-                case '\r':
-                case '\n': keycode = HID_KEYPAD_ENTER; break;
-                default: break;
-            }
-
-            // Print debug message to UART
-            char msg[64];
-            snprintf(msg, sizeof(msg),
-                "Received character 0x%02X ('%c') from UART, send HID %s\r\n",
-                ch, (ch >= 32 && ch <= 126) ? ch : '.', keycode ? "YES" : "NO");
-            for (char *p = msg; *p; ++p) uart_putc(UART_ID, *p);
-
-            // If mapped, start HID sequence
-            if (keycode) {
-                start_single_key_sequence(keycode);
-            }
-        }
+#if !BRIDGE_MULTICORE
+        log_uart_rate();
+        bridge_uart_task();
+#endif
 
         // Run the HID sequence engine
-        send_sequence_task();
+        bridge_hid_task();
+
+        // Sleep until the next USB or UART interrupt when there is nothing to do
+        bool idle = !tud_task_event_ready() && bridge_hid_idle();
+#if !BRIDGE_MULTICORE
+        idle = idle && bridge_uart_idle();
+#endif
+        if (idle) idle_wait();
     }
     return 0;
 }
 
+//--------------------------------------------------------------------+
+// Device callbacks
+//--------------------------------------------------------------------+
+
+// Invoked when the bus is suspended. Input is still queued, and
+// bridge_hid_task() wakes the host when there is some, if it allows that.
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+    LOG_INFO("USB suspended, remote wakeup %u", remote_wakeup_en);
+}
+
+void tud_resume_cb(void)
+{
+    LOG_INFO("USB resumed");
+}
+
 //--------------------------------------------------------------------+
 // USB HID callbacks
 //--------------------------------------------------------------------+
 
+// Invoked when a report has been sent to the host, drives completion pacing
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint8_t len)
 {
-    (void)instance;
+    (void)report;
     (void)len;
+    bridge_report_complete(instance);
 }
 
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
@@ -213,9 +266,9 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize)
 {
-    (void)instance;
-    (void)report_type;
     (void)report_id;
-    (void)buffer;
-    (void)bufsize;
+    // The keyboard's only output report is the lock LED state
+    if (report_type == HID_REPORT_TYPE_OUTPUT && bufsize >= 1) {
+        bridge_set_leds(instance, buffer[0]);
+    }
 }
\ No newline at end of file
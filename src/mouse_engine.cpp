@@ -0,0 +1,75 @@
+#include "mouse_engine.h"
+
+#include "hal.h"
+#include "hid_common.h"
+#include "log.h"
+#include "ring_buffer.h"
+#include "usb_descriptors.h"
+
+static ring_buffer<mouse_event_t, MOUSE_QUEUE_SIZE> queue;
+
+// Event being sent, with the movement still left to report
+static mouse_event_t current = {0, 0, 0, 0, 0};
+static bool has_current = false;
+static bool report_in_flight = false;
+static uint64_t sent_at = 0;
+
+static int8_t clamp_step(int16_t value) {
+    if (value > 127) return 127;
+    if (value < -127) return -127;
+    return (int8_t)value;
+}
+
+void mouse_engine_init(void) {
+    has_current = false;
+    report_in_flight = false;
+}
+
+bool mouse_engine_push(const mouse_event_t *ev) {
+    return queue.push(*ev);
+}
+
+size_t mouse_engine_free(void) {
+    return queue.free();
+}
+
+void mouse_engine_task(void) {
+    if (!hal_hid_ready(HID_INSTANCE_MOUSE)) return;
+    if (report_in_flight) {
+        // The endpoint is free but the completion never came, as after a bus reset
+        if (hal_time_us() - sent_at < HID_REPORT_TIMEOUT_US) return;
+        LOG_WARN("Mouse report not read within %u ms", (unsigned)(HID_REPORT_TIMEOUT_US / 1000));
+        report_in_flight = false;
+    }
+    if (!has_current) {
+        if (!queue.pop(current)) return;
+        has_current = true;
+    }
+
+    // Boot mouse compatible report: buttons, x, y, wheel, pan
+    int8_t x = clamp_step(current.dx);
+    int8_t y = clamp_step(current.dy);
+    uint8_t report[5] = { current.buttons, (uint8_t)x, (uint8_t)y, (uint8_t)current.wheel, (uint8_t)current.pan };
+    if (!hal_hid_report(HID_INSTANCE_MOUSE, 0, report, sizeof(report))) return;
+    report_in_flight = true;
+    sent_at = hal_time_us();
+
+    current.dx -= x;
+    current.dy -= y;
+    current.wheel = 0;
+    current.pan = 0;
+    if (current.dx == 0 && current.dy == 0) has_current = false;
+}
+
+void mouse_engine_report_complete(void) {
+    report_in_flight = false;
+    mouse_engine_task();
+}
+
+bool mouse_engine_idle(void) {
+    return !has_current && queue.empty();
+}
+
+bool mouse_engine_waiting(void) {
+    return report_in_flight || mouse_engine_idle();
+}
@@ -0,0 +1,48 @@
+#ifndef MOUSE_ENGINE_H_
+#define MOUSE_ENGINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Relative mouse on its own HID interface, queued separately from the keyboard
+
+// Size of the event queue, must be a power of two
+#define MOUSE_QUEUE_SIZE 32
+
+// Button bits
+enum : uint8_t {
+    MOUSE_BUTTON_LEFT   = 0x01,
+    MOUSE_BUTTON_RIGHT  = 0x02,
+    MOUSE_BUTTON_MIDDLE = 0x04
+};
+
+// Button state and movement. Moves beyond one report's -127..127 range
+// are split over several reports.
+typedef struct {
+    uint8_t buttons;
+    int16_t dx;
+    int16_t dy;
+    int8_t wheel;
+    int8_t pan;
+} mouse_event_t;
+
+void mouse_engine_init(void);
+
+// Queues an event, false if the queue is full
+bool mouse_engine_push(const mouse_event_t *ev);
+size_t mouse_engine_free(void);
+
+// Sends the next report when the endpoint is free, a report not read within
+// HID_REPORT_TIMEOUT_US counts as read
+void mouse_engine_task(void);
+
+// Called when the host has read a mouse report
+void mouse_engine_report_complete(void);
+
+bool mouse_engine_idle(void);
+
+// True when nothing can be sent before a report completes or new events arrive
+bool mouse_engine_waiting(void);
+
+#endif /* MOUSE_ENGINE_H_ */
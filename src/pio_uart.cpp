@@ -0,0 +1,193 @@
+#include "pio_uart.h"
+
+#include "autobaud.h"
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "pio_uart.pio.h"
+#include "ring_buffer.h"
+
+#define UART_PIO pio0
+#define UART_PIO_IRQ PIO0_IRQ_0
+
+// The rate detector of the hardware UART follows the PIO channels
+#define DETECTOR PIO_UART_CHANNELS
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t ch;
+} rx_entry_t;
+
+typedef struct {
+    bool active;
+    uint sm;
+    uint pin;
+    uint32_t baud;          // 0 while detecting
+    bool auto_baud;
+    autobaud_t autobaud;
+    void (*on_rate)(uint32_t baud);  // Set for the detector, which has no receiver
+    uint32_t errors_in_row;
+    volatile uint32_t framing_errors;
+    volatile uint32_t rx_overruns;
+} channel_t;
+
+static channel_t channels[PIO_UART_CHANNELS + 1];
+static ring_buffer<rx_entry_t, PIO_UART_RX_BUF_SIZE> rx_rings[PIO_UART_CHANNELS];
+static int rx_offset = -1;
+static int pulse_offset = -1;
+static bool irq_ready = false;
+
+// Both run with interrupts masked, from setup or the PIO interrupt
+static void start_detect(channel_t *ch) {
+    pio_sm_config c = pulse_measure_program_get_default_config(pulse_offset);
+    sm_config_set_in_pins(&c, ch->pin);
+    sm_config_set_jmp_pin(&c, ch->pin);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    pio_sm_set_enabled(UART_PIO, ch->sm, false);
+    pio_sm_init(UART_PIO, ch->sm, pulse_offset, &c);
+    pio_sm_set_enabled(UART_PIO, ch->sm, true);
+    pio_interrupt_clear(UART_PIO, ch->sm);
+    // Each count of the measuring loop takes two cycles
+    autobaud_reset(&ch->autobaud, clock_get_hz(clk_sys) / 2);
+    ch->baud = 0;
+}
+
+static void start_rx(channel_t *ch, uint32_t baud) {
+    pio_sm_config c = uart_rx_program_get_default_config(rx_offset);
+    sm_config_set_in_pins(&c, ch->pin);
+    sm_config_set_jmp_pin(&c, ch->pin);
+    // Bits come in LSB first, the byte ends up in the top of the ISR
+    sm_config_set_in_shift(&c, true, false, 32);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / (8.0f * baud));
+    pio_sm_set_enabled(UART_PIO, ch->sm, false);
+    pio_sm_init(UART_PIO, ch->sm, rx_offset, &c);
+    pio_interrupt_clear(UART_PIO, ch->sm);
+    pio_sm_set_enabled(UART_PIO, ch->sm, true);
+    ch->baud = baud;
+    ch->errors_in_row = 0;
+}
+
+static void detect_pulses(channel_t *ch) {
+    while (!pio_sm_is_rx_fifo_empty(UART_PIO, ch->sm)) {
+        uint32_t baud = autobaud_pulse(&ch->autobaud, pio_sm_get(UART_PIO, ch->sm) + 1);
+        if (!baud) continue;
+        if (ch->on_rate) {
+            // The hardware UART takes over, the state machine is done
+            pio_sm_set_enabled(UART_PIO, ch->sm, false);
+            pio_sm_unclaim(UART_PIO, ch->sm);
+            ch->active = false;
+            ch->baud = baud;
+            ch->on_rate(baud);
+        } else {
+            start_rx(ch, baud);
+        }
+        return;
+    }
+}
+
+static void receive(channel_t *ch, ring_buffer<rx_entry_t, PIO_UART_RX_BUF_SIZE> &ring, uint32_t now) {
+    while (!pio_sm_is_rx_fifo_empty(UART_PIO, ch->sm)) {
+        rx_entry_t entry = { now, (uint8_t)(pio_sm_get(UART_PIO, ch->sm) >> 24) };
+        if (!ring.push(entry)) ch->rx_overruns = ch->rx_overruns + 1;
+        ch->errors_in_row = 0;
+    }
+    if (pio_interrupt_get(UART_PIO, ch->sm)) {
+        pio_interrupt_clear(UART_PIO, ch->sm);
+        ch->framing_errors = ch->framing_errors + 1;
+        if (ch->auto_baud && ++ch->errors_in_row >= PIO_UART_RELOCK_ERRORS) start_detect(ch);
+    }
+}
+
+static void on_pio_irq(void) {
+    uint32_t now = time_us_32();
+    for (int i = 0; i <= PIO_UART_CHANNELS; i++) {
+        channel_t *ch = &channels[i];
+        if (!ch->active) continue;
+        if (ch->baud == 0) {
+            detect_pulses(ch);
+        } else if (i < PIO_UART_CHANNELS) {
+            receive(ch, rx_rings[i], now);
+        }
+    }
+}
+
+static bool channel_start(channel_t *ch, uint pin) {
+    if (!irq_ready) {
+        rx_offset = pio_add_program(UART_PIO, &uart_rx_program);
+        pulse_offset = pio_add_program(UART_PIO, &pulse_measure_program);
+        irq_set_exclusive_handler(UART_PIO_IRQ, on_pio_irq);
+        irq_set_enabled(UART_PIO_IRQ, true);
+        irq_ready = true;
+    }
+    int sm = pio_claim_unused_sm(UART_PIO, false);
+    if (sm < 0) return false;
+    ch->active = true;
+    ch->sm = sm;
+    ch->pin = pin;
+    pio_sm_set_consecutive_pindirs(UART_PIO, sm, pin, 1, false);
+    // Bytes and pulse lengths, and the framing error flag of the receiver
+    pio_set_irq0_source_enabled(UART_PIO, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), true);
+    pio_set_irq0_source_enabled(UART_PIO, (pio_interrupt_source)(pis_interrupt0 + sm), true);
+    return true;
+}
+
+void pio_uart_init(uint8_t channel, uint pin, uint32_t baud) {
+    if (channel >= PIO_UART_CHANNELS) return;
+    uint32_t irq_state = save_and_disable_interrupts();
+    channel_t *ch = &channels[channel];
+    gpio_init(pin);
+    gpio_pull_up(pin);
+    if (channel_start(ch, pin)) {
+        ch->auto_baud = (baud == 0);
+        ch->on_rate = NULL;
+        if (ch->auto_baud) {
+            start_detect(ch);
+        } else {
+            start_rx(ch, baud);
+        }
+    }
+    restore_interrupts(irq_state);
+}
+
+void pio_uart_detect(uint pin, void (*on_rate)(uint32_t baud)) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    channel_t *ch = &channels[DETECTOR];
+    if (channel_start(ch, pin)) {
+        ch->auto_baud = true;
+        ch->on_rate = on_rate;
+        start_detect(ch);
+    }
+    restore_interrupts(irq_state);
+}
+
+size_t pio_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max) {
+    if (channel >= PIO_UART_CHANNELS) return 0;
+    size_t n = 0;
+    rx_entry_t entry;
+    while (n < max && rx_rings[channel].pop(entry)) {
+        dst[n] = entry.ch;
+        if (rx_time_us) rx_time_us[n] = entry.time_us;
+        n++;
+    }
+    return n;
+}
+
+size_t pio_uart_rx_available(uint8_t channel) {
+    return channel < PIO_UART_CHANNELS ? rx_rings[channel].size() : 0;
+}
+
+uint32_t pio_uart_baud(uint8_t channel) {
+    return (channel < PIO_UART_CHANNELS && channels[channel].active) ? channels[channel].baud : 0;
+}
+
+uint32_t pio_uart_framing_errors(uint8_t channel) {
+    return channel < PIO_UART_CHANNELS ? channels[channel].framing_errors : 0;
+}
+
+uint32_t pio_uart_rx_overruns(uint8_t channel) {
+    return channel < PIO_UART_CHANNELS ? channels[channel].rx_overruns : 0;
+}
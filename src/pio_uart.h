@@ -0,0 +1,40 @@
+#ifndef PIO_UART_H_
+#define PIO_UART_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico/types.h"
+
+// Receive-only UARTs on the PIO state machines, as extra input channels
+// next to the hardware UART. Each channel has its own interrupt-fed ring of
+// timestamped bytes, like uart_io. A channel started without a baud rate
+// measures the low pulses on its pin until it has found the rate, and
+// measures again when framing errors show that the sender has changed it.
+
+#define PIO_UART_CHANNELS 2
+
+// Size of each channel's receive ring, must be a power of two
+#define PIO_UART_RX_BUF_SIZE 1024
+
+// Framing errors in a row after which a detected rate is measured again
+#define PIO_UART_RELOCK_ERRORS 8
+
+// Starts receiving 8N1 on pin, baud 0 detects the rate
+void pio_uart_init(uint8_t channel, uint pin, uint32_t baud);
+
+// Measures the baud rate on the RX pin of the hardware UART with a spare
+// state machine and calls on_rate from the PIO interrupt once it is known.
+// The pin keeps its UART function.
+void pio_uart_detect(uint pin, void (*on_rate)(uint32_t baud));
+
+size_t pio_uart_read(uint8_t channel, uint8_t *dst, uint32_t *rx_time_us, size_t max);
+size_t pio_uart_rx_available(uint8_t channel);
+
+// Rate in use, 0 while it is being detected or when the channel is not started
+uint32_t pio_uart_baud(uint8_t channel);
+
+uint32_t pio_uart_framing_errors(uint8_t channel);
+uint32_t pio_uart_rx_overruns(uint8_t channel);
+
+#endif /* PIO_UART_H_ */
@@ -0,0 +1,560 @@
+#include "protocol.h"
+
+#include <string.h>
+
+#include "cobs.h"
+#include "config_store.h"
+#include "consumer_engine.h"
+#include "crc16.h"
+#include "hal.h"
+#include "ingest.h"
+#include "key_queue.h"
+#include "latency.h"
+#include "hid_engine.h"
+#include "log.h"
+#include "macro_store.h"
+#include "mouse_engine.h"
+#include "trace.h"
+
+#define PROTO_RX_MAX COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX)
+
+// Smallest valid frame is a seq byte and the CRC
+#define PROTO_FRAME_MIN 3
+
+// Payload bytes of one CMD_MOUSE event
+#define MOUSE_RECORD_LEN 7
+
+// Payload bytes of one CONFIG_OP_SET entry, key and u32 value
+#define CONFIG_SET_LEN 5
+
+// Trace entries per QUERY_TRACE reply, after the seq, status, lost count,
+// entry count and CRC
+#define TRACE_ENTRY_LEN 8
+#define TRACE_READ_MAX ((PROTO_FRAME_MAX - 2 - 5 - 2) / TRACE_ENTRY_LEN)
+
+// Queue entries a frame needs, it is refused unless all of them fit.
+// The check pass also follows the macro upload through the frame.
+typedef struct {
+    size_t keys;
+    size_t consumer;
+    size_t mouse;
+    size_t macro_runs;
+    bool staging;           // An upload is open
+    uint16_t staging_id;
+    uint16_t staging_len;
+    uint16_t staged;
+    int32_t committed_id;   // Macro committed earlier in this frame, -1 if none
+} queue_demand_t;
+
+static uint8_t rx_buf[PROTO_RX_MAX];
+static size_t rx_len = 0;
+static bool rx_overflow = false;
+
+// Arrival of the first byte of the frame being received
+static uint32_t frame_rx_time = 0;
+
+static uint8_t expected_seq = 0;
+static bool seq_synced = false;
+
+// Frames executed since the sequence was set, up to PROTO_DUP_WINDOW
+static uint8_t executed = 0;
+
+// Latest CMD_SCHEDULE time, the base of relative times
+static uint32_t schedule_base = 0;
+static bool schedule_valid = false;
+
+static uint8_t reply[PROTO_FRAME_MAX];
+static size_t reply_len = 0;
+
+static protocol_stats_t stats = {0, 0, 0, 0, 0, 0};
+
+void protocol_reset(void) {
+    rx_len = 0;
+    rx_overflow = false;
+    seq_synced = false;
+    executed = 0;
+}
+
+static void reply_data(const void *data, size_t len) {
+    if (reply_len + len > sizeof(reply) - 2) return;
+    memcpy(&reply[reply_len], data, len);
+    reply_len += len;
+}
+
+// Sends the reply frame as a whole or not at all
+static void send_reply(uint8_t seq, uint8_t status) {
+    reply[0] = seq;
+    reply[1] = status;
+    uint16_t crc = crc16(reply, reply_len);
+    reply[reply_len++] = crc & 0xFF;
+    reply[reply_len++] = crc >> 8;
+
+    uint8_t out[COBS_MAX_ENCODED_LEN(PROTO_FRAME_MAX) + 2];
+    out[0] = 0;
+    size_t len = 1 + cobs_encode(reply, reply_len, &out[1]);
+    out[len++] = 0;
+
+    if (hal_uart_tx_free() < len) {
+        stats.replies_dropped++;
+        return;
+    }
+    hal_uart_write(out, len);
+    if (status == PROTO_ACK) stats.acks++;
+    else stats.nacks++;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void reply_u32(uint32_t value) {
+    uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    reply_data(bytes, sizeof(bytes));
+}
+
+static void query_latency(uint8_t arg) {
+    uint8_t stage = arg & 0x7F;
+    if (stage >= LAT_STAGE_COUNT) return;
+
+    latency_hist_t hist;
+    latency_get((latency_stage_t)stage, &hist);
+    reply_data(&stage, 1);
+    reply_u32(hist.count);
+    reply_u32(hist.min_us);
+    reply_u32(hist.max_us);
+    reply_u32(hist.count ? (uint32_t)(hist.sum_us / hist.count) : 0);
+    reply_u32(latency_percentile(&hist, 50));
+    reply_u32(latency_percentile(&hist, 99));
+    for (uint8_t b = 0; b < LATENCY_BUCKETS; b++) reply_u32(hist.buckets[b]);
+
+    if (arg & 0x80) latency_reset();
+}
+
+static void query_health(void) {
+    for (uint8_t channel = 0; channel < HAL_UART_CHANNELS; channel++) {
+        hal_uart_errors_t errors;
+        hal_uart_get_errors(channel, &errors);
+        reply_u32(errors.overruns);
+        reply_u32(errors.framing);
+        reply_u32(errors.parity);
+        reply_u32(errors.breaks);
+    }
+
+    key_queue_stats_t queue;
+    key_queue_get_stats(&queue);
+    reply_u32(queue.dropped);
+    reply_u32(queue.high_water);
+
+    hid_engine_stats_t hid;
+    hid_engine_get_stats(&hid);
+    reply_u32(hid.busy_stalls);
+    reply_u32(hid.retries);
+    reply_u32(hid.lost_reports);
+    reply_u32(hid.hold_releases);
+
+    reply_u32(stats.crc_errors);
+    reply_u32(stats.replies_dropped);
+}
+
+static void query_clock(void) {
+    uint64_t now = hal_time_us();
+    uint64_t frame = hal_usb_frame_time();
+    reply_u32((uint32_t)now);
+    reply_u32((uint32_t)(now >> 32));
+    reply_u32((uint32_t)frame);
+    reply_u32((uint32_t)(frame >> 32));
+}
+
+static void query_trace(uint8_t arg) {
+    if (arg == 1) {
+        trace_clear();
+        return;
+    }
+    trace_entry_t entries[TRACE_READ_MAX];
+    uint32_t lost;
+    uint8_t count = trace_read(entries, TRACE_READ_MAX, &lost);
+    reply_u32(lost);
+    reply_data(&count, 1);
+    for (uint8_t i = 0; i < count; i++) {
+        const trace_entry_t &e = entries[i];
+        reply_u32(e.time_us);
+        uint8_t rest[4] = { e.type, e.arg, e.data[0], e.data[1] };
+        reply_data(rest, sizeof(rest));
+    }
+}
+
+// Checks a CMD_MACRO record against the upload state left by the records before it
+static uint8_t check_macro(const uint8_t *payload, uint8_t len, queue_demand_t *demand) {
+    if (len < 1) return PROTO_NACK_MALFORMED;
+    switch (payload[0]) {
+        case MACRO_OP_BEGIN: {
+            if (len != 5) return PROTO_NACK_MALFORMED;
+            uint16_t id = get_u16(&payload[1]);
+            uint16_t size = get_u16(&payload[3]);
+            if (id > MACRO_ID_MAX || size == 0 || size % MACRO_STEP_LEN) return PROTO_NACK_MALFORMED;
+            if (size > MACRO_MAX_LEN) return PROTO_NACK_STORE;
+            demand->staging = true;
+            demand->staging_id = id;
+            demand->staging_len = size;
+            demand->staged = 0;
+            return PROTO_ACK;
+        }
+        case MACRO_OP_DATA:
+            if (!demand->staging || demand->staged + len - 1 > demand->staging_len) return PROTO_NACK_MALFORMED;
+            demand->staged += len - 1;
+            return PROTO_ACK;
+        case MACRO_OP_COMMIT:
+            if (len != 1 || !demand->staging || demand->staged != demand->staging_len) return PROTO_NACK_MALFORMED;
+            if (!hid_engine_idle() || demand->macro_runs) return PROTO_NACK_BUSY;
+            if (!macro_store_has_room(demand->staging_id, demand->staging_len)) return PROTO_NACK_STORE;
+            demand->committed_id = demand->staging_id;
+            demand->staging = false;
+            return PROTO_ACK;
+        case MACRO_OP_DELETE:
+            if (len != 3) return PROTO_NACK_MALFORMED;
+            if (!hid_engine_idle() || demand->macro_runs) return PROTO_NACK_BUSY;
+            return PROTO_ACK;
+        default:
+            return PROTO_NACK_UNKNOWN;
+    }
+}
+
+// Checks a CMD_CONFIG record, all values of a set must be valid
+static uint8_t check_config(const uint8_t *payload, uint8_t len) {
+    if (len < 1) return PROTO_NACK_MALFORMED;
+    switch (payload[0]) {
+        case CONFIG_OP_GET:
+            for (uint8_t i = 1; i < len; i++) {
+                uint32_t value;
+                if (!config_get_value(payload[i], &value)) return PROTO_NACK_RANGE;
+            }
+            return PROTO_ACK;
+        case CONFIG_OP_SET:
+            if ((len - 1) % CONFIG_SET_LEN) return PROTO_NACK_MALFORMED;
+            for (uint8_t i = 1; i < len; i += CONFIG_SET_LEN) {
+                if (!config_check(payload[i], get_u32(&payload[i + 1]))) return PROTO_NACK_RANGE;
+            }
+            return PROTO_ACK;
+        case CONFIG_OP_COMMIT:
+        case CONFIG_OP_DEFAULTS:
+            return len == 1 ? PROTO_ACK : PROTO_NACK_MALFORMED;
+        default:
+            return PROTO_NACK_UNKNOWN;
+    }
+}
+
+// Checks one record and counts the key events it will queue,
+// returns a NACK status or PROTO_ACK
+static uint8_t check_record(uint8_t cmd, const uint8_t *payload, uint8_t len, queue_demand_t *demand) {
+    switch (cmd) {
+        case CMD_KEY_TAP:
+            // A tap needs a key, usage 0 would go into the report as a key.
+            // Down and up may be modifier only, [modifier 0].
+            for (uint8_t i = 1; i < len; i += 2) {
+                if (payload[i] == 0) return PROTO_NACK_MALFORMED;
+            }
+            // fall through
+        case CMD_KEY_DOWN:
+        case CMD_KEY_UP:
+            if (len % 2) return PROTO_NACK_MALFORMED;
+            demand->keys += len / 2;
+            return PROTO_ACK;
+        case CMD_RAW_REPORT:
+            if (len % 8) return PROTO_NACK_MALFORMED;
+            demand->keys += len / 8;
+            return PROTO_ACK;
+        case CMD_DELAY:
+            if (len != 4) return PROTO_NACK_MALFORMED;
+            demand->keys += 1;
+            return PROTO_ACK;
+        case CMD_SCHEDULE:
+            if (len != 5 || (payload[0] & ~(SCHEDULE_ABSOLUTE | SCHEDULE_FRAME))) return PROTO_NACK_MALFORMED;
+            demand->keys += 1;
+            return PROTO_ACK;
+        case CMD_TEXT:
+            demand->keys += ingest_text_events(payload, len);
+            return PROTO_ACK;
+        case CMD_CONSUMER:
+            if (len % 2) return PROTO_NACK_MALFORMED;
+            demand->consumer += len / 2;
+            return PROTO_ACK;
+        case CMD_MOUSE:
+            if (len % MOUSE_RECORD_LEN) return PROTO_NACK_MALFORMED;
+            demand->mouse += len / MOUSE_RECORD_LEN;
+            return PROTO_ACK;
+        case CMD_MACRO_RUN:
+            if (len % 2) return PROTO_NACK_MALFORMED;
+            for (uint8_t i = 0; i < len; i += 2) {
+                uint16_t id = get_u16(&payload[i]);
+                if (!macro_store_exists(id) && id != demand->committed_id) return PROTO_NACK_NOT_FOUND;
+            }
+            demand->keys += len / 2;
+            demand->macro_runs += len / 2;
+            return PROTO_ACK;
+        case CMD_MACRO:
+            return check_macro(payload, len, demand);
+        case CMD_CONFIG:
+            return check_config(payload, len);
+        case CMD_SET_MODE:
+            return (len == 1 && payload[0] <= INGEST_FRAMED) ? PROTO_ACK : PROTO_NACK_MALFORMED;
+        case CMD_PING:
+            return len == 0 ? PROTO_ACK : PROTO_NACK_MALFORMED;
+        case CMD_QUERY:
+            if (len != 2) return PROTO_NACK_MALFORMED;
+            if (payload[0] == QUERY_LATENCY && (payload[1] & 0x7F) < LAT_STAGE_COUNT) return PROTO_ACK;
+            if (payload[0] == QUERY_HEALTH && payload[1] == 0) return PROTO_ACK;
+            if (payload[0] == QUERY_CLOCK && payload[1] == 0) return PROTO_ACK;
+            if (payload[0] == QUERY_TRACE && payload[1] <= 1) return PROTO_ACK;
+            return PROTO_NACK_UNKNOWN;
+        default:
+            return PROTO_NACK_UNKNOWN;
+    }
+}
+
+static void push_event(key_event_t *ev) {
+    ev->rx_time_us = frame_rx_time;
+    key_queue_push(ev);
+}
+
+static void push_keys(uint8_t type, const uint8_t *payload, uint8_t len) {
+    for (uint8_t i = 0; i + 1 < len; i += 2) {
+        key_event_t ev = { type, payload[i], { payload[i + 1], 0, 0, 0, 0, 0 }, 0, 0, 0 };
+        push_event(&ev);
+    }
+}
+
+static uint8_t run_macro(const uint8_t *payload, uint8_t len) {
+    bool ok = true;
+    switch (payload[0]) {
+        case MACRO_OP_BEGIN:
+            macro_store_begin(get_u16(&payload[1]), get_u16(&payload[3]));
+            break;
+        case MACRO_OP_DATA:
+            macro_store_append(&payload[1], len - 1);
+            break;
+        case MACRO_OP_COMMIT:
+            ok = macro_store_commit();
+            break;
+        case MACRO_OP_DELETE:
+            ok = macro_store_delete(get_u16(&payload[1]));
+            break;
+    }
+    if (!ok) LOG_ERROR("Macro store write failed");
+    return ok ? PROTO_ACK : PROTO_NACK_STORE;
+}
+
+static uint8_t run_config(const uint8_t *payload, uint8_t len) {
+    switch (payload[0]) {
+        case CONFIG_OP_GET:
+            for (uint8_t i = 1; i < len; i++) {
+                uint32_t value = 0;
+                config_get_value(payload[i], &value);
+                reply_data(&payload[i], 1);
+                reply_u32(value);
+            }
+            break;
+        case CONFIG_OP_SET:
+            for (uint8_t i = 1; i < len; i += CONFIG_SET_LEN) {
+                config_set_value(payload[i], get_u32(&payload[i + 1]));
+            }
+            break;
+        case CONFIG_OP_COMMIT:
+            if (!config_commit()) return PROTO_NACK_STORE;
+            break;
+        case CONFIG_OP_DEFAULTS:
+            config_reset();
+            break;
+    }
+    return PROTO_ACK;
+}
+
+// Executes a checked record. Only flash writes can still fail here.
+static uint8_t run_record(uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    switch (cmd) {
+        case CMD_KEY_TAP:
+            push_keys(KEY_EV_TAP, payload, len);
+            break;
+        case CMD_KEY_DOWN:
+            push_keys(KEY_EV_DOWN, payload, len);
+            break;
+        case CMD_KEY_UP:
+            push_keys(KEY_EV_UP, payload, len);
+            break;
+        case CMD_RAW_REPORT:
+            for (uint8_t i = 0; i < len; i += 8) {
+                // Boot report layout: modifier, reserved, six keycodes
+                key_event_t ev = { KEY_EV_RAW, payload[i], {0}, 0, 0, 0 };
+                memcpy(ev.keycodes, &payload[i + 2], 6);
+                push_event(&ev);
+            }
+            break;
+        case CMD_DELAY: {
+            key_event_t ev = { KEY_EV_DELAY, 0, {0}, get_u32(payload), 0, 0 };
+            push_event(&ev);
+            break;
+        }
+        case CMD_SCHEDULE: {
+            uint32_t at = get_u32(&payload[1]);
+            if (!(payload[0] & SCHEDULE_ABSOLUTE)) {
+                bool chained = schedule_valid && (int32_t)(schedule_base - frame_rx_time) > 0;
+                at += chained ? schedule_base : frame_rx_time;
+            }
+            schedule_base = at;
+            schedule_valid = true;
+            key_event_t ev = { KEY_EV_AT, 0, { (uint8_t)((payload[0] & SCHEDULE_FRAME) ? KEY_AT_FRAME : 0) }, at, 0, 0 };
+            push_event(&ev);
+            break;
+        }
+        case CMD_TEXT:
+            ingest_text(payload, len, frame_rx_time);
+            break;
+        case CMD_SET_MODE:
+            ingest_set_mode((ingest_mode_t)payload[0]);
+            break;
+        case CMD_QUERY:
+            if (payload[0] == QUERY_LATENCY) query_latency(payload[1]);
+            if (payload[0] == QUERY_HEALTH) query_health();
+            if (payload[0] == QUERY_CLOCK) query_clock();
+            if (payload[0] == QUERY_TRACE) query_trace(payload[1]);
+            break;
+        case CMD_CONSUMER:
+            for (uint8_t i = 0; i < len; i += 2) {
+                consumer_engine_push(get_u16(&payload[i]));
+            }
+            break;
+        case CMD_MOUSE:
+            for (uint8_t i = 0; i < len; i += MOUSE_RECORD_LEN) {
+                const uint8_t *rec = &payload[i];
+                mouse_event_t ev = { rec[0], (int16_t)(rec[1] | (rec[2] << 8)), (int16_t)(rec[3] | (rec[4] << 8)),
+                    (int8_t)rec[5], (int8_t)rec[6] };
+                mouse_engine_push(&ev);
+            }
+            break;
+        case CMD_MACRO_RUN:
+            for (uint8_t i = 0; i < len; i += 2) {
+                key_event_t ev = { KEY_EV_MACRO, 0, {0}, get_u16(&payload[i]), 0, 0 };
+                push_event(&ev);
+            }
+            break;
+        case CMD_MACRO:
+            return run_macro(payload, len);
+        case CMD_CONFIG:
+            return run_config(payload, len);
+        default:
+            break;
+    }
+    return PROTO_ACK;
+}
+
+// Walks the records of a frame body. With run set the records are executed
+// and the first failure is returned, otherwise they are only checked and
+// their queue entries counted.
+static uint8_t walk_records(const uint8_t *body, size_t len, bool run, queue_demand_t *demand) {
+    uint8_t result = PROTO_ACK;
+    size_t pos = 0;
+    while (pos < len) {
+        if (pos + 2 > len) return PROTO_NACK_MALFORMED;
+        uint8_t cmd = body[pos];
+        uint8_t rec_len = body[pos + 1];
+        const uint8_t *payload = &body[pos + 2];
+        pos += 2 + rec_len;
+        if (pos > len) return PROTO_NACK_MALFORMED;
+
+        if (run) {
+            uint8_t status = run_record(cmd, payload, rec_len);
+            if (result == PROTO_ACK) result = status;
+        } else {
+            uint8_t status = check_record(cmd, payload, rec_len, demand);
+            if (status != PROTO_ACK) return status;
+        }
+    }
+    return result;
+}
+
+static void handle_frame(uint8_t *frame, size_t len) {
+    stats.frames++;
+    reply_len = 2;
+
+    uint8_t seq = frame[0];
+    uint16_t crc = frame[len - 2] | (frame[len - 1] << 8);
+    if (crc16(frame, len - 2) != crc) {
+        stats.crc_errors++;
+        send_reply(seq, PROTO_NACK_CRC);
+        return;
+    }
+
+    if (!seq_synced) {
+        expected_seq = seq;
+        seq_synced = true;
+    }
+    uint8_t behind = expected_seq - 1 - seq;
+    if (behind < executed) {
+        // Already executed, the sender did not see our ACK
+        stats.duplicates++;
+        send_reply(seq, PROTO_ACK);
+        return;
+    }
+    if (seq != expected_seq) {
+        reply_data(&expected_seq, 1);
+        send_reply(seq, PROTO_NACK_SEQ);
+        return;
+    }
+
+    const uint8_t *body = &frame[1];
+    size_t body_len = len - 3;
+    queue_demand_t demand = {0, 0, 0, 0, false, 0, 0, 0, -1};
+    demand.staging = macro_store_staging(&demand.staging_id, &demand.staging_len, &demand.staged);
+    uint8_t status = walk_records(body, body_len, false, &demand);
+    if (status == PROTO_ACK && (demand.keys > key_queue_free() || demand.consumer > consumer_engine_free() ||
+                                demand.mouse > mouse_engine_free())) {
+        status = PROTO_NACK_BUSY;
+    }
+    if (status != PROTO_ACK) {
+        LOG_DEBUG("Frame %u refused, status %u", seq, status);
+        send_reply(seq, status);
+        return;
+    }
+
+    expected_seq = seq + 1;
+    if (executed < PROTO_DUP_WINDOW) executed++;
+    status = walk_records(body, body_len, true, &demand);
+    send_reply(seq, status);
+}
+
+void protocol_rx_byte(uint8_t ch, uint32_t rx_time_us) {
+    if (ch != 0) {
+        if (rx_len == 0) frame_rx_time = rx_time_us;
+        if (rx_len < sizeof(rx_buf)) {
+            rx_buf[rx_len++] = ch;
+        } else {
+            rx_overflow = true;
+        }
+        return;
+    }
+
+    // Delimiter, decode what was collected. Empty frames between
+    // back to back delimiters are ignored.
+    if (rx_overflow) {
+        LOG_WARN("Oversized frame dropped");
+        stats.frames++;
+        stats.crc_errors++;
+    } else if (rx_len > 0) {
+        size_t len = cobs_decode(rx_buf, rx_len, rx_buf);
+        if (len >= PROTO_FRAME_MIN) {
+            handle_frame(rx_buf, len);
+        } else {
+            stats.frames++;
+            stats.crc_errors++;
+        }
+    }
+    rx_len = 0;
+    rx_overflow = false;
+}
+
+void protocol_get_stats(protocol_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,129 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdint.h>
+
+// Framed binary command protocol on the bridge UART.
+//
+// Frames are COBS encoded and delimited by zero bytes. A decoded frame is
+//   [seq] [record]... [crc16 lo] [crc16 hi]
+// where every record is [command] [payload length] [payload], and the
+// CRC-16/CCITT-FALSE covers everything before it. All records of a frame are
+// executed together or not at all.
+//
+// Every frame is answered with [seq] [status] [data]... [crc16 lo] [crc16 hi].
+// Frames must arrive with consecutive sequence numbers, so the sender can
+// keep a window of frames in flight and go back to the first one not ACKed.
+// The first frame after entering framed mode sets the sequence. A repeated
+// frame among the last PROTO_DUP_WINDOW executed ones is ACKed again without
+// running it twice. That ACK carries no data, a repeated query gets no answer.
+// Any other seq is answered with PROTO_NACK_SEQ, also an older one, so a
+// sender that restarts its numbering learns the expected seq.
+
+// Largest decoded frame
+#define PROTO_FRAME_MAX 256
+
+// Executed frames a repeat is recognized for, at most 127
+#define PROTO_DUP_WINDOW 16
+
+// Commands
+enum {
+    CMD_KEY_TAP    = 0x01, // [modifier keycode]...  press and release each key
+    CMD_KEY_DOWN   = 0x02, // [modifier keycode]...  press and hold
+    CMD_KEY_UP     = 0x03, // [modifier keycode]...  release held keys
+    CMD_RAW_REPORT = 0x04, // [8 byte boot keyboard report]...
+    CMD_DELAY      = 0x05, // [u32 microseconds]  pause before the next event
+    CMD_TEXT       = 0x06, // [characters]...  typed with the active layout
+    CMD_SET_MODE   = 0x07, // [ingest mode]  0 returns to text input
+    CMD_PING       = 0x08, // no payload
+    CMD_QUERY      = 0x09, // [query] [argument]  reply data depends on the query
+    CMD_CONSUMER   = 0x0A, // [usage lo usage hi]...  consumer control taps
+    CMD_MOUSE      = 0x0B, // [buttons dx(i16) dy(i16) wheel(i8) pan(i8)]...
+    CMD_MACRO_RUN  = 0x0C, // [id lo id hi]...  plays stored macros on the keyboard
+    CMD_MACRO      = 0x0D, // [op] ...  macro upload, see MACRO_OP_*
+    CMD_CONFIG     = 0x0E, // [op] ...  runtime config, see CONFIG_OP_*
+    CMD_SCHEDULE   = 0x0F  // [flags] [u32 microseconds]  time of the next keyboard event, see SCHEDULE_*
+};
+
+// CMD_SCHEDULE flags. A relative time counts from the previous scheduled
+// time while that is still ahead, otherwise from the arrival of the frame,
+// so a replay of recorded intervals does not drift. Absolute times are in
+// the bridge clock, see QUERY_CLOCK.
+enum {
+    SCHEDULE_ABSOLUTE = 0x01,
+    SCHEDULE_FRAME    = 0x02  // The host reads the report in the USB frame starting at or after the time
+};
+
+// CMD_MACRO operations. Commit and delete are refused with NACK_BUSY until
+// the keyboard is idle, so a macro is never moved in flash while it plays.
+enum {
+    MACRO_OP_BEGIN  = 0x01, // [id lo id hi] [len lo len hi]
+    MACRO_OP_DATA   = 0x02, // the next bytes of the macro
+    MACRO_OP_COMMIT = 0x03, // writes the macro to flash
+    MACRO_OP_DELETE = 0x04  // [id lo id hi]
+};
+
+// CMD_CONFIG operations, keys are the CONFIG_* values of config_store.h.
+// Set changes the running config, commit keeps it across resets.
+enum {
+    CONFIG_OP_GET      = 0x01, // [key]...  data: [key] [u32 value] for each
+    CONFIG_OP_SET      = 0x02, // [key] [u32 value]...
+    CONFIG_OP_COMMIT   = 0x03, // writes the config to flash
+    CONFIG_OP_DEFAULTS = 0x04  // back to the built-in defaults, until the next commit
+};
+
+// Queries
+enum {
+    // Argument: latency stage, plus 0x80 to reset all statistics after reading.
+    // Data: [stage] then u32 count, min, max, mean, p50, p99 in us and the
+    // LATENCY_BUCKETS log2 histogram buckets as u32
+    QUERY_LATENCY = 0x01,
+    // Argument: 0. Data: u32 counters since boot, for each of the
+    // HAL_UART_CHANNELS inputs overruns, framing, parity and break errors,
+    // then key queue drops and high water mark, keyboard busy stalls,
+    // retries, lost reports and held key releases (see hid_engine_stats_t),
+    // and frame CRC errors and dropped replies
+    QUERY_HEALTH  = 0x02,
+    // Argument: 0. Data: u64 bridge time in us, then u64 start of the
+    // latest USB frame in the same clock, 0 while unknown
+    QUERY_CLOCK   = 0x03,
+    // Argument: 0 reads the oldest trace entries, 1 clears the trace.
+    // Data: u32 entries lost since the last read, [count], then count
+    // trace_entry_t of 8 bytes, u32 time first (see trace.h). An empty read
+    // means the trace has been read up to now.
+    QUERY_TRACE   = 0x04
+};
+
+// Reply status
+enum {
+    PROTO_ACK            = 0x00,
+    PROTO_NACK_CRC       = 0x01, // Frame was damaged, seq may be wrong too
+    PROTO_NACK_BUSY      = 0x02, // Not enough room in the key queue, resend later
+    PROTO_NACK_MALFORMED = 0x03, // Records do not add up to the frame length
+    PROTO_NACK_UNKNOWN   = 0x04, // Unknown command
+    PROTO_NACK_SEQ       = 0x05, // Unexpected seq, data holds the expected one
+    PROTO_NACK_NOT_FOUND = 0x06, // No macro with that id
+    PROTO_NACK_STORE     = 0x07, // Macro does not fit or a flash write failed.
+                                 // A failed write is only known after the frame
+                                 // ran, so the frame counts as executed.
+    PROTO_NACK_RANGE     = 0x08  // Unknown config key or value out of range
+};
+
+typedef struct {
+    uint32_t frames;
+    uint32_t acks;
+    uint32_t nacks;
+    uint32_t crc_errors;
+    uint32_t duplicates;
+    uint32_t replies_dropped; // UART transmit ring had no room for a reply
+} protocol_stats_t;
+
+// Forgets any partial frame and the sequence number
+void protocol_reset(void);
+
+// Handles one received byte in framed mode
+void protocol_rx_byte(uint8_t ch, uint32_t rx_time_us);
+
+void protocol_get_stats(protocol_stats_t *stats);
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,77 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer.
+// The producer only writes head and the consumer only writes tail, so one side
+// can run in an interrupt handler without any locking. N must be a power of two.
+template <typename T, size_t N>
+class ring_buffer {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "ring_buffer size must be a power of two");
+
+public:
+    // Producer side
+    bool push(const T &item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N) return false;
+        buf_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail) return false;
+        item = buf_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Copies up to max items out in one go, returns the number copied
+    size_t read(T *dst, size_t max) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t avail = head_.load(std::memory_order_acquire) - tail;
+        size_t n = avail < max ? avail : max;
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = buf_[(tail + i) & (N - 1)];
+        }
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Looks at the i-th oldest item without removing it, NULL if there is none
+    const T *peek(size_t i) const {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (i >= head_.load(std::memory_order_acquire) - tail) return NULL;
+        return &buf_[(tail + i) & (N - 1)];
+    }
+
+    // Removes up to n items that were looked at with peek()
+    size_t discard(size_t n) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t avail = head_.load(std::memory_order_acquire) - tail;
+        if (n > avail) n = avail;
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    size_t free() const { return N - size(); }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= N; }
+    static constexpr size_t capacity() { return N; }
+
+private:
+    T buf_[N];
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+};
+
+#endif /* RING_BUFFER_H_ */
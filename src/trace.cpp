@@ -0,0 +1,140 @@
+#include "trace.h"
+
+#include <atomic>
+
+static_assert((TRACE_ENTRIES & (TRACE_ENTRIES - 1)) == 0, "TRACE_ENTRIES must be a power of two");
+
+// Most keys recorded per report, more than any report the engine builds
+#define TRACE_REPORT_KEYS_MAX 16
+
+// Entries of the longest report record
+#define TRACE_RECORD_MAX (1 + (TRACE_REPORT_KEYS_MAX + 1) / TRACE_KEYS_PER_ENTRY)
+
+// Entries of one producer. The writer owns head, the reader owns tail.
+typedef struct {
+    trace_entry_t entries[TRACE_ENTRIES];
+    std::atomic<uint32_t> head;
+    uint32_t tail;
+} trace_ring_t;
+
+static trace_ring_t rx_ring;
+static trace_ring_t report_ring;
+static std::atomic<bool> enabled{TRACE_DEFAULT_ENABLED};
+static uint32_t lost = 0;
+
+void trace_set_enabled(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool trace_enabled(void) {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+static void ring_push(trace_ring_t *ring, const trace_entry_t &entry) {
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    // The slot may still be read, the reader sees from head that it changed
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->entries[head & (TRACE_ENTRIES - 1)] = entry;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Copies entry i of a ring, false if the writer overwrote it meanwhile
+static bool ring_get(const trace_ring_t *ring, uint32_t i, trace_entry_t *entry) {
+    *entry = ring->entries[i & (TRACE_ENTRIES - 1)];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ring->head.load(std::memory_order_relaxed) - i < TRACE_ENTRIES;
+}
+
+// Moves the read position past overwritten entries, returns the entries left
+static uint32_t ring_catch_up(trace_ring_t *ring) {
+    uint32_t head = ring->head.load(std::memory_order_acquire);
+    if (head - ring->tail > TRACE_ENTRIES) {
+        lost += head - TRACE_ENTRIES - ring->tail;
+        ring->tail = head - TRACE_ENTRIES;
+    }
+    return head - ring->tail;
+}
+
+void trace_rx(uint8_t channel, uint8_t ch, uint32_t time_us) {
+    if (!trace_enabled()) return;
+    trace_entry_t entry = { time_us, TRACE_RX, channel, { ch, 0 } };
+    ring_push(&rx_ring, entry);
+}
+
+void trace_report(uint8_t modifier, const uint8_t *keycodes, uint8_t count, uint32_t time_us) {
+    if (!trace_enabled()) return;
+    if (count > TRACE_REPORT_KEYS_MAX) count = TRACE_REPORT_KEYS_MAX;
+    trace_entry_t entry = { time_us, TRACE_REPORT, modifier, { count, (uint8_t)(count ? keycodes[0] : 0) } };
+    ring_push(&report_ring, entry);
+    for (uint8_t i = 1; i < count; i += TRACE_KEYS_PER_ENTRY) {
+        uint8_t keys[TRACE_KEYS_PER_ENTRY] = {0};
+        for (uint8_t k = 0; k < TRACE_KEYS_PER_ENTRY && i + k < count; k++) keys[k] = keycodes[i + k];
+        trace_entry_t more = { time_us, TRACE_KEYS, keys[0], { keys[1], keys[2] } };
+        ring_push(&report_ring, more);
+    }
+}
+
+static uint8_t record_len(uint8_t count) {
+    return 1 + (count > 1 ? (count - 1 + TRACE_KEYS_PER_ENTRY - 1) / TRACE_KEYS_PER_ENTRY : 0);
+}
+
+// Copies the oldest complete report record, returns its entries or 0.
+// Records the writer overwrote are skipped and counted as lost.
+static uint8_t peek_report(trace_entry_t *record) {
+    for (;;) {
+        uint32_t avail = ring_catch_up(&report_ring);
+        if (avail == 0) return 0;
+        uint32_t tail = report_ring.tail;
+        if (!ring_get(&report_ring, tail, &record[0]) || record[0].type != TRACE_REPORT) {
+            // Overwritten, or the rest of a record whose start was
+            lost++;
+            report_ring.tail++;
+            continue;
+        }
+        uint8_t len = record_len(record[0].data[0]);
+        if (avail < len) return 0;
+        bool intact = true;
+        for (uint8_t i = 1; i < len; i++) intact = intact && ring_get(&report_ring, tail + i, &record[i]);
+        if (intact) return len;
+        lost++;
+        report_ring.tail++;
+    }
+}
+
+// Copies the oldest received byte, false if there is none
+static bool peek_rx(trace_entry_t *entry) {
+    while (ring_catch_up(&rx_ring)) {
+        if (ring_get(&rx_ring, rx_ring.tail, entry)) return true;
+        lost++;
+        rx_ring.tail++;
+    }
+    return false;
+}
+
+size_t trace_read(trace_entry_t *entries, size_t max, uint32_t *lost_out) {
+    size_t n = 0;
+    trace_entry_t rx;
+    trace_entry_t record[TRACE_RECORD_MAX];
+    while (n < max) {
+        bool have_rx = peek_rx(&rx);
+        uint8_t len = peek_report(record);
+        if (!have_rx && !len) break;
+        if (have_rx && (!len || (int32_t)(rx.time_us - record[0].time_us) <= 0)) {
+            entries[n++] = rx;
+            rx_ring.tail++;
+        } else {
+            if (n + len > max) break;
+            for (uint8_t i = 0; i < len; i++) entries[n++] = record[i];
+            report_ring.tail += len;
+        }
+    }
+    *lost_out = lost;
+    lost = 0;
+    return n;
+}
+
+void trace_clear(void) {
+    rx_ring.tail = rx_ring.head.load(std::memory_order_acquire);
+    report_ring.tail = report_ring.head.load(std::memory_order_acquire);
+    lost = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional record of what went in and out of the bridge, for reproducing
+// field problems on the host (see host/bridge_replay.cpp). Received bytes
+// and submitted keyboard reports are kept with their times in RAM rings,
+// the newest TRACE_ENTRIES of each, and read out with QUERY_TRACE.
+//
+// Received bytes are recorded by the core running ingest and reports by the
+// core running the engine, each into its own ring, so neither ever waits.
+// The rings overwrite their oldest entries, the reader notices when an entry
+// it copied was overwritten and counts it as lost.
+
+// Entries per ring, must be a power of two
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 1024
+#endif
+
+// Tracing at boot, 1 to record
+#ifndef TRACE_DEFAULT_ENABLED
+#define TRACE_DEFAULT_ENABLED 0
+#endif
+
+typedef enum {
+    TRACE_RX,      // arg: channel, data[0]: the byte
+    TRACE_REPORT,  // arg: modifier, data[0]: key count, data[1]: first key
+    TRACE_KEYS     // The next three keys of the report before, in arg and data
+} trace_type_t;
+
+typedef struct {
+    uint32_t time_us;  // Low 32 bits of hal_time_us()
+    uint8_t type;
+    uint8_t arg;
+    uint8_t data[2];
+} trace_entry_t;
+
+// Keys a TRACE_KEYS entry holds
+#define TRACE_KEYS_PER_ENTRY 3
+
+void trace_set_enabled(bool enabled);
+bool trace_enabled(void);
+
+// Producers, each called from one core only
+void trace_rx(uint8_t channel, uint8_t ch, uint32_t time_us);
+void trace_report(uint8_t modifier, const uint8_t *keycodes, uint8_t count, uint32_t time_us);
+
+// Copies up to max of the oldest unread entries, received bytes and reports
+// merged in time order. A report is never split. lost counts the entries
+// overwritten before they could be read since the last call.
+size_t trace_read(trace_entry_t *entries, size_t max, uint32_t *lost);
+
+// Forgets everything recorded so far
+void trace_clear(void);
+
+#endif /* TRACE_H_ */
@@ -96,14 +96,19 @@ extern "C"
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID 1
+#define CFG_TUD_HID 3 // Keyboard, consumer control and mouse
 #define CFG_TUD_CDC 0
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
 #define CFG_TUD_VENDOR 0
 
-// HID buffer size Should be sufficient to hold ID (if any) + Data
+// HID buffer size Should be sufficient to hold ID (if any) + Data,
+// the NKRO report is 21 bytes
+#if BRIDGE_NKRO
+#define CFG_TUD_HID_EP_BUFSIZE 32
+#else
 #define CFG_TUD_HID_EP_BUFSIZE 16
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,179 @@
+#include "uart_io.h"
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "ring_buffer.h"
+
+static uart_inst_t *uart_io = NULL;
+// Received bytes with the time the interrupt collected them
+typedef struct {
+    uint32_t time_us;
+    uint8_t ch;
+} rx_entry_t;
+
+static ring_buffer<rx_entry_t, UART_RX_BUF_SIZE> rx_ring;
+static ring_buffer<uint8_t, UART_TX_BUF_SIZE> tx_ring;
+static volatile uart_io_errors_t errors = {0, 0, 0, 0, 0};
+static volatile bool rx_enabled = true;
+
+static uart_flow_t flow = UART_FLOW_NONE;
+static uint rts_gpio = 0;
+static volatile bool rx_paused = false;
+// XON or XOFF waiting to go out ahead of the TX ring, 0 if none
+static volatile uint8_t tx_flow_char = 0;
+
+// Moves queued bytes into the TX FIFO, and keeps the TX interrupt enabled
+// only while there is something left to send. Called with interrupts masked.
+static void tx_fill_fifo(void) {
+    if (tx_flow_char && uart_is_writable(uart_io)) {
+        uart_putc_raw(uart_io, tx_flow_char);
+        tx_flow_char = 0;
+    }
+    uint8_t ch;
+    while (uart_is_writable(uart_io) && tx_ring.pop(ch)) {
+        uart_putc_raw(uart_io, ch);
+    }
+    uart_set_irq_enables(uart_io, true, tx_flow_char || !tx_ring.empty());
+}
+
+// Pauses or resumes the sender when the receive ring crosses a watermark.
+// Called with interrupts masked.
+static void flow_update(void) {
+    if (flow == UART_FLOW_NONE) return;
+    size_t level = rx_ring.size();
+    if (!rx_paused && level >= UART_RX_HIGH_WATER) {
+        rx_paused = true;
+    } else if (rx_paused && level <= UART_RX_LOW_WATER) {
+        rx_paused = false;
+    } else {
+        return;
+    }
+
+    if (flow == UART_FLOW_RTS_CTS) {
+        gpio_put(rts_gpio, rx_paused);  // RTS is active low
+    } else {
+        tx_flow_char = rx_paused ? UART_XOFF : UART_XON;
+        tx_fill_fifo();
+    }
+}
+
+// Empties the hardware RX FIFO into the ring and refills the TX FIFO.
+// RX runs on both the RX level and the RX timeout interrupt, so single
+// bytes are not left waiting in the FIFO.
+static void on_uart_irq(void) {
+    uint32_t now = time_us_32();
+    while (uart_is_readable(uart_io)) {
+        // The data register holds the error flags of each byte above the data
+        uint32_t dr = uart_get_hw(uart_io)->dr;
+        if (!rx_enabled) continue;
+        if (dr & UART_UARTDR_OE_BITS) errors.fifo_overruns = errors.fifo_overruns + 1;
+        if (dr & UART_UARTDR_BE_BITS) {
+            errors.breaks = errors.breaks + 1;
+            continue;
+        }
+        if (dr & UART_UARTDR_FE_BITS) {
+            errors.framing = errors.framing + 1;
+            continue;
+        }
+        if (dr & UART_UARTDR_PE_BITS) {
+            errors.parity = errors.parity + 1;
+            continue;
+        }
+        rx_entry_t entry = { now, (uint8_t)dr };
+        if (!rx_ring.push(entry)) {
+            errors.rx_overruns = errors.rx_overruns + 1;
+        }
+    }
+    flow_update();
+    tx_fill_fifo();
+}
+
+void uart_io_init(uart_inst_t *uart, uint baud_rate, uint tx_pin, uint rx_pin) {
+    uart_io = uart;
+
+    uart_init(uart, baud_rate);
+    gpio_set_function(tx_pin, GPIO_FUNC_UART);
+    gpio_set_function(rx_pin, GPIO_FUNC_UART);
+    uart_set_fifo_enabled(uart, true);
+
+    int irq = (uart == uart0) ? UART0_IRQ : UART1_IRQ;
+    irq_set_exclusive_handler(irq, on_uart_irq);
+    irq_set_enabled(irq, true);
+    uart_set_irq_enables(uart, true, false);
+}
+
+void uart_io_set_flow(uart_flow_t new_flow, uint rts_pin, uint cts_pin) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    flow = new_flow;
+    rx_paused = false;
+    if (flow == UART_FLOW_RTS_CTS) {
+        rts_gpio = rts_pin;
+        gpio_init(rts_pin);
+        gpio_set_dir(rts_pin, GPIO_OUT);
+        gpio_put(rts_pin, 0);
+        gpio_set_function(cts_pin, GPIO_FUNC_UART);
+    }
+    uart_set_hw_flow(uart_io, flow == UART_FLOW_RTS_CTS, false);
+    flow_update();
+    restore_interrupts(irq_state);
+}
+
+uint uart_io_set_baud(uint baud_rate) {
+    return uart_set_baudrate(uart_io, baud_rate);
+}
+
+void uart_io_set_rx_enabled(bool enabled) {
+    rx_enabled = enabled;
+}
+
+bool uart_io_rx_paused(void) {
+    return rx_paused;
+}
+
+size_t uart_io_read(uint8_t *dst, uint32_t *rx_time_us, size_t max) {
+    size_t n = 0;
+    rx_entry_t entry;
+    while (n < max && rx_ring.pop(entry)) {
+        dst[n] = entry.ch;
+        if (rx_time_us) rx_time_us[n] = entry.time_us;
+        n++;
+    }
+
+    // Resume the sender once the ring has drained far enough
+    if (n && rx_paused) {
+        uint32_t irq_state = save_and_disable_interrupts();
+        flow_update();
+        restore_interrupts(irq_state);
+    }
+    return n;
+}
+
+size_t uart_io_rx_available(void) {
+    return rx_ring.size();
+}
+
+void uart_io_get_errors(uart_io_errors_t *out) {
+    out->rx_overruns = errors.rx_overruns;
+    out->fifo_overruns = errors.fifo_overruns;
+    out->framing = errors.framing;
+    out->parity = errors.parity;
+    out->breaks = errors.breaks;
+}
+
+size_t uart_io_write(const uint8_t *src, size_t len) {
+    size_t n = 0;
+    while (n < len && tx_ring.push(src[n])) n++;
+
+    // The TX interrupt only fires when the FIFO level drops, so prime the
+    // FIFO here if the interrupt is not already draining the ring
+    uint32_t irq_state = save_and_disable_interrupts();
+    tx_fill_fifo();
+    restore_interrupts(irq_state);
+    return n;
+}
+
+size_t uart_io_tx_free(void) {
+    return tx_ring.free();
+}
@@ -0,0 +1,73 @@
+#ifndef UART_IO_H_
+#define UART_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/uart.h"
+
+// Size of the interrupt-fed receive ring, must be a power of two.
+// 1024 bytes cover ~11 ms of input at 921600 baud.
+#define UART_RX_BUF_SIZE 1024
+
+// Size of the interrupt-drained transmit ring, must be a power of two
+#define UART_TX_BUF_SIZE 1024
+
+// Flow control towards the sender
+typedef enum {
+    UART_FLOW_NONE,
+    UART_FLOW_RTS_CTS,  // RTS driven from the receive ring level, CTS gates our TX
+    UART_FLOW_XON_XOFF  // XOFF/XON sent ahead of queued TX data, text input only
+} uart_flow_t;
+
+// Receive ring levels at which the sender is paused and resumed. The gap
+// above the high mark absorbs what the sender still has in flight.
+#define UART_RX_HIGH_WATER (UART_RX_BUF_SIZE - 256)
+#define UART_RX_LOW_WATER  (UART_RX_BUF_SIZE / 4)
+
+#define UART_XON  0x11
+#define UART_XOFF 0x13
+
+// Receive errors since boot. Bytes with a framing, parity or break error
+// are dropped, a FIFO overrun only flags the byte after the lost ones.
+typedef struct {
+    uint32_t rx_overruns;    // Bytes dropped because the receive ring was full
+    uint32_t fifo_overruns;  // Bytes lost because the interrupt was late
+    uint32_t framing;
+    uint32_t parity;
+    uint32_t breaks;
+} uart_io_errors_t;
+
+// Initializes the UART and starts interrupt driven reception
+void uart_io_init(uart_inst_t *uart, uint baud_rate, uint tx_pin, uint rx_pin);
+
+// Enables flow control, the pins are only used with UART_FLOW_RTS_CTS.
+// RTS is a plain GPIO because the hardware RTS only follows the RX FIFO.
+void uart_io_set_flow(uart_flow_t flow, uint rts_pin, uint cts_pin);
+
+// Changes the baud rate, returns the rate actually set
+uint uart_io_set_baud(uint baud_rate);
+
+// Received bytes are dropped while disabled, e.g. while the rate is being detected
+void uart_io_set_rx_enabled(bool enabled);
+
+// True while the sender is being held off
+bool uart_io_rx_paused(void);
+
+// Copies up to max received bytes into dst, returns the number copied.
+// rx_time_us, if not NULL, gets the time_us_32() at which each byte was taken
+// from the FIFO, which is at most one FIFO trigger level after it arrived.
+size_t uart_io_read(uint8_t *dst, uint32_t *rx_time_us, size_t max);
+
+// Number of received bytes waiting in the ring
+size_t uart_io_rx_available(void);
+
+void uart_io_get_errors(uart_io_errors_t *errors);
+
+// Queues up to len bytes for transmission without blocking, returns the number queued
+size_t uart_io_write(const uint8_t *src, size_t len);
+
+// Free space in the transmit ring
+size_t uart_io_tx_free(void);
+
+#endif /* UART_IO_H_ */
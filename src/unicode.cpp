@@ -0,0 +1,151 @@
+#include "unicode.h"
+
+#include <string.h>
+
+#include "hid_keycodes.h"
+#include "keymap.h"
+
+typedef struct {
+    uint32_t tag;  // Codepoint + 1, 0 when empty
+    unicode_seq_t seq;
+} cache_entry_t;
+
+static unicode_method_t method = UNICODE_DEFAULT_METHOD;
+
+// The cached sequences depend on the layout and method they were made for
+static cache_entry_t cache[UNICODE_CACHE_SIZE];
+static keymap_layout_t cache_layout = LAYOUT_COUNT;
+static unicode_method_t cache_method = UNICODE_METHOD_COUNT;
+
+// Sequence of a character of the layout table, not cached
+static unicode_seq_t direct;
+
+void unicode_set_method(unicode_method_t new_method) {
+    if (new_method < UNICODE_METHOD_COUNT) method = new_method;
+}
+
+unicode_method_t unicode_get_method(void) {
+    return method;
+}
+
+static void seq_add(unicode_seq_t *seq, uint8_t modifier, uint8_t keycode) {
+    seq->keys[seq->count].modifier = modifier;
+    seq->keys[seq->count].keycode = keycode;
+    seq->count++;
+}
+
+static void seq_key(unicode_seq_t *seq, keymap_entry_t key) {
+    seq->count = 0;
+    seq_add(seq, key.modifier, key.keycode);
+    // A dead key only shows its own character when followed by a space
+    if (key.flags & KEYMAP_DEAD) seq_add(seq, 0, KC_SPACE);
+}
+
+// Hex digits, most significant first without leading zeros. Digits come
+// from the main keys or the keypad, a-f from the letter keys, which sit in
+// the same place in all text layouts.
+static void seq_hex(unicode_seq_t *seq, uint32_t codepoint, uint8_t modifier, bool keypad) {
+    int shift = 20;
+    while (shift > 0 && !(codepoint >> shift)) shift -= 4;
+    for (; shift >= 0; shift -= 4) {
+        uint8_t digit = (codepoint >> shift) & 0xF;
+        uint8_t keycode;
+        if (digit >= 10) {
+            keycode = KC_A + digit - 10;
+        } else if (keypad) {
+            keycode = digit ? KC_KEYPAD_1 + digit - 1 : KC_KEYPAD_0;
+        } else {
+            keycode = digit ? KC_1 + digit - 1 : KC_0;
+        }
+        seq_add(seq, modifier, keycode);
+    }
+}
+
+static void compile(uint32_t codepoint, unicode_seq_t *seq) {
+    seq->count = 0;
+    keymap_entry_t key = keymap_lookup_wide(codepoint);
+    if (key.keycode) {
+        seq_key(seq, key);
+        return;
+    }
+    // Control characters, surrogates and codepoints beyond Unicode have no entry
+    if (codepoint < 0x20 || (codepoint >= 0x7F && codepoint < 0xA0)) return;
+    if ((codepoint >= 0xD800 && codepoint <= 0xDFFF) || codepoint > 0x10FFFF) return;
+
+    switch (method) {
+        case UNICODE_LINUX:
+            seq_add(seq, MOD_LCTRL | MOD_LSHIFT, KC_A + ('u' - 'a'));
+            seq_hex(seq, codepoint, 0, false);
+            seq_add(seq, 0, KC_SPACE);
+            break;
+        case UNICODE_WINDOWS:
+            if (codepoint > 0xFFFF) return;
+            seq_add(seq, MOD_LALT, KC_KEYPAD_PLUS);
+            seq_hex(seq, codepoint, MOD_LALT, true);
+            seq_add(seq, 0, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+const unicode_seq_t *unicode_sequence(uint32_t codepoint) {
+    if (codepoint < 0x100) {
+        keymap_entry_t key = keymap_lookup(codepoint);
+        if (key.keycode) {
+            seq_key(&direct, key);
+            return &direct;
+        }
+    }
+
+    keymap_layout_t layout = keymap_get_layout();
+    if (layout != cache_layout || method != cache_method) {
+        memset(cache, 0, sizeof(cache));
+        cache_layout = layout;
+        cache_method = method;
+    }
+    cache_entry_t *entry = &cache[(codepoint ^ (codepoint >> 7)) & (UNICODE_CACHE_SIZE - 1)];
+    if (entry->tag != codepoint + 1) {
+        compile(codepoint, &entry->seq);
+        entry->tag = codepoint + 1;
+    }
+    return &entry->seq;
+}
+
+void utf8_reset(utf8_decoder_t *decoder) {
+    decoder->need = 0;
+}
+
+uint32_t utf8_decode(utf8_decoder_t *decoder, uint8_t byte) {
+    if ((byte & 0xC0) == 0x80) {
+        if (!decoder->need) return UTF8_INVALID;
+        decoder->codepoint = (decoder->codepoint << 6) | (byte & 0x3F);
+        if (--decoder->need) return UTF8_PENDING;
+
+        // Overlong forms, surrogates and codepoints beyond Unicode
+        uint32_t codepoint = decoder->codepoint;
+        static const uint32_t min[4] = { 0, 0x80, 0x800, 0x10000 };
+        if (codepoint < min[decoder->len - 1] || (codepoint >= 0xD800 && codepoint <= 0xDFFF) || codepoint > 0x10FFFF) {
+            return UTF8_INVALID;
+        }
+        return codepoint;
+    }
+
+    // Anything else starts a new character
+    decoder->need = 0;
+    if (byte < 0x80) return byte;
+    if (byte >= 0xC2 && byte <= 0xDF) {
+        decoder->codepoint = byte & 0x1F;
+        decoder->need = 1;
+    } else if (byte >= 0xE0 && byte <= 0xEF) {
+        decoder->codepoint = byte & 0x0F;
+        decoder->need = 2;
+    } else if (byte >= 0xF0 && byte <= 0xF4) {
+        decoder->codepoint = byte & 0x07;
+        decoder->need = 3;
+    } else {
+        return UTF8_INVALID;
+    }
+    decoder->len = decoder->need + 1;
+    return UTF8_PENDING;
+}
@@ -0,0 +1,67 @@
+#ifndef UNICODE_H_
+#define UNICODE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Unicode text entry. A character is typed with its key in the active
+// layout when it has one, otherwise with the host's hex input method:
+//   Linux (IBus, GTK)  Ctrl+Shift+U, the hex digits, Space
+//   Windows            Alt held, keypad +, the hex digits, Alt released.
+//                      Needs the EnableHexNumpad registry value, BMP only.
+// The key sequences of recent characters are kept in a small cache, so
+// repeated characters are not expanded again.
+
+typedef enum {
+    UNICODE_NONE,     // Only characters with a key in the layout are typed
+    UNICODE_LINUX,
+    UNICODE_WINDOWS,
+    UNICODE_METHOD_COUNT
+} unicode_method_t;
+
+#ifndef UNICODE_DEFAULT_METHOD
+#define UNICODE_DEFAULT_METHOD UNICODE_NONE
+#endif
+
+// Longest sequence, Ctrl+Shift+U, six hex digits and Space
+#define UNICODE_SEQ_MAX 8
+
+// Cached characters, must be a power of two
+#define UNICODE_CACHE_SIZE 16
+
+// One tap. A keycode of 0 releases the keys of the previous taps, the
+// Windows method needs Alt to go up before the next character.
+typedef struct {
+    uint8_t modifier;
+    uint8_t keycode;
+} unicode_key_t;
+
+typedef struct {
+    uint8_t count;  // 0 when the character cannot be typed
+    unicode_key_t keys[UNICODE_SEQ_MAX];
+} unicode_seq_t;
+
+void unicode_set_method(unicode_method_t method);
+unicode_method_t unicode_get_method(void);
+
+// Key sequence for a codepoint in the active layout and method. The pointer
+// is valid until the next call.
+const unicode_seq_t *unicode_sequence(uint32_t codepoint);
+
+// UTF-8 decoder, one per input stream
+typedef struct {
+    uint32_t codepoint;
+    uint8_t need;  // Continuation bytes still to come
+    uint8_t len;   // Of the sequence being decoded
+} utf8_decoder_t;
+
+#define UTF8_PENDING 0xFFFFFFFFu  // Byte taken, the character is not complete yet
+#define UTF8_INVALID 0xFFFFFFFEu  // Byte or sequence dropped
+
+void utf8_reset(utf8_decoder_t *decoder);
+
+// Takes one byte, returns the codepoint it completes, UTF8_PENDING or
+// UTF8_INVALID. A sequence cut short by a new character is dropped.
+uint32_t utf8_decode(utf8_decoder_t *decoder, uint8_t byte);
+
+#endif /* UNICODE_H_ */
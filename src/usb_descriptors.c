@@ -72,30 +72,84 @@ uint8_t const *tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] = { TUD_HID_REPORT_DESC_KEYBOARD() };
+#if BRIDGE_NKRO
+// Same as TUD_HID_REPORT_DESC_KEYBOARD() with the six key array replaced by
+// a bitmap. Hosts using the boot protocol ignore this and get boot reports.
+#define TUD_HID_REPORT_DESC_NKRO_KEYBOARD() \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP     )                    ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD )                    ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION )                    ,\
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD )                     ,\
+      HID_USAGE_MIN    ( 224                                    )  ,\
+      HID_USAGE_MAX    ( 231                                    )  ,\
+      HID_LOGICAL_MIN  ( 0                                      )  ,\
+      HID_LOGICAL_MAX  ( 1                                      )  ,\
+      HID_REPORT_COUNT ( 8                                      )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+    /* One bit per key usage */ \
+      HID_USAGE_MIN    ( 0                                      )  ,\
+      HID_USAGE_MAX    ( HID_NKRO_KEYS - 1                      )  ,\
+      HID_REPORT_COUNT ( HID_NKRO_KEYS                          )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+    /* Output 5-bit LED Indicator Kana | Compose | ScrollLock | CapsLock | NumLock */ \
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_LED                   )       ,\
+      HID_USAGE_MIN    ( 1                                       ) ,\
+      HID_USAGE_MAX    ( 5                                       ) ,\
+      HID_REPORT_COUNT ( 5                                       ) ,\
+      HID_REPORT_SIZE  ( 1                                       ) ,\
+      HID_OUTPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE  ) ,\
+      /* led padding */ \
+      HID_REPORT_COUNT ( 1                                       ) ,\
+      HID_REPORT_SIZE  ( 3                                       ) ,\
+      HID_OUTPUT       ( HID_CONSTANT                            ) ,\
+  HID_COLLECTION_END
+
+uint8_t const desc_hid_keyboard_report[] = { TUD_HID_REPORT_DESC_NKRO_KEYBOARD() };
+#else
+uint8_t const desc_hid_keyboard_report[] = { TUD_HID_REPORT_DESC_KEYBOARD() };
+#endif
+
+uint8_t const desc_hid_consumer_report[] = { TUD_HID_REPORT_DESC_CONSUMER() };
+
+uint8_t const desc_hid_mouse_report[] = { TUD_HID_REPORT_DESC_MOUSE() };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
 {
-    (void)instance;
-    return desc_hid_report;
+    switch (instance)
+    {
+    case HID_INSTANCE_CONSUMER:
+        return desc_hid_consumer_report;
+    case HID_INSTANCE_MOUSE:
+        return desc_hid_mouse_report;
+    default:
+        return desc_hid_keyboard_report;
+    }
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
+// Interface numbers match the HID_INSTANCE_* order
 enum
 {
-    ITF_NUM_HID,
+    ITF_NUM_KEYBOARD,
+    ITF_NUM_CONSUMER,
+    ITF_NUM_MOUSE,
     ITF_NUM_TOTAL
 };
 
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + 3 * TUD_HID_DESC_LEN)
 
-#define EPNUM_HID 0x81
+#define EPNUM_KEYBOARD 0x81
+#define EPNUM_CONSUMER 0x82
+#define EPNUM_MOUSE 0x83
 
 uint8_t const desc_configuration[] =
     {
@@ -103,7 +157,9 @@ uint8_t const desc_configuration[] =
         TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
         // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-        TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)};
+        TUD_HID_DESCRIPTOR(ITF_NUM_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report), EPNUM_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, BRIDGE_HID_INTERVAL_MS),
+        TUD_HID_DESCRIPTOR(ITF_NUM_CONSUMER, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_consumer_report), EPNUM_CONSUMER, CFG_TUD_HID_EP_BUFSIZE, BRIDGE_HID_INTERVAL_MS),
+        TUD_HID_DESCRIPTOR(ITF_NUM_MOUSE, 0, HID_ITF_PROTOCOL_MOUSE, sizeof(desc_hid_mouse_report), EPNUM_MOUSE, CFG_TUD_HID_EP_BUFSIZE, BRIDGE_HID_INTERVAL_MS)};
 
 #if TUD_OPT_HIGH_SPEED
 // Per USB specs: high speed capable device must report device_qualifier and other_speed_configuration
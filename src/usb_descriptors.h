@@ -30,4 +30,30 @@ enum
     REPORT_ID_KEYBOARD = 1
 };
 
+// HID interfaces, in TinyUSB instance order
+enum
+{
+    HID_INSTANCE_KEYBOARD = 0,
+    HID_INSTANCE_CONSUMER,
+    HID_INSTANCE_MOUSE,
+    HID_INSTANCE_COUNT
+};
+
+// Adds an N-key-rollover bitmap report, used whenever the host has not
+// switched the keyboard to the boot protocol
+#ifndef BRIDGE_NKRO
+#define BRIDGE_NKRO 0
+#endif
+
+// HID endpoint polling interval requested from the host
+#ifndef BRIDGE_HID_INTERVAL_MS
+#define BRIDGE_HID_INTERVAL_MS 5
+#endif
+
+// Keyboard usages 0..HID_NKRO_KEYS-1 are covered by the bitmap
+#define HID_NKRO_KEYS 160
+
+// NKRO report: modifier byte followed by the key bitmap
+#define HID_NKRO_REPORT_LEN (1 + HID_NKRO_KEYS / 8)
+
 #endif /* USB_DESCRIPTORS_H_ */